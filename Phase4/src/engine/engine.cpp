@@ -1,5 +1,7 @@
 #include <array>
 #include <cmath>
+#include <chrono>
+#include <thread>
 
 #include <GL/glew.h>
 #include <IL/il.h>
@@ -13,6 +15,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "../engine/Parsing.h"
+#include "../engine/AssetLoader.h"
+#include "../engine/Hud.h"
+#include "../engine/Headless.h"
 
 World world;
 
@@ -839,36 +844,13 @@ namespace render {
 		}
 
 		void show() {
-			glPushAttrib(GL_CURRENT_BIT | GL_LIGHTING_BIT);
-			glDisable(GL_LIGHTING);
-			glBegin(GL_LINES);
-
-			glColor3f(1.0f, 0.0f, 0.0f);  // Red (X+)
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(1000.0f, 0.0f, 0.0f);
-
-			glColor3f(0.2f, 0.0f, 0.0f);  // Red (X-)
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(-1000.0f, 0.0f, 0.0f);
-
-			glColor3f(0.0f, 1.0f, 0.0f);  // Green (Y+)
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(0.0f, 1000.0f, 0.0f);
-
-			glColor3f(0.0f, 0.2f, 0.0f);  // Green (Y-)
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(0.0f, -1000.0f, 0.0f);
-
-			glColor3f(0.0f, 0.0f, 1.0f);  // Blue (Z+)
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(0.0f, 0.0f, 1000.0f);
-
-			glColor3f(0.0f, 0.0f, 0.2f);  // Blue (Z-)
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(0.0f, 0.0f, -1000.0f);
-
-			glEnd();
-			glPopAttrib();
+			const glm::vec3 origin = glm::vec3(0.0f);
+			DebugDraw::frame.line(origin, {  1000.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }); // Red (X+)
+			DebugDraw::frame.line(origin, { -1000.0f, 0.0f, 0.0f }, { 0.2f, 0.0f, 0.0f }); // Red (X-)
+			DebugDraw::frame.line(origin, { 0.0f,  1000.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }); // Green (Y+)
+			DebugDraw::frame.line(origin, { 0.0f, -1000.0f, 0.0f }, { 0.0f, 0.2f, 0.0f }); // Green (Y-)
+			DebugDraw::frame.line(origin, { 0.0f, 0.0f,  1000.0f }, { 0.0f, 0.0f, 1.0f }); // Blue (Z+)
+			DebugDraw::frame.line(origin, { 0.0f, 0.0f, -1000.0f }, { 0.0f, 0.0f, 0.2f }); // Blue (Z-)
 
 			AnimatedTranslation::showPath = true;
 		}
@@ -884,16 +866,16 @@ namespace render {
 
 			switch (current) {
 			case 0:
-				glDisable(GL_CULL_FACE);
+				GLState::disable(GL_CULL_FACE);
 				break;
 
 			case 1:
-				glEnable(GL_CULL_FACE);
+				GLState::enable(GL_CULL_FACE);
 				glCullFace(GL_BACK);
 				break;
 
 			case 2:
-				glEnable(GL_CULL_FACE);
+				GLState::enable(GL_CULL_FACE);
 				glCullFace(GL_FRONT);
 				break;
 			}
@@ -917,7 +899,7 @@ namespace render {
 
 		void toggle() {
 			enabled = !enabled;
-			if (enabled) glEnable(GL_LIGHTING); else glDisable(GL_LIGHTING);
+			if (enabled) GLState::enable(GL_LIGHTING); else GLState::disable(GL_LIGHTING);
 		}
 	}
 	
@@ -931,7 +913,8 @@ namespace render {
 
 		void update() {
 			lastTime = currentTime;
-			currentTime = glutGet(GLUT_ELAPSED_TIME);
+			// headless runs step a fixed time per frame, the same on every machine
+			currentTime = Headless::enabled ? currentTime + Headless::frameStepMs : glutGet(GLUT_ELAPSED_TIME);
 			deltaTime = (currentTime - lastTime) / 1000.0f;
 			hudString = std::format("Elapsed: {:.1f}s", currentTime / 1000.0f);
 		}
@@ -945,8 +928,17 @@ namespace render {
 
 		std::string hudString = "Frames/s: 0";
 
+		// every frame, from the previous one's start
+		FrameTimes frameTimes;
+		std::chrono::steady_clock::time_point lastFrame;
+
 		void update(float currentTime, float samplingPeriod = 100.0f) {
 
+			auto now = std::chrono::steady_clock::now();
+			if (lastFrame.time_since_epoch().count() != 0)
+				frameTimes.record(std::chrono::duration<float, std::milli>(now - lastFrame).count());
+			lastFrame = now;
+
 			frameCount++;
 			if (currentTime - lastSampleTime > samplingPeriod) {
 				fps = frameCount * 1000.0f / (currentTime - lastSampleTime);
@@ -960,62 +952,114 @@ namespace render {
 	
 	namespace hud {
 
-		void show() {
+		// one per line on screen, rebuilt only when their text changes
+		std::vector<HudText::Line> lines;
 
-			const double windowWidth = glutGet(GLUT_WINDOW_WIDTH);
-			const double windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
+		// formatted again only after a key press
+		std::vector<std::string> settings;
+		bool settingsChanged = true;
 
-			glPushAttrib(GL_CURRENT_BIT | GL_LIGHTING_BIT | GL_DEPTH_BUFFER_BIT);
-			glDisable(GL_LIGHTING);
-			glDisable(GL_DEPTH_TEST);
-			
-			glMatrixMode(GL_PROJECTION); glPushMatrix();
-			glLoadIdentity();
-			gluOrtho2D(0, windowWidth, 0, windowHeight);
+		DebugDraw::Batch frameGraph;
 
-			glMatrixMode(GL_MODELVIEW); glPushMatrix();
-			glLoadIdentity();
-			
+		std::vector<std::string> statistics() {
 
-			const std::vector<std::string> stats = {
+			std::vector<std::string> stats = {
 				framesPerSecond::hudString,
 				clock::hudString
 			};
 
-			const std::vector<std::string> settings = {
+			stats.push_back(std::format("Triangles: {}", Model::trianglesDrawn));
+			stats.push_back(std::format("Objects: {} drawn, {} culled", Group::objectsDrawn, Group::objectsCulled));
+			stats.push_back(std::format("Transforms: {} of {} nodes updated", SceneGraph::nodesUpdated, world.scene.size()));
+			stats.push_back(std::format("Draw calls: {} ({} instances in {} batches)",
+				Model::drawCalls, InstanceBatcher::instancesDrawn, InstanceBatcher::batches));
+			stats.push_back(std::format("State changes: {} ({} in scene order, {} untracked)",
+				RenderQueue::stateChanges, RenderQueue::sceneOrderChanges, RenderQueue::untrackedChanges));
+			stats.push_back(std::format("GL state calls: {} issued, {} elided", GLState::issued, GLState::elided));
+			if (StaticBatching::batchCount > 0)
+				stats.push_back(std::format("Static batches: {} ({} references merged)", StaticBatching::batchCount, StaticBatching::referencesMerged));
+			if (OcclusionCulling::enabled && !GpuCulling::active())
+				stats.push_back(std::format("Occlusion: {} objects occluded by {} occluders ({:.2f} ms raster, {:.2f} ms test)",
+					OcclusionCulling::objectsOccluded, OcclusionCulling::occludersDrawn, OcclusionCulling::rasterMs, OcclusionCulling::testMs));
+			if (CoreRenderer::active() && !CoreRenderer::clusteredLights.empty())
+				stats.push_back(std::format("Clustered lights: {} (up to {} per cluster, {:.2f} ms binning)",
+					CoreRenderer::clusteredLights.size(), CoreRenderer::clusters.maxPerCluster, CoreRenderer::clusters.buildMs));
+
+			if (DebugDraw::drawCalls > 0)
+				stats.push_back(std::format("Debug draw calls: {}", DebugDraw::drawCalls));
+
+			if (!AssetLoader::finished)
+				stats.push_back(AssetLoader::hudString());
+
+			stats.push_back(framesPerSecond::frameTimes.hudString());
+			return stats;
+		}
+
+		void show() {
+
+			if (!HudText::ready()) return;
+
+			std::vector<std::string> stats = statistics();
+
+			if (settingsChanged) settings = {
 				std::format("[1] Polygons: {}",  polygonMode::str[polygonMode::current]),
 				std::format("[2] Axes: {}",      (axes::enabled) ? "On" : "Off"),
 				std::format("[3] Face Cull: {}", faceCull::str[faceCull::current]),
 				std::format("[4] Lighting: {}",  (lighting::enabled) ? "On" : "Off"),
 				std::format("[5] Filtering: {}", textureFilter::str[textureFilter::current]),
-				std::format("[0] Fullscreen")
+				std::format("[6] LOD: {}",       (Model::lodEnabled) ? "On" : "Off"),
+				std::format("[7] Culling: {}",   (Group::cullingEnabled) ? "On" : "Off"),
+				std::format("[8] Instancing: {}", InstanceBatcher::modeName()),
+				std::format("[9] Draw sorting: {}", (RenderQueue::sorting) ? "On" : "Off"),
+				std::format("[0] Fullscreen"),
+				std::format("[G] GPU culling: {}", !GpuCulling::supported ? "Unsupported" : (GpuCulling::enabled) ? "On" : "Off"),
+				std::format("[O] Occlusion culling: {}", (OcclusionCulling::enabled) ? "On" : "Off"),
+				std::format("[P] Pipeline: {}", !CoreRenderer::supported ? "Fixed function (programmable unsupported)" : (CoreRenderer::enabled) ? "Programmable" : "Fixed function")
 			};
 
-			float y = windowHeight - 20.0f;
+			settingsChanged = false;
+
+			const int windowWidth = WindowState::currentWidth;
+			const int windowHeight = WindowState::currentHeight;
+
+			lines.resize(stats.size() + settings.size());
+			HudText::drawCalls = HudText::rebuilds = 0;
+			HudText::begin(windowWidth, windowHeight);
+
+			int y = windowHeight - 20;
+			size_t i = 0;
 
 			glColor3f(1.0f, 1.0f, 1.0f);
-			for (const auto& line : stats) {
-				glRasterPos2f(10, y);
-				for (char c : line) {
-					glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
-				}
-				y -= 15.0f;
+			for (const auto& text : stats) {
+				lines[i].set(text);
+				lines[i++].draw(10, y);
+				y -= 15;
 			}
-			y -= 10.0f;
+			y -= 10;
 
 			glColor3f(1.0f, 1.0f, 0.0f);
-			for (const auto& line : settings) {
-				glRasterPos2f(10, y);
-				for (char c : line) {
-					glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
-				}
-				y -= 15.0f;
+			for (const auto& text : settings) {
+				lines[i].set(text);
+				lines[i++].draw(10, y);
+				y -= 15;
 			}
 
-			glMatrixMode(GL_PROJECTION); glPopMatrix();
-			glMatrixMode(GL_MODELVIEW); glPopMatrix();
+			// frame time graph in the bottom left corner
+			const float graphWidth = static_cast<float>(FrameTimes::SAMPLES), graphHeight = 60.0f;
+			frameGraph.clear();
+			framesPerSecond::frameTimes.graph(frameGraph, 10.0f, 10.0f, graphWidth, graphHeight);
+			frameGraph.upload(GL_STREAM_DRAW);
+			glLoadIdentity();
+			frameGraph.draw();
+
+			HudText::end();
+		}
 
-			glPopAttrib();
+		void cleanup() {
+			for (auto& line : lines)
+				line.destroy();
+			frameGraph.destroy();
+			HudText::cleanup();
 		}
 	};
 
@@ -1023,6 +1067,9 @@ namespace render {
 		clock::update();
 		keybinds::update(clock::deltaTime);
 		framesPerSecond::update(clock::currentTime, 100.0f);
+		AssetLoader::pump();
+		if (AssetLoader::finished) world.bakeStaticBatches();
+		if (!HudText::ready() && !Headless::enabled) HudText::buildAtlas(GLUT_BITMAP_HELVETICA_12);
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glLoadIdentity();
@@ -1032,7 +1079,13 @@ namespace render {
 		LightCaster::applyAll();
 
 		glColor3f(1.0f, 1.0f, 1.0f);
+		Model::trianglesDrawn = 0;
+		Group::objectsDrawn = Group::objectsCulled = 0;
+		Model::drawCalls = InstanceBatcher::batches = InstanceBatcher::instancesDrawn = 0;
+		DebugDraw::drawCalls = 0;
+		GLState::issued = GLState::elided = 0;
 		world.renderGroups(clock::deltaTime);
+		DebugDraw::flush(CameraController::viewMatrix());
 		//glTranslatef(10.0f, 0, 0);
 		//debugPatch.draw(20);
 
@@ -1046,7 +1099,35 @@ namespace render {
 		//glPopMatrix();
 
 		hud::show();
-		glutSwapBuffers();
+		if (!Headless::enabled) glutSwapBuffers();
+		else glFinish(); // so the frame times include the rendering
+	}
+
+	// every asset is in before the first frame, so each run draws the same frames
+	int runHeadless() {
+
+		while (!AssetLoader::finished) {
+			AssetLoader::pump();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		bool saved = true;
+		auto start = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < Headless::frames; frame++) {
+			renderScene();
+			saved = Headless::saveFrame(frame) && saved;
+		}
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << std::format("Headless: {} frames of {}x{} in {:.2f} s ({:.1f} frames/s)",
+			Headless::frames, WindowState::currentWidth, WindowState::currentHeight, seconds, Headless::frames / seconds) << std::endl;
+
+		// the frames per second line counts simulated time, the line above has the real rate
+		std::vector<std::string> stats = hud::statistics();
+		for (size_t i = 1; i < stats.size(); i++)
+			std::cout << stats[i] << std::endl;
+
+		return saved ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 };
 
@@ -1056,9 +1137,12 @@ namespace keybinds {
 	std::unordered_set<int> specialKeysPressed;
 
 	std::unordered_set<unsigned char> toggleKeys = {
-		'1','2','3','4','5','0',
+		'1','2','3','4','5','6','7','8','9','0',
 		
 		'c','C',
+		'g','G',
+		'o','O',
+		'p','P',
 	};
 
 	void keyboardSpecialUp(int key_code, int x, int y) {
@@ -1076,6 +1160,7 @@ namespace keybinds {
 	void keyboard(unsigned char key, int x, int y) {
 		if (!toggleKeys.contains(key))
 			keysPressed.insert(key);
+		render::hud::settingsChanged = true;
 
 		switch (key) {
 		
@@ -1097,6 +1182,18 @@ namespace keybinds {
 		case '5':
 			render::textureFilter::next();
 			break;
+		case '6':
+			Model::toggleLod();
+			break;
+		case '7':
+			Group::toggleCulling();
+			break;
+		case '8':
+			InstanceBatcher::toggle();
+			break;
+		case '9':
+			RenderQueue::toggleSorting();
+			break;
 		case '0':
 			WindowState::toggleFullscreen();
 			break;
@@ -1104,6 +1201,18 @@ namespace keybinds {
 		case 'C':
 			CameraController::toggleMode();
 			break;
+		case 'g':
+		case 'G':
+			GpuCulling::toggle();
+			break;
+		case 'o':
+		case 'O':
+			OcclusionCulling::toggle();
+			break;
+		case 'p':
+		case 'P':
+			CoreRenderer::toggle();
+			break;
 		}
 	}
 
@@ -1117,43 +1226,140 @@ namespace keybinds {
 	}
 };
 
-int main(int argc, char** argv) {	
+static int run(int argc, char** argv) {
+
+	// the value after the flag at argv[i], which is skipped over
+	auto flagValue = [&](int& i) {
+		if (i + 1 >= argc)
+			throw std::runtime_error(std::format("Missing value for {}", argv[i]));
+		return argv[++i];
+	};
+
+	auto errorBound = [&](int& i) {
+		const char* flag = argv[i];
+		const char* value = flagValue(i);
+		char* end;
+		float bound = std::strtof(value, &end);
+		if (end == value || *end != '\0' || !(bound > 0.0f))
+			throw std::runtime_error(std::format("Invalid {} '{}', expected a positive number", flag, value));
+		return bound;
+	};
+
+	auto frameCount = [&](int& i) {
+		const char* flag = argv[i];
+		const char* value = flagValue(i);
+		const char* end = value + std::strlen(value);
+		int frames = 0;
+		auto [next, ec] = std::from_chars(value, end, frames);
+		if (ec != std::errc() || next != end || frames < 1)
+			throw std::runtime_error(std::format("Invalid {} '{}', expected a positive whole number", flag, value));
+		return frames;
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--no-optimize") == 0)
+			ModelStorage::optimizeOnLoad = false;
+		else if (std::strcmp(argv[i], "--no-quantize") == 0)
+			VertexQuantization::enabled = false;
+		else if (std::strcmp(argv[i], "--max-position-error") == 0)
+			VertexQuantization::maxPositionError = errorBound(i);
+		else if (std::strcmp(argv[i], "--max-normal-error") == 0) // in degrees
+			VertexQuantization::maxNormalError = glm::radians(errorBound(i));
+		else if (std::strcmp(argv[i], "--max-texcoord-error") == 0)
+			VertexQuantization::maxTexcoordError = errorBound(i);
+		else if (std::strcmp(argv[i], "--no-lod") == 0)
+			ModelStorage::lodsOnLoad = false;
+		else if (std::strcmp(argv[i], "--quiet") == 0)
+			configParser::quiet = true;
+		else if (std::strcmp(argv[i], "--no-scene-cache") == 0)
+			configParser::useCompiledScenes = false;
+		else if (std::strcmp(argv[i], "--gpu-culling") == 0)
+			GpuCulling::enabled = true;
+		else if (std::strcmp(argv[i], "--no-occlusion") == 0)
+			OcclusionCulling::enabled = false;
+		else if (std::strcmp(argv[i], "--no-static-batching") == 0)
+			StaticBatching::enabled = false;
+		else if (std::strcmp(argv[i], "--programmable") == 0)
+			CoreRenderer::enabled = true;
+		else if (std::strcmp(argv[i], "--headless") == 0)
+			Headless::enabled = true;
+		else if (std::strcmp(argv[i], "--frames") == 0)
+			Headless::frames = frameCount(i);
+		else if (std::strcmp(argv[i], "--size") == 0)
+			Headless::parseSize(flagValue(i));
+		else if (std::strcmp(argv[i], "--save-frames") == 0)
+			Headless::parseFramePattern(flagValue(i));
+	}
+
+	// offline steps for automated runs, no window needed; the scene file is the next argument
+	for (int i = 1; i < argc; i++) {
+		bool compile = std::strcmp(argv[i], "--compile-scene") == 0;
+		bool verify = std::strcmp(argv[i], "--verify-scene") == 0;
+		if (!compile && !verify) continue;
+
+		std::string configFilename = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[i + 1] : "config.xml";
+		bool succeeded = compile
+			? configParser::compileScene(configFilename)
+			: configParser::verifyCompiledScene(configFilename);
+		return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
 	world = configParser::loadWorld("config.xml");
 	
-	glutInit(&argc, argv);
+	if (Headless::enabled) {
+		// no window: an offscreen context, drawn into a framebuffer object
+		Headless::createContext();
+		atexit(Headless::cleanup);
+	}
+	else {
+		glutInit(&argc, argv);
 
-	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
+		glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
 	
-	glutInitWindowPosition(100, 100);
-	glutInitWindowSize(WindowState::initialWidth, WindowState::initialHeight);
-	glutCreateWindow("Engine");
-	glutReshapeFunc(WindowState::changeSize);
+		glutInitWindowPosition(100, 100);
+		glutInitWindowSize(WindowState::initialWidth, WindowState::initialHeight);
+		glutCreateWindow("Engine");
+		glutReshapeFunc(WindowState::changeSize);
+	}
 
 	// Initialize GLEW
+	// (with no X display GLEW fails on GLX after it has loaded the GL entry points)
 	GLenum err = glewInit();
-	if (GLEW_OK != err) {
+	if (GLEW_OK != err && !(Headless::enabled && GLEW_VERSION_1_1)) {
 		fprintf(stderr, "Error: %s\n", glewGetErrorString(err));
 		return 1;
 	}
 
-	configParser::importModels();
-	configParser::importTextures();
-
-	Texture::print();
+	// vertex formats depend on what the GL accepts in fixed function arrays
+	VertexQuantization::detectSupport();
+	InstanceBatcher::detectSupport();
+	GpuCulling::detectSupport();
+	CoreRenderer::detectSupport();
+	GLState::detectSupport();
+
+	if (Headless::enabled)
+		Headless::createTarget();
+
+	// assets stream in while the first frames are already being drawn
+	AssetLoader::start(
+		configParser::requestedModels,
+		configParser::requestedTextures
+	);
 	
-	atexit([]() { ModelStorage::cleanupBuffers(); });
+	atexit([]() { AssetLoader::stop(); InstanceBatcher::cleanup(); GpuCulling::cleanup(); CoreRenderer::cleanup(); DebugDraw::cleanup(); render::hud::cleanup(); ModelStorage::cleanupBuffers(); });
 
-	glutIdleFunc(render::renderScene);
-	glutDisplayFunc(render::renderScene);
+	if (!Headless::enabled) {
+		glutIdleFunc(render::renderScene);
+		glutDisplayFunc(render::renderScene);
 
-	glutKeyboardFunc(keybinds::keyboard);
-	glutKeyboardUpFunc(keybinds::keyboardUp);
-	glutSpecialFunc(keybinds::keyboardSpecial);
-	glutSpecialUpFunc(keybinds::keyboardSpecialUp);
+		glutKeyboardFunc(keybinds::keyboard);
+		glutKeyboardUpFunc(keybinds::keyboardUp);
+		glutSpecialFunc(keybinds::keyboardSpecial);
+		glutSpecialUpFunc(keybinds::keyboardSpecialUp);
+	}
 
-	glEnable(GL_RESCALE_NORMAL);
-	glEnable(GL_DEPTH_TEST);
+	GLState::enable(GL_RESCALE_NORMAL);
+	GLState::enable(GL_DEPTH_TEST);
 	
 	// render settings initialisation
 	render::faceCull::next();
@@ -1161,7 +1367,21 @@ int main(int argc, char** argv) {
 
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
+	if (Headless::enabled)
+		return render::runHeadless();
+
 	glutMainLoop();
 
 	return 1;
+}
+
+// bad flags and a context that can't be made end the run with a message
+int main(int argc, char** argv) {
+	try {
+		return run(argc, argv);
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
 }
\ No newline at end of file
@@ -57,6 +57,17 @@ void generateDefaultModels() {
 }
 
 int main(int argc, char** argv) {
+    // flags may appear anywhere, the remaining arguments are positional
+    std::vector<char*> args;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "--no-optimize") == 0)
+            fileManagement::optimizeMeshes = false;
+        else
+            args.push_back(argv[i]);
+    }
+    argc = static_cast<int>(args.size());
+    argv = args.data();
+
     if (argc == 1) {
         generateDefaultModels();
         return 0;
@@ -71,7 +82,10 @@ int main(int argc, char** argv) {
             << "  sphere <float:radius> <int:slices> <int:stacks> <string:output_filename>\n"
             << "  cone <float:radius> <float:height> <int:slices> <int:stacks> <string:output_filename>\n"
             << "  tube <float:inner_radius> <float:outer_radius> <float:height> <int:slices> <string:output_filename>\n"
-            << "  bezier <string:patch_filename> <int:tessellation>\n";
+            << "  bezier <string:patch_filename> <int:tessellation>\n"
+            << "  lod <string:input_filename> <int:levels> <string:output_prefix>\n"
+            << "Options:\n"
+            << "  --no-optimize   keep triangles in generation order (skip vertex cache/overdraw optimisation)\n";
         return 1;
     }
 
@@ -190,6 +204,26 @@ int main(int argc, char** argv) {
         );
     }
 
+    else if (strcmp(shape, "lod") == 0) {
+        if (argc < 5) {
+            std::cerr << "lod <string:input_filename> <int:levels> <string:output_prefix>";
+            return 1;
+        }
+
+        const std::string inputFilename = argv[2];
+        const int levels = atoi(argv[3]);
+        const std::string outputPrefix = argv[4];
+
+        ModelData model = fileManagement::importOBJ(inputFilename);
+        auto lods = levelsOfDetail::build(model, levels);
+
+        for (size_t i = 0; i < lods.size(); i++) {
+            std::string lodFilename = std::format("{}_lod{}.3d", outputPrefix, i + 1);
+            fileManagement::exportOBJ(lods[i].first, lodFilename);
+            std::cout << std::format("{}: {} triangles, error {:.5f}\n", lodFilename, lods[i].first.vIndices.size() / 3, lods[i].second);
+        }
+    }
+
     else {
         std::cerr << "Invalid shape specified!\n";
         return 1;
@@ -0,0 +1,402 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+#include <string>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+#include <format>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+////////////////////////////////////////////////////////////
+// Triangle and vertex reordering for GPU efficiency
+//
+// 1. Tipsify (Sander, Nehab & Barczak 2007) orders triangles
+//    so vertices are reused while in the post-transform cache
+// 2. its output is cut into clusters, and clusters facing
+//    away from the mesh centre are drawn first (less overdraw)
+// 3. attribute arrays are renumbered in order of first use
+//
+// Works on any mesh with OBJ-style index triples
+// (vertices/normals/texcoords + vIndices/vnIndices/vtIndices),
+// i.e. both the generator's ModelData and the engine's Model.
+////////////////////////////////////////////////////////////
+
+namespace meshOptimizer {
+
+	const unsigned int CACHE_SIZE = 16;
+	const float OVERDRAW_THRESHOLD = 1.05f; // max ACMR loss accepted when cutting clusters
+
+	struct CacheStats {
+		float acmr = 0.0f; // average cache miss ratio (transforms per triangle)
+		float atvr = 0.0f; // average transform to vertex ratio (1.0 is ideal)
+	};
+
+	// FIFO post-transform cache simulation
+	CacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = CACHE_SIZE) {
+
+		std::vector<unsigned int> timestamps(vertexCount, 0);
+		std::vector<bool> referenced(vertexCount, false);
+		unsigned int time = cacheSize + 1;
+		size_t misses = 0, unique = 0;
+
+		for (unsigned int v : indices) {
+			if (time - timestamps[v] > cacheSize) {
+				timestamps[v] = time++;
+				misses++;
+			}
+			if (!referenced[v]) {
+				referenced[v] = true;
+				unique++;
+			}
+		}
+
+		CacheStats stats;
+		if (indices.size() >= 3) stats.acmr = float(misses) / (indices.size() / 3);
+		if (unique > 0) stats.atvr = float(misses) / unique;
+		return stats;
+	}
+
+	// Returns the new triangle order plus the positions in it where the walk hit
+	// a dead end and had to jump elsewhere in the mesh (hard cluster boundaries)
+	std::pair<std::vector<unsigned int>, std::vector<size_t>> tipsify(
+		const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = CACHE_SIZE) {
+
+		const size_t triCount = indices.size() / 3;
+
+		// vertex -> triangles adjacency
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (unsigned int v : indices) offsets[v + 1]++;
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+		std::vector<unsigned int> adjacency(indices.size());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triCount; t++)
+			for (size_t c = 0; c < 3; c++)
+				adjacency[fill[indices[3 * t + c]]++] = static_cast<unsigned int>(t);
+
+		std::vector<unsigned int> live(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++) live[v] = offsets[v + 1] - offsets[v];
+
+		std::vector<unsigned int> timestamps(vertexCount, 0);
+		std::vector<bool> emitted(triCount, false);
+		std::vector<unsigned int> deadEnd, candidates;
+		deadEnd.reserve(indices.size());
+
+		std::vector<unsigned int> order;
+		order.reserve(triCount);
+		std::vector<size_t> boundaries = { 0 };
+
+		unsigned int time = cacheSize + 1;
+		size_t cursor = 0;
+
+		auto skipDeadEnd = [&]() -> long long {
+			while (!deadEnd.empty()) {
+				unsigned int d = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[d] > 0) return d;
+			}
+			for (; cursor < vertexCount; cursor++)
+				if (live[cursor] > 0) return static_cast<long long>(cursor);
+			return -1;
+		};
+
+		long long fanning = skipDeadEnd();
+
+		while (fanning >= 0) {
+
+			candidates.clear();
+
+			// emit every remaining triangle around the fanning vertex
+			for (unsigned int i = offsets[fanning]; i < offsets[fanning + 1]; i++) {
+				unsigned int t = adjacency[i];
+				if (emitted[t]) continue;
+
+				for (size_t c = 0; c < 3; c++) {
+					unsigned int v = indices[3 * t + c];
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					if (time - timestamps[v] > cacheSize) timestamps[v] = time++;
+				}
+
+				emitted[t] = true;
+				order.push_back(t);
+			}
+
+			// next fanning vertex: the oldest candidate that stays cached
+			// while its remaining triangles are emitted
+			long long next = -1;
+			long long best = -1;
+			for (unsigned int v : candidates) {
+				if (live[v] == 0) continue;
+
+				long long priority = 0;
+				if (time - timestamps[v] + 2 * live[v] <= cacheSize) priority = time - timestamps[v];
+				if (priority > best) {
+					best = priority;
+					next = v;
+				}
+			}
+
+			if (next < 0) {
+				next = skipDeadEnd();
+				if (next >= 0) boundaries.push_back(order.size());
+			}
+
+			fanning = next;
+		}
+
+		return { order, boundaries };
+	}
+
+	// Cuts hard clusters further wherever the running ACMR is already within
+	// threshold of the whole cluster's, so clusters stay small enough to sort
+	std::vector<size_t> softBoundaries(
+		const std::vector<unsigned int>& indices, size_t vertexCount,
+		const std::vector<unsigned int>& order, const std::vector<size_t>& hardBoundaries,
+		float threshold = OVERDRAW_THRESHOLD, unsigned int cacheSize = CACHE_SIZE) {
+
+		std::vector<unsigned int> timestamps(vertexCount, 0);
+		unsigned int time = cacheSize + 1;
+
+		auto resetCache = [&]() { time += cacheSize + 1; };
+		auto misses = [&](unsigned int t) {
+			unsigned int count = 0;
+			for (size_t c = 0; c < 3; c++) {
+				unsigned int v = indices[3 * t + c];
+				if (time - timestamps[v] > cacheSize) {
+					timestamps[v] = time++;
+					count++;
+				}
+			}
+			return count;
+		};
+
+		std::vector<size_t> boundaries;
+
+		for (size_t h = 0; h < hardBoundaries.size(); h++) {
+
+			size_t start = hardBoundaries[h];
+			size_t end = (h + 1 < hardBoundaries.size()) ? hardBoundaries[h + 1] : order.size();
+			if (start >= end) continue;
+
+			resetCache();
+			size_t clusterMisses = 0;
+			for (size_t i = start; i < end; i++) clusterMisses += misses(order[i]);
+			float clusterThreshold = threshold * float(clusterMisses) / (end - start);
+
+			boundaries.push_back(start);
+
+			resetCache();
+			size_t runningMisses = 0, runningTris = 0;
+			for (size_t i = start; i < end; i++) {
+				runningMisses += misses(order[i]);
+				runningTris++;
+
+				if (float(runningMisses) / runningTris <= clusterThreshold && i + 1 < end) {
+					boundaries.push_back(i + 1);
+					resetCache();
+					runningMisses = runningTris = 0;
+				}
+			}
+		}
+
+		return boundaries;
+	}
+
+	// Sorts clusters so the ones facing away from the mesh centre (the likely
+	// occluders) are drawn first. Returns the final triangle order.
+	std::vector<unsigned int> sortClusters(
+		const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		const std::vector<unsigned int>& order, const std::vector<size_t>& boundaries) {
+
+		struct Cluster {
+			size_t start, end;
+			glm::vec3 centroid = glm::vec3(0.0f);
+			glm::vec3 normal = glm::vec3(0.0f);
+			float area = 0.0f;
+			float key = 0.0f;
+		};
+
+		std::vector<Cluster> clusters;
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+
+		for (size_t b = 0; b < boundaries.size(); b++) {
+
+			Cluster cluster;
+			cluster.start = boundaries[b];
+			cluster.end = (b + 1 < boundaries.size()) ? boundaries[b + 1] : order.size();
+
+			for (size_t i = cluster.start; i < cluster.end; i++) {
+				unsigned int t = order[i];
+				const glm::vec3& p0 = positions[indices[3 * t + 0]];
+				const glm::vec3& p1 = positions[indices[3 * t + 1]];
+				const glm::vec3& p2 = positions[indices[3 * t + 2]];
+
+				glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+				float area = 0.5f * glm::length(cross);
+
+				cluster.centroid += area * (p0 + p1 + p2) / 3.0f;
+				cluster.normal += cross;
+				cluster.area += area;
+			}
+
+			meshCentroid += cluster.centroid;
+			meshArea += cluster.area;
+			clusters.push_back(cluster);
+		}
+
+		if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+		for (auto& cluster : clusters) {
+			if (cluster.area <= 0.0f) continue;
+			glm::vec3 centroid = cluster.centroid / cluster.area;
+			float normalLength = glm::length(cluster.normal);
+			if (normalLength > 0.0f)
+				cluster.key = glm::dot(centroid - meshCentroid, cluster.normal / normalLength);
+		}
+
+		std::stable_sort(clusters.begin(), clusters.end(),
+			[](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+		std::vector<unsigned int> sorted;
+		sorted.reserve(order.size());
+		for (const auto& cluster : clusters)
+			sorted.insert(sorted.end(), order.begin() + cluster.start, order.begin() + cluster.end);
+
+		return sorted;
+	}
+
+	// One id per distinct (v, vn, vt) corner - the vertices the GPU will actually see -
+	// and, for every id, the first corner it was made from. A vn or vt index that is
+	// absent or out of range counts as missing.
+	template<typename Mesh>
+	std::pair<std::vector<unsigned int>, std::vector<size_t>> weldCornerIds(const Mesh& mesh) {
+
+		static constexpr unsigned int MISSING = ~0u;
+
+		struct Corner {
+			unsigned int v, vn, vt;
+			bool operator==(const Corner&) const = default;
+		};
+
+		struct CornerHash {
+			size_t operator()(const Corner& c) const {
+				uint64_t h = (uint64_t(c.v) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(c.vn) * 0xC2B2AE3D27D4EB4Full);
+				h ^= uint64_t(c.vt) * 0x165667B19E3779F9ull;
+				return static_cast<size_t>(h ^ (h >> 32));
+			}
+		};
+
+		std::unordered_map<Corner, unsigned int, CornerHash> welded;
+		welded.reserve(mesh.vIndices.size());
+
+		std::vector<unsigned int> corners;
+		corners.reserve(mesh.vIndices.size());
+		std::vector<size_t> firstCorners;
+
+		for (size_t i = 0; i < mesh.vIndices.size(); i++) {
+			Corner corner = {
+				mesh.vIndices[i],
+				(i < mesh.vnIndices.size() && mesh.vnIndices[i] < mesh.normals.size()) ? mesh.vnIndices[i] : MISSING,
+				(i < mesh.vtIndices.size() && mesh.vtIndices[i] < mesh.texcoords.size()) ? mesh.vtIndices[i] : MISSING
+			};
+
+			auto [it, inserted] = welded.try_emplace(corner, static_cast<unsigned int>(welded.size()));
+			if (inserted) firstCorners.push_back(i);
+			corners.push_back(it->second);
+		}
+
+		return { corners, firstCorners };
+	}
+
+	// The welded ids with the position of each
+	template<typename Mesh>
+	std::pair<std::vector<unsigned int>, std::vector<glm::vec3>> weldCorners(const Mesh& mesh) {
+
+		auto [corners, firstCorners] = weldCornerIds(mesh);
+
+		std::vector<glm::vec3> positions;
+		positions.reserve(firstCorners.size());
+		for (size_t first : firstCorners)
+			positions.push_back(mesh.vertices[mesh.vIndices[first]]);
+
+		return { corners, positions };
+	}
+
+	template<typename T>
+	void permuteTriangles(std::vector<T>& indices, const std::vector<unsigned int>& order) {
+		if (indices.size() != order.size() * 3) return;
+
+		std::vector<T> permuted(indices.size());
+		for (size_t i = 0; i < order.size(); i++)
+			for (size_t c = 0; c < 3; c++)
+				permuted[3 * i + c] = indices[3 * order[i] + c];
+
+		indices = std::move(permuted);
+	}
+
+	// Renumbers an attribute array in order of first use by the indices
+	template<typename T>
+	void reorderForFetch(std::vector<T>& attribs, std::vector<unsigned int>& indices) {
+		for (unsigned int i : indices)
+			if (i >= attribs.size()) return; // leave dangling references alone
+
+		const unsigned int UNSEEN = ~0u;
+		std::vector<unsigned int> remap(attribs.size(), UNSEEN);
+		unsigned int next = 0;
+
+		for (unsigned int i : indices)
+			if (remap[i] == UNSEEN) remap[i] = next++;
+		for (auto& r : remap)
+			if (r == UNSEEN) r = next++; // unreferenced entries go last
+
+		std::vector<T> reordered(attribs.size());
+		for (size_t i = 0; i < attribs.size(); i++)
+			reordered[remap[i]] = attribs[i];
+
+		for (auto& i : indices) i = remap[i];
+		attribs = std::move(reordered);
+	}
+
+	template<typename Mesh>
+	void optimize(Mesh& mesh, const std::string& name) {
+
+		if (mesh.vIndices.size() < 3 || mesh.vIndices.size() % 3 != 0) return;
+
+		auto [corners, positions] = weldCorners(mesh);
+		CacheStats before = analyzeVertexCache(corners, positions.size());
+
+		auto [order, hardBoundaries] = tipsify(corners, positions.size());
+		auto boundaries = softBoundaries(corners, positions.size(), order, hardBoundaries);
+		order = sortClusters(corners, positions, order, boundaries);
+
+		permuteTriangles(mesh.vIndices, order);
+		permuteTriangles(mesh.vnIndices, order);
+		permuteTriangles(mesh.vtIndices, order);
+
+		reorderForFetch(mesh.vertices, mesh.vIndices);
+		reorderForFetch(mesh.normals, mesh.vnIndices);
+		reorderForFetch(mesh.texcoords, mesh.vtIndices);
+
+		auto [cornersAfter, positionsAfter] = weldCorners(mesh);
+		CacheStats after = analyzeVertexCache(cornersAfter, positionsAfter.size());
+
+		std::cout
+			<< std::format(
+				"Optimised {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f} ({} clusters)",
+				name,
+				before.acmr, after.acmr,
+				before.atvr, after.atvr,
+				boundaries.size())
+			<< std::endl;
+	}
+};
+
+#endif
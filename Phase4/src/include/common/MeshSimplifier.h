@@ -0,0 +1,256 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <vector>
+#include <queue>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+////////////////////////////////////////////////////////////
+// Quadric error metric simplification (Garland & Heckbert 1997)
+//
+// Works on welded index buffers and only collapses vertices
+// onto existing ones, so every level of detail reuses the
+// original vertex buffer with its own index list.
+// Border vertices (mesh edges and attribute seams, which weld
+// into separate vertices) are locked so seams never open.
+// Errors are distances in model units.
+////////////////////////////////////////////////////////////
+
+namespace meshSimplifier {
+
+	// symmetric 4x4 matrix, area weighted sum of squared distances to a set of planes
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		static Quadric plane(const glm::dvec3& n, double d, double area) {
+			return { area * n.x * n.x, area * n.x * n.y, area * n.x * n.z, area * n.x * d,
+			         area * n.y * n.y, area * n.y * n.z, area * n.y * d,
+			         area * n.z * n.z, area * n.z * d,
+			         area * d * d,
+			         area };
+		}
+
+		Quadric& operator+=(const Quadric& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			weight += q.weight;
+			return *this;
+		}
+
+		// mean squared distance from p to the planes
+		double error(const glm::dvec3& p) const {
+			if (weight <= 0.0) return 0.0;
+			double e = a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+			         + b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+			         + c2 * p.z * p.z + 2 * cd * p.z
+			         + d2;
+			return std::max(e, 0.0) / weight;
+		}
+	};
+
+	struct Level {
+		std::vector<unsigned int> indices;
+		float error = 0.0f; // RMS distance to the original surface, worst collapse
+	};
+
+	// Collapses edges until the index count reaches targetIndexCount or the next
+	// collapse would move the surface by more than maxError
+	Level simplify(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		size_t targetIndexCount, float maxError = std::numeric_limits<float>::max()) {
+
+		const size_t vertexCount = positions.size();
+		const size_t triCount = indices.size() / 3;
+
+		std::vector<unsigned int> tris(indices.begin(), indices.begin() + triCount * 3);
+		std::vector<bool> triRemoved(triCount, false);
+		size_t liveTris = triCount;
+
+		// vertex -> triangles (grows as vertices absorb their neighbours)
+		std::vector<std::vector<unsigned int>> vertexTris(vertexCount);
+		for (size_t t = 0; t < triCount; t++)
+			for (size_t c = 0; c < 3; c++)
+				vertexTris[tris[3 * t + c]].push_back(static_cast<unsigned int>(t));
+
+		// plane quadrics
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t t = 0; t < triCount; t++) {
+			glm::dvec3 p0 = glm::dvec3(positions[tris[3 * t + 0]]);
+			glm::dvec3 p1 = glm::dvec3(positions[tris[3 * t + 1]]);
+			glm::dvec3 p2 = glm::dvec3(positions[tris[3 * t + 2]]);
+
+			glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+			double length = glm::length(n);
+			if (length == 0.0) continue;
+			n /= length;
+
+
+			Quadric q = Quadric::plane(n, -glm::dot(n, p0), 0.5 * length);
+			for (size_t c = 0; c < 3; c++) quadrics[tris[3 * t + c]] += q;
+		}
+
+		// lock vertices on edges used by a single triangle
+		std::vector<bool> locked(vertexCount, false);
+		{
+			std::unordered_map<uint64_t, unsigned int> edgeUse;
+			edgeUse.reserve(triCount * 3);
+			auto key = [](unsigned int a, unsigned int b) {
+				return (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+			};
+
+			for (size_t t = 0; t < triCount; t++)
+				for (size_t c = 0; c < 3; c++)
+					edgeUse[key(tris[3 * t + c], tris[3 * t + (c + 1) % 3])]++;
+
+			for (const auto& [edge, uses] : edgeUse) {
+				if (uses != 1) continue;
+				locked[edge >> 32] = true;
+				locked[edge & 0xFFFFFFFFu] = true;
+			}
+		}
+
+		struct Collapse {
+			double cost;
+			unsigned int from, to;
+			unsigned int fromStamp, toStamp;
+			bool operator>(const Collapse& o) const { return cost > o.cost; }
+		};
+
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+		std::vector<unsigned int> stamps(vertexCount, 0);
+		std::vector<bool> removed(vertexCount, false);
+
+		auto pushCollapse = [&](unsigned int from, unsigned int to) {
+			if (locked[from] || from == to) return;
+			Quadric q = quadrics[from];
+			q += quadrics[to];
+			heap.push({ q.error(glm::dvec3(positions[to])), from, to, stamps[from], stamps[to] });
+		};
+
+		for (size_t t = 0; t < triCount; t++)
+			for (size_t c = 0; c < 3; c++) {
+				unsigned int a = tris[3 * t + c], b = tris[3 * t + (c + 1) % 3];
+				pushCollapse(a, b);
+				pushCollapse(b, a);
+			}
+
+		// moving `from` onto `to` must not flip or collapse the triangles that survive
+		auto collapseIsValid = [&](unsigned int from, unsigned int to) {
+			const glm::vec3& target = positions[to];
+			for (unsigned int t : vertexTris[from]) {
+				if (triRemoved[t]) continue;
+
+				unsigned int* tri = &tris[3 * t];
+				if (tri[0] == to || tri[1] == to || tri[2] == to) continue;
+
+				glm::vec3 p[3], q[3];
+				for (size_t c = 0; c < 3; c++) {
+					p[c] = positions[tri[c]];
+					q[c] = (tri[c] == from) ? target : p[c];
+				}
+
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(before, after) <= 0.0f) return false;
+			}
+			return true;
+		};
+
+		const double maxCost = double(maxError) * double(maxError);
+		double worstCost = 0.0;
+
+		while (liveTris * 3 > targetIndexCount && !heap.empty()) {
+
+			Collapse collapse = heap.top();
+			heap.pop();
+
+			unsigned int from = collapse.from, to = collapse.to;
+			if (removed[from] || removed[to]) continue;
+			if (collapse.fromStamp != stamps[from] || collapse.toStamp != stamps[to]) continue;
+			if (collapse.cost > maxCost) break;
+			if (!collapseIsValid(from, to)) continue;
+
+			// rewire triangles of `from` onto `to`, dropping the ones that degenerate
+			for (unsigned int t : vertexTris[from]) {
+				if (triRemoved[t]) continue;
+
+				unsigned int* tri = &tris[3 * t];
+				for (size_t c = 0; c < 3; c++)
+					if (tri[c] == from) tri[c] = to;
+
+				if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+					triRemoved[t] = true;
+					liveTris--;
+				}
+				else vertexTris[to].push_back(t);
+			}
+
+			vertexTris[from].clear();
+			removed[from] = true;
+			quadrics[to] += quadrics[from];
+			worstCost = std::max(worstCost, collapse.cost);
+
+			// costs around `to` changed
+			stamps[to]++;
+			auto& around = vertexTris[to];
+			around.erase(std::remove_if(around.begin(), around.end(),
+				[&](unsigned int t) { return triRemoved[t]; }), around.end());
+
+			for (unsigned int t : around)
+				for (size_t c = 0; c < 3; c++) {
+					unsigned int n = tris[3 * t + c];
+					if (n == to) continue;
+					pushCollapse(to, n);
+					pushCollapse(n, to);
+				}
+		}
+
+		Level level;
+		level.indices.reserve(liveTris * 3);
+		for (size_t t = 0; t < triCount; t++)
+			if (!triRemoved[t])
+				level.indices.insert(level.indices.end(), tris.begin() + 3 * t, tris.begin() + 3 * t + 3);
+		level.error = static_cast<float>(std::sqrt(worstCost));
+
+		return level;
+	}
+
+	// Full detail followed by levels with about `ratio` of the previous level's
+	// triangles, until a level stops shrinking or gets below minTriangles
+	std::vector<Level> buildChain(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		size_t maxLevels = 6, float ratio = 0.5f, size_t minTriangles = 32) {
+
+		std::vector<Level> chain;
+		chain.push_back({ indices, 0.0f });
+
+		while (chain.size() < maxLevels) {
+
+			size_t previous = chain.back().indices.size();
+			if (previous / 3 <= minTriangles) break;
+
+			size_t target = std::max<size_t>(static_cast<size_t>(previous * ratio) / 3, minTriangles) * 3;
+			Level level = simplify(indices, positions, target);
+
+			// locked borders or flips stopped it short - no point in a near copy
+			if (level.indices.empty() || level.indices.size() > previous * 0.8f) break;
+
+			level.error = std::max(level.error, chain.back().error);
+			chain.push_back(std::move(level));
+		}
+
+		return chain;
+	}
+};
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+
+#include <glm/glm.hpp>
+
+////////////////////////////////////////////////////////////
+// OBJ (.3d) parsing straight out of a file buffer
+//
+// Numbers are read with std::from_chars between pointers,
+// no per-line strings or streams are created. A pre-pass
+// counts the records so the arrays are sized once, and big
+// files are cut at line boundaries and parsed on several
+// threads, the chunks appended in file order.
+//
+// Works on any mesh with OBJ-style index triples
+// (vertices/normals/texcoords + vIndices/vnIndices/vtIndices),
+// i.e. both the generator's ModelData and the engine's Model.
+////////////////////////////////////////////////////////////
+
+namespace objText {
+
+	// whitespace as understood by operator>> in the "C" locale (minus '\n')
+	inline bool isBlank(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	inline const char* skipBlanks(const char* p, const char* end) {
+		while (p < end && isBlank(*p)) ++p;
+		return p;
+	}
+
+	inline const char* tokenEnd(const char* p, const char* end) {
+		while (p < end && !isBlank(*p)) ++p;
+		return p;
+	}
+
+	inline const char* lineEnd(const char* p, const char* end) {
+		const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		return eol ? eol : end;
+	}
+
+	inline bool parseFloat(const char*& p, const char* end, float& out) {
+		p = skipBlanks(p, end);
+		if (p < end && *p == '+') ++p; // from_chars rejects an explicit '+'
+
+		auto [next, ec] = std::from_chars(p, end, out);
+		if (ec != std::errc()) return false;
+
+		p = next;
+		return true;
+	}
+
+	inline bool parseIndex(const char* first, const char* last, unsigned int& out) {
+		if (first < last && *first == '+') ++first;
+
+		unsigned long value;
+		auto [next, ec] = std::from_chars(first, last, value);
+		if (ec != std::errc()) return false;
+
+		out = static_cast<unsigned int>(value - 1); // OBJ indices are 1-based
+		return true;
+	}
+}
+
+namespace objParser {
+
+	// a corner without a texcoord or normal index, with Options::placeholders
+	constexpr unsigned int MISSING = ~0u;
+
+	struct Options {
+		bool polygons = false;     // fan faces with more than three corners instead of rejecting them
+		bool placeholders = false; // MISSING for an absent vt or vn index instead of leaving it out
+	};
+
+	struct RecordCounts {
+		size_t v = 0, vn = 0, vt = 0, f = 0;
+	};
+
+	// Cheap pre-pass so the mesh vectors can be sized once
+	inline RecordCounts countRecords(const char* begin, const char* end) {
+		RecordCounts counts;
+
+		for (const char* p = begin; p < end; ) {
+			const char* eol = objText::lineEnd(p, end);
+
+			if (eol - p >= 2) {
+				if (p[0] == 'v') {
+					if (objText::isBlank(p[1])) counts.v++;
+					else if (p[1] == 'n') counts.vn++;
+					else if (p[1] == 't') counts.vt++;
+				}
+				else if (p[0] == 'f' && objText::isBlank(p[1])) counts.f++;
+			}
+
+			p = (eol < end) ? eol + 1 : end;
+		}
+
+		return counts;
+	}
+
+	// Parses the OBJ records in [begin, end) and appends them to the mesh
+	template<typename Mesh>
+	void parse(const char* begin, const char* end, Mesh& mesh, const Options& options = {}) {
+
+		using namespace objText;
+
+		struct Corner {
+			unsigned int v = 0, vt = MISSING, vn = MISSING;
+		};
+
+		auto emit = [&](const Corner& c) {
+			mesh.vIndices.push_back(c.v);
+			if (c.vt != MISSING || options.placeholders) mesh.vtIndices.push_back(c.vt);
+			if (c.vn != MISSING || options.placeholders) mesh.vnIndices.push_back(c.vn);
+		};
+
+		for (const char* p = begin; p < end; ) {
+
+			const char* line = p;
+			const char* eol = lineEnd(p, end);
+			p = (eol < end) ? eol + 1 : end;
+
+			if (line == eol || line[0] == '#') continue;
+
+			auto lineString = [&]() { return std::string(line, eol); };
+
+			const char* q = skipBlanks(line, eol);
+			const char* qEnd = tokenEnd(q, eol);
+			std::string_view prefix(q, qEnd - q);
+			q = qEnd;
+
+			// Parse vertex coords
+			if (prefix == "v") {
+				glm::vec3 v;
+				if (!(parseFloat(q, eol, v.x) && parseFloat(q, eol, v.y) && parseFloat(q, eol, v.z)))
+					throw std::runtime_error("Failed to parse vertex line: " + lineString());
+				mesh.vertices.push_back(v);
+			}
+			// Parse normal coords
+			else if (prefix == "vn") {
+				glm::vec3 vn;
+				if (!(parseFloat(q, eol, vn.x) && parseFloat(q, eol, vn.y) && parseFloat(q, eol, vn.z)))
+					throw std::runtime_error("Failed to parse normal line: " + lineString());
+				mesh.normals.push_back(vn);
+			}
+			// Parse tex coords
+			else if (prefix == "vt") {
+				glm::vec2 vt;
+				if (!(parseFloat(q, eol, vt.x) && parseFloat(q, eol, vt.y)))
+					throw std::runtime_error("Failed to parse texcoords line: " + lineString());
+				mesh.texcoords.push_back(vt);
+			}
+			// Parse face indices (v, v/vt, v//vn or v/vt/vn), polygons fanned from the first corner
+			else if (prefix == "f") {
+
+				Corner first, previous;
+				int corners = 0;
+
+				for (q = skipBlanks(q, eol); q < eol; q = skipBlanks(q, eol)) {
+
+					const char* token = q;
+					q = tokenEnd(q, eol);
+
+					if (++corners > 3 && !options.polygons)
+						throw std::runtime_error("Only triangular faces are supported");
+
+					Corner corner;
+
+					// Parse vertex index
+					const char* slash = std::find(token, q, '/');
+					if (slash == token) throw std::runtime_error("Vertex index is required");
+					if (!parseIndex(token, slash, corner.v))
+						throw std::runtime_error("Invalid face index in line: " + lineString());
+
+					// Parse texture coordinate index if exists
+					if (slash < q) {
+						const char* vtBegin = slash + 1;
+						slash = std::find(vtBegin, q, '/');
+						if (slash > vtBegin && !parseIndex(vtBegin, slash, corner.vt))
+							throw std::runtime_error("Invalid face index in line: " + lineString());
+					}
+
+					// Parse normal index if exists (after second slash)
+					if (slash < q) {
+						const char* vnBegin = slash + 1;
+						slash = std::find(vnBegin, q, '/');
+						if (slash > vnBegin && !parseIndex(vnBegin, slash, corner.vn))
+							throw std::runtime_error("Invalid face index in line: " + lineString());
+					}
+
+					if (corners == 1) first = corner;
+					else if (corners >= 3) {
+						emit(first);
+						emit(previous);
+						emit(corner);
+					}
+					previous = corner;
+				}
+
+				if (corners < 3 || (corners != 3 && !options.polygons))
+					throw std::runtime_error("Only triangular faces are supported");
+			}
+		}
+	}
+
+	template<typename Mesh>
+	void parseReserved(const char* begin, const char* end, Mesh& mesh, const Options& options = {}) {
+		RecordCounts counts = countRecords(begin, end);
+		mesh.vertices.reserve(mesh.vertices.size() + counts.v);
+		mesh.normals.reserve(mesh.normals.size() + counts.vn);
+		mesh.texcoords.reserve(mesh.texcoords.size() + counts.vt);
+		mesh.vIndices.reserve(mesh.vIndices.size() + counts.f * 3);
+		mesh.vnIndices.reserve(mesh.vnIndices.size() + counts.f * 3);
+		mesh.vtIndices.reserve(mesh.vtIndices.size() + counts.f * 3);
+
+		parse(begin, end, mesh, options);
+	}
+
+	// Splits the buffer at line boundaries into one chunk per thread and parses
+	// each chunk into its own arrays. OBJ indices are absolute, so appending the
+	// chunk results in file order gives exactly what the serial parser produces.
+	template<typename Mesh>
+	void parseParallel(const char* begin, const char* end, unsigned int threadCount, Mesh& mesh, const Options& options = {}) {
+
+		size_t chunkSize = (end - begin) / threadCount;
+
+		std::vector<const char*> bounds = { begin };
+		for (unsigned int i = 1; i < threadCount; i++) {
+			const char* cut = std::max(bounds.back(), begin + i * chunkSize);
+			cut = objText::lineEnd(cut, end);
+			bounds.push_back((cut < end) ? cut + 1 : end);
+		}
+		bounds.push_back(end);
+
+		std::vector<Mesh> chunks(threadCount);
+		std::vector<std::exception_ptr> errors(threadCount);
+		std::vector<std::thread> workers;
+
+		for (unsigned int i = 0; i < threadCount; i++) {
+			workers.emplace_back([&, i]() {
+				try {
+					parseReserved(bounds[i], bounds[i + 1], chunks[i], options);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			});
+		}
+
+		for (auto& worker : workers) worker.join();
+
+		for (auto& error : errors)
+			if (error) std::rethrow_exception(error);
+
+		auto append = [](auto& dst, const auto& src) { dst.insert(dst.end(), src.begin(), src.end()); };
+		auto total = [&](auto member) {
+			size_t n = 0;
+			for (const auto& chunk : chunks) n += (chunk.*member).size();
+			return n;
+		};
+
+		mesh.vertices.reserve(total(&Mesh::vertices));
+		mesh.normals.reserve(total(&Mesh::normals));
+		mesh.texcoords.reserve(total(&Mesh::texcoords));
+		mesh.vIndices.reserve(total(&Mesh::vIndices));
+		mesh.vnIndices.reserve(total(&Mesh::vnIndices));
+		mesh.vtIndices.reserve(total(&Mesh::vtIndices));
+
+		for (const auto& chunk : chunks) {
+			append(mesh.vertices, chunk.vertices);
+			append(mesh.normals, chunk.normals);
+			append(mesh.texcoords, chunk.texcoords);
+			append(mesh.vIndices, chunk.vIndices);
+			append(mesh.vnIndices, chunk.vnIndices);
+			append(mesh.vtIndices, chunk.vtIndices);
+		}
+	}
+
+	inline std::string readFileBuffer(const std::filesystem::path& filepath) {
+		std::ifstream file(filepath, std::ios::binary);
+		if (!file) throw std::runtime_error("Failed to open file: " + filepath.string());
+
+		std::string buffer(std::filesystem::file_size(filepath), '\0');
+		file.read(buffer.data(), buffer.size());
+
+		return buffer;
+	}
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Parsing.h"
+
+////////////////////////////////////////////////////////////
+// Progressive scene loading
+//
+// Worker threads parse models and decode images while the
+// render loop is already running. The render thread uploads
+// finished assets to the GL a few at a time (see pump), so a
+// frame never spends more than uploadBudgetMs on uploads.
+// Until then, ModelStorage skips unknown models and
+// Texture::id gives 0 (untextured) for unknown textures.
+////////////////////////////////////////////////////////////
+
+struct AssetLoader {
+
+	struct Job {
+		enum class Kind { MODEL, TEXTURE };
+		Kind kind;
+		std::string filename;
+	};
+
+	inline static float uploadBudgetMs = 4.0f;
+
+	inline static std::vector<Job> jobs = {};
+	inline static std::atomic<size_t> nextJob = 0;
+	inline static std::atomic<bool> cancelled = false;
+	inline static std::vector<std::thread> workers = {};
+
+	inline static std::mutex readyMutex;
+	inline static std::deque<std::pair<std::string, Model>> readyModels = {};
+	inline static std::deque<std::pair<std::string, modelFileManagement::Image>> readyTextures = {};
+
+	// render thread only
+	inline static size_t modelsRequested = 0, texturesRequested = 0;
+	inline static size_t modelsDone = 0, texturesDone = 0;
+	inline static bool finished = true;
+	inline static std::chrono::steady_clock::time_point startTime;
+
+	static void work() {
+
+		for (size_t i = nextJob++; i < jobs.size() && !cancelled; i = nextJob++) {
+
+			const Job& job = jobs[i];
+
+			if (job.kind == Job::Kind::MODEL) {
+
+				Model model;
+				try {
+					model = modelFileManagement::importModel(job.filename);
+				}
+				catch (const std::exception& e) {
+					std::cerr << std::format("Failed to load model {}: {}", job.filename, e.what()) << std::endl;
+				}
+
+				std::lock_guard<std::mutex> lock(readyMutex);
+				readyModels.emplace_back(job.filename, std::move(model));
+			}
+			else {
+
+				modelFileManagement::Image image;
+				modelFileManagement::decodeTexture(job.filename, image);
+
+				std::lock_guard<std::mutex> lock(readyMutex);
+				readyTextures.emplace_back(job.filename, std::move(image));
+			}
+		}
+	}
+
+	static void start(const std::vector<std::string>& modelFilenames, const std::vector<std::string>& textureFilenames) {
+
+		stop();
+
+		jobs.clear();
+		nextJob = 0;
+		cancelled = false;
+
+		// interleave models and textures so both show up progressively
+		for (size_t i = 0; i < std::max(modelFilenames.size(), textureFilenames.size()); i++) {
+			if (i < modelFilenames.size())   jobs.push_back({ Job::Kind::MODEL, modelFilenames[i] });
+			if (i < textureFilenames.size()) jobs.push_back({ Job::Kind::TEXTURE, textureFilenames[i] });
+		}
+
+		modelsRequested = modelFilenames.size();
+		texturesRequested = textureFilenames.size();
+		modelsDone = texturesDone = 0;
+		finished = jobs.empty();
+		startTime = std::chrono::steady_clock::now();
+
+		unsigned int threadCount = std::clamp(std::thread::hardware_concurrency(), 2u, 8u) - 1;
+		threadCount = std::min<unsigned int>(threadCount, jobs.size());
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.emplace_back(work);
+	}
+
+	static void stop() {
+		cancelled = true;
+		for (auto& worker : workers)
+			if (worker.joinable()) worker.join();
+		workers.clear();
+	}
+
+	// Uploads finished assets until the frame's budget is spent (at least one per call)
+	static void pump() {
+
+		if (finished) return;
+
+		auto frameStart = std::chrono::steady_clock::now();
+		auto withinBudget = [&]() {
+			std::chrono::duration<float, std::milli> spent = std::chrono::steady_clock::now() - frameStart;
+			return spent.count() < uploadBudgetMs;
+		};
+
+		while (withinBudget()) {
+
+			std::unique_lock<std::mutex> lock(readyMutex);
+
+			if (!readyModels.empty()) {
+				auto [filename, model] = std::move(readyModels.front());
+				readyModels.pop_front();
+				lock.unlock();
+
+				if (model.packed.attribs) {
+					ModelStorage::load(filename, std::move(model));
+					ModelStorage::models[filename].initBuffers();
+				}
+				modelsDone++;
+			}
+			else if (!readyTextures.empty()) {
+				auto [filename, image] = std::move(readyTextures.front());
+				readyTextures.pop_front();
+				lock.unlock();
+
+				if (!image.texels.empty())
+					Texture::load(filename, modelFileManagement::uploadTexture(image));
+				texturesDone++;
+			}
+			else break;
+		}
+
+		if (modelsDone == modelsRequested && texturesDone == texturesRequested) {
+			stop();
+			finished = true;
+
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+			std::cout
+				<< std::format(
+					"Loaded {} models and {} textures in {:.2f} s",
+					ModelStorage::models.size(),
+					Texture::textureIDs.size(),
+					elapsed.count())
+				<< std::endl;
+			Texture::print();
+		}
+	}
+
+	static float progress() {
+		size_t total = modelsRequested + texturesRequested;
+		return (total == 0) ? 1.0f : float(modelsDone + texturesDone) / total;
+	}
+
+	static std::string hudString() {
+		return std::format(
+			"Loading: {:.0f}% (models {}/{}, textures {}/{})",
+			progress() * 100.0f,
+			modelsDone, modelsRequested,
+			texturesDone, texturesRequested
+		);
+	}
+};
+
+#endif
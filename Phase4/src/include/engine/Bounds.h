@@ -0,0 +1,84 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <array>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+struct BoundingSphere {
+
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = -1.0f; // negative: empty
+
+	bool empty() const { return radius < 0.0f; }
+
+	static BoundingSphere fromBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+		return { 0.5f * (boundsMin + boundsMax), 0.5f * glm::length(boundsMax - boundsMin) };
+	}
+
+	// smallest sphere holding both
+	void merge(const BoundingSphere& other) {
+		if (other.empty()) return;
+		if (empty()) { *this = other; return; }
+
+		glm::vec3 offset = other.center - center;
+		float distance = glm::length(offset);
+
+		if (distance + other.radius <= radius) return;
+		if (distance + radius <= other.radius) { *this = other; return; }
+
+		float merged = 0.5f * (distance + radius + other.radius);
+		center += offset * ((merged - radius) / distance);
+		radius = merged;
+	}
+
+	// conservative under non-uniform scaling
+	BoundingSphere transformed(const glm::mat4& m) const {
+		if (empty()) return *this;
+
+		float scale = std::max({
+			glm::length(glm::vec3(m[0])),
+			glm::length(glm::vec3(m[1])),
+			glm::length(glm::vec3(m[2]))
+		});
+		return { glm::vec3(m * glm::vec4(center, 1.0f)), radius * scale };
+	}
+};
+
+struct Frustum {
+
+	// left, right, bottom, top, near, far - normals point inwards
+	std::array<glm::vec4, 6> planes = {};
+
+	// Gribb & Hartmann: planes from the rows of projection * view
+	static Frustum fromMatrix(const glm::mat4& viewProjection) {
+
+		auto row = [&](int i) {
+			return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		};
+
+		Frustum frustum;
+		frustum.planes = {
+			row(3) + row(0), row(3) - row(0),
+			row(3) + row(1), row(3) - row(1),
+			row(3) + row(2), row(3) - row(2)
+		};
+
+		for (auto& plane : frustum.planes)
+			plane /= glm::length(glm::vec3(plane));
+
+		return frustum;
+	}
+
+	bool intersects(const BoundingSphere& sphere) const {
+		if (sphere.empty()) return false;
+
+		for (const auto& plane : planes)
+			if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+				return false;
+		return true;
+	}
+};
+
+#endif
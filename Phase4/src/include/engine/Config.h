@@ -1,13 +1,24 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <map>
 #include <format>
+#include <memory>
 #include <variant>
 #include <unordered_map>
 #include <unordered_set>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Bounds.h"
+#include "GLState.h"
+#include "DebugDraw.h"
+#include "MeshArena.h"
+#include "VertexFormat.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 
 
 
@@ -247,6 +258,19 @@ struct CameraController {
 		);
 	}
 
+	static glm::mat4 viewMatrix() {
+		return glm::lookAt(currentPlacement.pos, currentPlacement.target, currentPlacement.up);
+	}
+
+	static glm::mat4 projectionMatrix(float aspectRatio) {
+		return glm::perspective(
+			glm::radians(static_cast<float>(currentProjection.fov)),
+			aspectRatio,
+			static_cast<float>(currentProjection.near),
+			static_cast<float>(currentProjection.far)
+		);
+	}
+
 	static void perspective(float aspectRatio) {
 		gluPerspective(
 			currentProjection.fov,
@@ -287,6 +311,9 @@ struct WindowState {
 		if (h == 0)
 			h = 1;
 
+		currentWidth = w;
+		currentHeight = h;
+
 		float aspectRatio = w * 1.0f / h;
 
 		glMatrixMode(GL_PROJECTION);
@@ -463,12 +490,12 @@ namespace catRom {
 		return { glm::vec3(T * MP), glm::vec3(dT * MP) };
 	}
 
-	void draw(int tessellationLevel, const glm::mat3x4& MP) {
+	void tessellate(int tessellationLevel, const glm::mat3x4& MP, std::vector<glm::vec3>& points) {
 	
 		for (int i = 0; i < tessellationLevel+1; i++) {
 			float t = i / (float)tessellationLevel;
 			auto [pos, deriv] = point(MP, t);
-			glVertex3f(pos.x, pos.y, pos.z);
+			points.push_back(pos);
 		}
 	}
 
@@ -486,40 +513,44 @@ namespace catRom {
 			return point(segmentMPs[iSegment], tSegment);
 		}
 
-		void drawWhole(int tesselationLevel) {
+		void drawWhole(DebugDraw::Batch& batch, int tesselationLevel, const glm::vec3& color) const {
 			if (segmentMPs.empty()) return;
 
-			glBegin(GL_LINE_STRIP);
+			std::vector<glm::vec3> points;
 			for (const auto& mp : segmentMPs) {
-				draw(tesselationLevel, mp);
+				tessellate(tesselationLevel, mp, points);
 			}
-			glEnd();
+			batch.polyline(points, color);
 		}
 	
 		void transform(float t, float aligned, glm::vec3 worldUp) {
+			glMultMatrixf(glm::value_ptr(matrix(t, aligned, worldUp)));
+		}
+
+		glm::mat4 matrix(float t, bool aligned, glm::vec3 worldUp) const {
 			const auto [p, dp] = evaluate(t);
 			
 			// translate to spline position
 
-			glMultMatrixf(glm::value_ptr(glm::mat4(
+			glm::mat4 m = glm::mat4(
 				glm::vec4(1, 0, 0, 0),
 				glm::vec4(0, 1, 0, 0),
 				glm::vec4(0, 0, 1, 0),
 				glm::vec4(p,       1)
 			
-			)));
+			);
 
 			if (aligned) {
 				auto front = glm::normalize(dp);
 				auto right = glm::normalize(glm::cross(front,worldUp));
 				auto up = glm::normalize(glm::cross(right, front));
 
-				glMultMatrixf(glm::value_ptr(glm::mat4(
+				m *= glm::mat4(
 					glm::vec4(front,   0),
 					glm::vec4(up,      0),
 					glm::vec4(right,   0),
 					glm::vec4(0, 0, 0, 1)
-				)));
+				);
 
 				/* alternative: Z-alignment...
 
@@ -535,6 +566,33 @@ namespace catRom {
 				)));
 				*/
 			}
+
+			return m;
+		}
+
+		// sphere around the whole path (sampled, padded by half the largest step)
+		BoundingSphere bounds(int samplesPerSegment = 32) const {
+			if (segmentMPs.empty()) return { glm::vec3(0.0f), 0.0f };
+
+			std::vector<glm::vec3> samples;
+			for (const auto& mp : segmentMPs)
+				for (int i = 0; i <= samplesPerSegment; i++)
+					samples.push_back(point(mp, i / (float)samplesPerSegment).first);
+
+			glm::vec3 lo = samples[0], hi = samples[0];
+			float step = 0.0f;
+			for (size_t i = 0; i < samples.size(); i++) {
+				lo = glm::min(lo, samples[i]);
+				hi = glm::max(hi, samples[i]);
+				if (i > 0) step = std::max(step, glm::length(samples[i] - samples[i - 1]));
+			}
+
+			BoundingSphere sphere = { 0.5f * (lo + hi), 0.0f };
+			for (const auto& sample : samples)
+				sphere.radius = std::max(sphere.radius, glm::length(sample - sphere.center));
+			sphere.radius += 0.5f * step;
+
+			return sphere;
 		}
 
 		Spline() = default;
@@ -561,6 +619,9 @@ struct LightCaster {
 	inline static bool locationVisible = false;
 	inline static float white[4] = { 1.0f, 1.0f, 1.0f, 1.0f }; 
 
+	// all the fixed function pipeline has (GL_LIGHT0 + i), it takes the first ones
+	static constexpr int MAX_FIXED_LIGHTS = 8;
+
 	enum class Type { POINT, DIRECTIONAL, SPOTLIGHT };
 
 	Type type = Type::POINT;
@@ -578,50 +639,53 @@ struct LightCaster {
 	float linearAttenuation = 1.0f;
 	float quadraticAttenuation = 1.0f;
 
-	void drawLocation() {
+	// Point & spot: 0 lights the whole scene, anything else is the distance
+	// where the light fades out, which lets CoreRenderer bin it into clusters.
+	// Within it the intensity falls as 1 / (1 + 9 (d / range)^2), the
+	// quadratic attenuation the fixed pipeline is given for it.
+	float range = 0.0f;
+
+	float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f }; // diffuse and specular
+
+	bool bounded() const {
+		return type != Type::DIRECTIONAL && range > 0.0f;
+	}
+
+	// into the frame's debug batch, drawn with the rest of it
+	void drawLocation() const {
 		if (type == Type::DIRECTIONAL)
 			return;
-		
-		glPushMatrix();
-		glPushAttrib(GL_POINT_BIT | GL_CURRENT_BIT | GL_LINE_BIT | GL_LIGHTING_BIT);
-		glDisable(GL_LIGHTING);
-		
-		glTranslatef(pos[0], pos[1], pos[2]);
-		glColor3f(1,1,0);
 
-		// Locate the light source
-		glPointSize(8.0f);
-		glBegin(GL_POINTS);
-		glVertex3f(0.0f, 0.0f, 0.0f);
-		glEnd();
+		const glm::vec3 yellow = { 1.0f, 1.0f, 0.0f };
+		glm::vec3 position = { pos[0], pos[1], pos[2] };
 
-		if (type == Type::SPOTLIGHT) {
-			glLineWidth(2.0f);
-			glBegin(GL_LINES);
-			glVertex3f(0.0f, 0.0f, 0.0f);
-			glVertex3f(dir[0] * 2.0f, dir[1] * 2.0f, dir[2] * 2.0f);
-			glEnd();
-		}
+		// Locate the light source
+		DebugDraw::frame.point(position, yellow, 8.0f);
 
-		glPopMatrix();
-		glPopAttrib();
+		if (type == Type::SPOTLIGHT)
+			DebugDraw::frame.line(position, position + 2.0f * glm::vec3(dir[0], dir[1], dir[2]), yellow, 2.0f);
 	}
 	
-	static void applyAll() {
+	static void drawLocations() {
+		for (auto& light : lights)
+			light.drawLocation();
+	}
 
-		static int nLights = lights.size();
+	// the fixed function lights, in eye space from the modelview in place
+	static void applyAll() {
 
 		glLightModelfv(GL_LIGHT_MODEL_AMBIENT, LightCaster::white);
-		for (int i = 0; i < std::min(nLights, 8); ++i) {
+		if (locationVisible)
+			drawLocations();
 
-			GLenum lightID = GL_LIGHT0 + i;
-			auto light = lights[i];
+		int count = static_cast<int>(std::min<size_t>(lights.size(), MAX_FIXED_LIGHTS));
+		for (int i = 0; i < count; ++i) {
 
-			if (locationVisible)
-				light.drawLocation();
+			GLenum lightID = GL_LIGHT0 + i;
+			const auto& light = lights[i];
 
-			glLightfv(lightID, GL_DIFFUSE, LightCaster::white);
-			glLightfv(lightID, GL_SPECULAR, LightCaster::white);
+			glLightfv(lightID, GL_DIFFUSE, light.color);
+			glLightfv(lightID, GL_SPECULAR, light.color);
 
 			if (light.type == Type::DIRECTIONAL) {
 				glLightfv(lightID, GL_POSITION, light.dir);
@@ -630,7 +694,7 @@ struct LightCaster {
 				glLightfv(lightID, GL_POSITION, light.pos);
 				//glLightf(lightID, GL_CONSTANT_ATTENUATION, light.constantAttenuation);
 				//glLightf(lightID, GL_LINEAR_ATTENUATION, light.linearAttenuation);
-				//glLightf(lightID, GL_QUADRATIC_ATTENUATION, light.quadraticAttenuation);
+				glLightf(lightID, GL_QUADRATIC_ATTENUATION, light.bounded() ? 9.0f / (light.range * light.range) : 0.0f);
 
 				if (light.type == Type::SPOTLIGHT) {
 					glLightfv(lightID, GL_SPOT_DIRECTION, light.dir);
@@ -639,7 +703,7 @@ struct LightCaster {
 				}
 			}
 
-			glEnable(lightID);
+			GLState::enable(lightID);
 
 		}
 
@@ -647,7 +711,6 @@ struct LightCaster {
 	}
 	
 	static void loadPoint(glm::vec3 position) {
-		if (lights.size() > 8) return;
 		LightCaster l;
 		l.type = Type::POINT;
 		l.pos[0] = position.x;
@@ -760,6 +823,10 @@ struct AnimatedTranslation {
 	float tPeriod = 0.0f;
 	bool aligned = true;
 
+	// built on first use, in the frame the translation is applied in
+	DebugDraw::Batch pathBatch;
+	int pathLevel = -1;
+
 	AnimatedTranslation(std::vector<glm::vec3> controlPoints, float tPeriod, bool isAligned) :
 		tPeriod(tPeriod),
 		aligned(isAligned)
@@ -774,15 +841,18 @@ struct AnimatedTranslation {
 		crPath = catRom::Spline(this->controlPoints);
 	}
 
-	void drawControlPoints() {
-		glPushAttrib(GL_POINT_BIT | GL_CURRENT_BIT);
-		glPointSize(3.0f);
-		glBegin(GL_POINTS);
-		glColor3f(1, 1, 0);
-		for (const auto& p : controlPoints)
-			glVertex3f(p.x, p.y, p.z);
-		glEnd();
-		glPopAttrib();
+	// control points and curve, rebuilt only when the tessellation level changes
+	const DebugDraw::Batch& path() {
+		int level = tessellationLevels[currentTessIndex];
+		if (pathLevel != level) {
+			pathBatch.clear();
+			for (const auto& p : controlPoints)
+				pathBatch.point(p, { 1.0f, 1.0f, 0.0f }, 3.0f);
+			crPath.drawWhole(pathBatch, level, glm::vec3(1.0f));
+			pathBatch.upload();
+			pathLevel = level;
+		}
+		return pathBatch;
 	}
 
 	static void nextTessellationLevel() {
@@ -791,17 +861,32 @@ struct AnimatedTranslation {
 
 	void apply(float tDelta) {
 
-		if (AnimatedTranslation::showPath == true) {
-			drawControlPoints();
-		    crPath.drawWhole(tessellationLevels[currentTessIndex]);
-		}
+		if (AnimatedTranslation::showPath == true)
+			path().draw();
 
 		crPath.transform(t, aligned, CameraController::initialPlacement.up);
 
+		advance(tDelta);
+	}
+
+	void advance(float tDelta) {
 		auto tDeltaNormalised = tDelta / tPeriod;
 		t = (t + tDeltaNormalised <= 1.0f) ? t + tDeltaNormalised : 0.0f;
 	}
 
+	glm::mat4 matrix() const {
+		return crPath.matrix(t, aligned, CameraController::initialPlacement.up);
+	}
+
+	// everything the bounds can reach over a whole period
+	BoundingSphere sweep(BoundingSphere bounds) const {
+		if (bounds.empty()) return bounds;
+		if (aligned) bounds = { glm::vec3(0.0f), glm::length(bounds.center) + bounds.radius };
+
+		BoundingSphere path = crPath.bounds();
+		return { path.center + bounds.center, path.radius + bounds.radius };
+	}
+
 	std::string toString() const {
 		std::string pointsStr;
 		for (const auto& point : controlPoints) {
@@ -837,6 +922,14 @@ struct Translation {
 		glTranslatef(x, y, z);
 	}
 
+	glm::mat4 matrix() const {
+		return glm::translate(glm::mat4(1.0f), glm::vec3(x, y, z));
+	}
+
+	BoundingSphere sweep(const BoundingSphere& bounds) const {
+		return bounds.transformed(matrix());
+	}
+
 	std::string toString() const {
 		return std::format("Translation({}, {}, {})", x, y, z);
 	}
@@ -854,9 +947,25 @@ struct AnimatedRotation {
 
 		glRotatef(360.0f * t, axis.x, axis.y, axis.z);
 
+		advance(tDelta);
+	}
+
+	void advance(float tDelta) {
 		auto tDeltaNormalised = tDelta / tPeriod;
 		t = (t + tDeltaNormalised <= 1.0f) ? t + tDeltaNormalised : 0.0f;
-		
+	}
+
+	glm::mat4 matrix() const {
+		return glm::rotate(glm::mat4(1.0f), glm::radians(360.0f * t), axis);
+	}
+
+	// a full turn keeps the centre's component along the axis and sweeps the rest into a ring
+	BoundingSphere sweep(const BoundingSphere& bounds) const {
+		if (bounds.empty()) return bounds;
+
+		glm::vec3 a = glm::normalize(axis);
+		glm::vec3 along = glm::dot(bounds.center, a) * a;
+		return { along, bounds.radius + glm::length(bounds.center - along) };
 	}
 	
 	std::string toString() const {
@@ -880,6 +989,14 @@ struct Rotation {
 		glRotatef(angle, x, y, z);
 	}
 
+	glm::mat4 matrix() const {
+		return glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(x, y, z));
+	}
+
+	BoundingSphere sweep(const BoundingSphere& bounds) const {
+		return bounds.transformed(matrix());
+	}
+
 	std::string toString() const {
 		return std::format("Rotation(angle: {}, axis: ({}, {}, {}))", angle, x, y, z);
 	}
@@ -894,6 +1011,14 @@ struct Scaling {
 		glScalef(x, y, z);
 	}
 
+	glm::mat4 matrix() const {
+		return glm::scale(glm::mat4(1.0f), glm::vec3(x, y, z));
+	}
+
+	BoundingSphere sweep(const BoundingSphere& bounds) const {
+		return bounds.transformed(matrix());
+	}
+
 	std::string toString() const {
 		return std::format("Scaling({}, {}, {})", x, y, z);
 	}
@@ -943,7 +1068,7 @@ struct Texture {
 	static void updateFiltering(std::string filename = "") {
 		
 		auto updateTexture = [](GLuint texID) {
-			glBindTexture(GL_TEXTURE_2D, texID);
+			GLState::bindTexture(GL_TEXTURE_2D, texID);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (minFilter == GL_NEAREST)?GL_NEAREST:GL_LINEAR);
 			if (anisotropy) {
@@ -960,7 +1085,7 @@ struct Texture {
 			for (auto& [_, texID] : textureIDs)
 				updateTexture(texID);
 
-		glBindTexture(GL_TEXTURE_2D, 0);
+		GLState::bindTexture(GL_TEXTURE_2D, 0);
 	}
 	
 	static void load(std::string filename, unsigned int id) {
@@ -990,6 +1115,16 @@ struct Model {
 	inline static bool showAxes = false;
 	inline static bool showTexture = true;
 
+	// level of detail selection: coarsest level whose error projects under
+	// lodThreshold pixels, refining at once and coarsening only with margin
+	inline static bool lodEnabled = true;
+	inline static float lodThreshold = 1.0f;
+	inline static float lodHysteresis = 0.25f;
+
+	// per frame statistics
+	inline static size_t trianglesDrawn = 0;
+	inline static size_t drawCalls = 0;
+
 	std::vector<glm::vec3> vertices = {};
 	std::vector<glm::vec3> normals = {};
 	std::vector<glm::vec2> texcoords = {};
@@ -998,50 +1133,186 @@ struct Model {
 	std::vector<unsigned int> vnIndices = {};
 	std::vector<unsigned int> vtIndices = {};
 
-	GLuint vertexBufferID = 0;
-	GLuint indexBufferID = 0;
+	GLuint vertexArrayID = 0; // 0 without vertex array objects
 	bool buffersInitialised = false;
 
-	std::pair<std::vector<float>, std::vector<unsigned int>> interleavedData() {
+	DebugDraw::Batch axesBatch; // see axes()
+
+	// sizes of the streams uploaded to the GPU
+	size_t vertexCount = 0;
+	size_t elementCount = 0;
+	GLenum elementType = GL_UNSIGNED_INT;
+
+	// where they start in the MeshArena buffers, in bytes
+	size_t vertexBase = 0;
+	size_t indexBase = 0;
+
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+
+	// Interleaved streams ready for glBufferData, either built by pack() or
+	// mapped straight from a .3db cache file. Released once uploaded.
+	struct PackedBuffers {
+		std::shared_ptr<const void> storage = nullptr; // owns the memory below
+		const void* attribs = nullptr;
+		const void* indices = nullptr;
+		size_t indexSize = sizeof(unsigned int);
+		size_t vertexCount = 0;
+		size_t indexCount = 0;
+		VertexLayout layout = {};
+	};
+
+	PackedBuffers packed;
+
+	// format of the uploaded vertex buffer
+	VertexLayout layout = {};
+
+	// index ranges in the element buffer, full detail first
+	struct Lod {
+		size_t firstIndex = 0;
+		size_t indexCount = 0;
+		float error = 0.0f; // model units
+	};
+
+	std::vector<Lod> lods = {};
+
+	// coarse copy of the surface for OcclusionCulling (model units), built
+	// by initBuffers from the packed streams before they are released
+	static constexpr size_t OCCLUDER_TRIANGLES = 512;
+	std::vector<glm::vec3> occluderPositions = {};
+	std::vector<uint32_t> occluderIndices = {};
+
+	BoundingSphere boundingSphere() const {
+		return BoundingSphere::fromBox(boundsMin, boundsMax);
+	}
+
+	void computeBounds() {
+		if (vertices.empty()) return;
+
+		boundsMin = boundsMax = vertices[0];
+		for (const auto& v : vertices) {
+			boundsMin = glm::min(boundsMin, v);
+			boundsMax = glm::max(boundsMax, v);
+		}
+	}
+
+	struct WeldedVertices {
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;   // empty when the model has none
+		std::vector<glm::vec2> texcoords; // empty when the model has none
+		std::vector<unsigned int> indices;
+	};
+
+	WeldedVertices weld() const {
 
-		// Insert vertex attributes (position + normal + texcoord) according to indices
-		// this pmuch negates the whole purpose of indices in the first place
-		// too bad
-		std::vector<float> interleavedAttribs;
-		interleavedAttribs.reserve(vIndices.size() * 8); // 3 pos + 3 normal + 2 texcoord per vertex
+		// Weld corners: every distinct (v, vn, vt) triple becomes one vertex
+		// and the elements index into those
+		auto [ids, firstCorners] = meshOptimizer::weldCornerIds(*this);
 
+		WeldedVertices result;
+		result.indices = std::move(ids);
+
+		auto hasNormal = [&](size_t i) { return i < vnIndices.size() && vnIndices[i] < normals.size(); };
+		auto hasTexcoord = [&](size_t i) { return i < vtIndices.size() && vtIndices[i] < texcoords.size(); };
+
+		bool hasNormals = false, hasTexcoords = false;
 		for (size_t i = 0; i < vIndices.size(); i++) {
+			hasNormals |= hasNormal(i);
+			hasTexcoords |= hasTexcoord(i);
+		}
+
+		result.positions.reserve(firstCorners.size());
+		for (size_t i : firstCorners) {
+
 			// Position (must exist)
-			glm::vec3 vertex = vertices[vIndices[i]];
-			interleavedAttribs.push_back(vertex.x);
-			interleavedAttribs.push_back(vertex.y);
-			interleavedAttribs.push_back(vertex.z);
-
-			// Normal (default if missing)
-			glm::vec3 normal(0, 1, 0);
-			if (i < vnIndices.size() && vnIndices[i] < normals.size()) {
-				normal = normals[vnIndices[i]];
-			}
-			interleavedAttribs.push_back(normal.x);
-			interleavedAttribs.push_back(normal.y);
-			interleavedAttribs.push_back(normal.z);
-
-			// Texture coordinate (default if missing)
-			glm::vec2 texcoord(0, 0);
-			if (i < vtIndices.size() && vtIndices[i] < texcoords.size()) {
-				texcoord = texcoords[vtIndices[i]];
+			result.positions.push_back(vertices[vIndices[i]]);
+
+			// Normal / texture coordinate (default where a corner lacks one)
+			if (hasNormals)
+				result.normals.push_back(hasNormal(i) ? normals[vnIndices[i]] : glm::vec3(0, 1, 0));
+			if (hasTexcoords)
+				result.texcoords.push_back(hasTexcoord(i) ? texcoords[vtIndices[i]] : glm::vec2(0, 0));
+		}
+
+		return result;
+	}
+
+	// buildLods appends simplified index lists (see MeshSimplifier.h) after the full one;
+	// quantize = false keeps float attributes, for meshes that were quantized before
+	void pack(bool buildLods = false, bool quantize = true) {
+		if (packed.attribs) return;
+
+		computeBounds();
+
+		struct Streams {
+			std::vector<unsigned char> attribs;
+			std::vector<unsigned int> indices32;
+			std::vector<unsigned short> indices16;
+		};
+
+		auto streams = std::make_shared<Streams>();
+		WeldedVertices welded = weld();
+
+		// smallest vertex layout within the error bounds, then encode
+		VertexLayout layout = VertexQuantization::choose(welded.positions, welded.normals, welded.texcoords, quantize);
+		size_t weldedCount = welded.positions.size();
+		size_t stride = layout.stride();
+
+		streams->attribs.resize(weldedCount * stride);
+		for (size_t i = 0; i < weldedCount; i++) {
+			unsigned char* vertex = streams->attribs.data() + i * stride;
+			layout.writePosition(vertex, welded.positions[i]);
+			if (!welded.normals.empty()) layout.writeNormal(vertex + layout.normalOffset(), welded.normals[i]);
+			if (!welded.texcoords.empty()) layout.writeTexcoord(vertex + layout.texcoordOffset(), welded.texcoords[i]);
+		}
+
+		lods = { { 0, welded.indices.size(), 0.0f } };
+
+		if (buildLods) {
+			auto chain = meshSimplifier::buildChain(welded.indices, welded.positions);
+
+			for (size_t i = 1; i < chain.size(); i++) {
+				auto& indices = chain[i].indices;
+				meshOptimizer::permuteTriangles(indices, meshOptimizer::tipsify(indices, weldedCount).first);
+
+				lods.push_back({ welded.indices.size(), indices.size(), chain[i].error });
+				welded.indices.insert(welded.indices.end(), indices.begin(), indices.end());
 			}
-			interleavedAttribs.push_back(texcoord.s);
-			interleavedAttribs.push_back(texcoord.t);
 		}
 
-		// Create element indices (sequential since we've deferred the vertex data)
-		std::vector<unsigned int> elementIndices(vIndices.size());
-		for (unsigned int i = 0; i < vIndices.size(); i++) {
-			elementIndices[i] = i;
+		streams->indices32 = std::move(welded.indices);
+		size_t indexCount = streams->indices32.size();
+
+		// 16 bit indices whenever every vertex is addressable with them
+		if (weldedCount < 65536) {
+			streams->indices16.assign(streams->indices32.begin(), streams->indices32.end());
+			streams->indices32 = {};
 		}
 
-		return { interleavedAttribs, elementIndices };
+		bool shortIndices = !streams->indices16.empty();
+
+		packed = {
+			.storage = streams,
+			.attribs = streams->attribs.data(),
+			.indices = shortIndices ? (const void*)streams->indices16.data() : (const void*)streams->indices32.data(),
+			.indexSize = shortIndices ? sizeof(unsigned short) : sizeof(unsigned int),
+			.vertexCount = weldedCount,
+			.indexCount = indexCount,
+			.layout = layout
+		};
+
+		size_t expandedBytes = lods[0].indexCount * (8 * sizeof(float) + sizeof(unsigned int));
+		size_t packedBytes = weldedCount * stride + indexCount * packed.indexSize;
+
+		std::cout
+			<< std::format(
+				"Welded {} -> {} vertices, buffers {:.1f} KB -> {:.1f} KB ({:.0f}% smaller, {} byte vertices, {} bit indices)",
+				lods[0].indexCount, weldedCount,
+				expandedBytes / 1024.0, packedBytes / 1024.0,
+				(expandedBytes > 0) ? 100.0 * (1.0 - double(packedBytes) / expandedBytes) : 0.0,
+				stride,
+				packed.indexSize * 8)
+			<< std::endl;
 	}
 
 	static void toggleAxes() {
@@ -1051,184 +1322,292 @@ struct Model {
 	static void toggleTextures() {
 		Model::showTexture = !Model::showTexture;
 	}
-	
-	void drawAxes() const {
 
-		glPushAttrib(GL_LIGHTING_BIT);
-		glDisable(GL_LIGHTING);
+	static void toggleLod() {
+		Model::lodEnabled = !Model::lodEnabled;
+	}
+
+	// Picks the level for an instance drawn with modelview m, starting from
+	// the level the same instance used last frame
+	unsigned int selectLod(unsigned int current, const glm::mat4& m) const {
 
-		glPushAttrib(GL_CURRENT_BIT);
-		glBegin(GL_LINES);
+		if (!lodEnabled || lods.size() < 2) return 0;
 
-		glColor3f(1.0f, 0.0f, 0.0f);  // Red
-		glVertex3f(0.0f, 0.0f, 0.0f);
-		glVertex3f(1.3f, 0.0f, 0.0f);
+		// closest point of the bounding sphere in eye space
+		glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+		float radius = 0.5f * glm::length(boundsMax - boundsMin);
+		float scale = std::max({ glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2])) });
 
-		glColor3f(0.0f, 1.0f, 0.0f);  // Green
-		glVertex3f(0.0f, 0.0f, 0.0f);
-		glVertex3f(0.0f, 1.3f, 0.0f);
+		glm::vec3 eye = glm::vec3(m * glm::vec4(center, 1.0f));
+		float distance = glm::length(eye) - radius * scale;
+		distance = std::max(distance, static_cast<float>(CameraController::currentProjection.near));
 
-		glColor3f(0.0f, 0.0f, 1.0f);  // Blue
-		glVertex3f(0.0f, 0.0f, 0.0f);
-		glVertex3f(0.0f, 0.0f, 1.3f);
+		float fovY = glm::radians(static_cast<float>(CameraController::currentProjection.fov));
+		float pixelsPerUnit = WindowState::currentHeight / (2.0f * std::tan(fovY / 2.0f)) / distance;
+
+		auto projectedError = [&](unsigned int level) {
+			return lods[level].error * scale * pixelsPerUnit;
+		};
+
+		unsigned int level = std::min<unsigned int>(current, static_cast<unsigned int>(lods.size() - 1));
+		while (level > 0 && projectedError(level) > lodThreshold)
+			level--;
+		while (level + 1 < lods.size() && projectedError(level + 1) < lodThreshold * (1.0f - lodHysteresis))
+			level++;
+
+		return level;
+	}
+	
+	// Object space axes, yaw and pitch circles and vertex normals, built the
+	// first time they are shown from one read of the model's vertices
+	const DebugDraw::Batch& axes() {
 
-		glEnd();
+		if (axesBatch.uploaded()) return axesBatch;
+		if (!buffersInitialised) initBuffers();
+
+		axesBatch.line(glm::vec3(0.0f), { 1.3f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }); // Red
+		axesBatch.line(glm::vec3(0.0f), { 0.0f, 1.3f, 0.0f }, { 0.0f, 1.0f, 0.0f }); // Green
+		axesBatch.line(glm::vec3(0.0f), { 0.0f, 0.0f, 1.3f }, { 0.0f, 0.0f, 1.0f }); // Blue
 
 		// polars
 		static const float radius = 1.3f;
 		static const int slices = 20;
 		static constexpr float step = glm::radians(360.0) / slices;
 
-		// for yaw (in XZ plane)
-		glColor3f(1.0f, 0.0f, 1.0f);
-		glBegin(GL_LINE_LOOP);
-
+		std::vector<glm::vec3> yaw, pitch; // in the XZ and ZY planes
 		for (int i = 0; i < slices; i++) {
-			float yaw = i * step;
-			float x = radius * cos(yaw);
-			float z = radius * sin(yaw);
-			glVertex3f(x, 0.0f, z);
+			yaw.push_back({ radius * cos(i * step), 0.0f, radius * sin(i * step) });
+			pitch.push_back({ 0.0f, radius * sin(i * step), radius * cos(i * step) });
 		}
-		glEnd();
+		axesBatch.polyline(yaw, { 1.0f, 0.0f, 1.0f }, true);
+		axesBatch.polyline(pitch, { 1.0f, 0.0f, 1.0f }, true);
 
-		// for pitch (in ZY plane)
-		glBegin(GL_LINE_LOOP);
+		if (layout.normal != VertexLayout::Normal::NONE) {
+			const size_t stride = layout.stride();
+			std::vector<unsigned char> data = MeshArena::read(MeshArena::vertices, vertexBase, vertexCount * stride);
 
-		for (int i = 0; i < slices; i++) {
-			float pitch = i * step;
-			float y = radius * sin(pitch);
-			float z = radius * cos(pitch);
-			glVertex3f(0.0f, y, z);
+			for (size_t i = 0; i < vertexCount; i++) {
+				const unsigned char* vertex = data.data() + i * stride;
+				glm::vec3 p = layout.readPosition(vertex);
+				glm::vec3 n = layout.readNormal(vertex + layout.normalOffset());
+
+				// line from vertex to vertex + normal*0.2
+				axesBatch.line(p, p + n * 0.2f, { 1.0f, 0.5f, 0.0f }); // Orange
+			}
 		}
 
-		glEnd();
-		
+		axesBatch.upload();
+		return axesBatch;
+	}
 
-		// Draw normals from GPU buffer
-		if (buffersInitialised) {
-			glColor3f(1.0f, 0.5f, 0.0f); // Orange
+	void initBuffers() {
+		if (buffersInitialised) return;
 
-			// Bind the vertex buffer
-			glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+		pack();
 
-			// Get the size of the buffer
-			GLint bufferSize;
-			glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
+		// the index buffer binding below is recorded in it
+		if (GLState::vertexArrays) {
+			glGenVertexArrays(1, &vertexArrayID);
+			GLState::bindVertexArray(vertexArrayID);
+		}
 
-			// Map the buffer to client memory
-			float* bufferData = (float*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
-			const size_t stride = 8; // 3 pos + 3 normal + 2 texcoord
+		// Append interleaved vertex data and index data to the shared buffers
+		vertexBase = MeshArena::addVertices(packed.attribs, packed.vertexCount * packed.layout.stride(), packed.layout.stride());
+		indexBase = MeshArena::addIndices(packed.indices, packed.indexCount * packed.indexSize, packed.indexSize);
 
-			if (bufferData) {
-				glBegin(GL_LINES);
+		buildOccluder();
 
-				for (size_t i = 0; i < vIndices.size(); i++) {
-					// Get vertex position (first 3 floats)
-					float x = bufferData[i * stride + 0];
-					float y = bufferData[i * stride + 1];
-					float z = bufferData[i * stride + 2];
+		vertexCount = packed.vertexCount;
+		elementCount = packed.indexCount;
+		elementType = (packed.indexSize == sizeof(unsigned short)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		layout = packed.layout;
+		packed = {}; // the GL owns a copy now (also unmaps cached files)
 
-					// Get normal (next 3 floats)
-					float nx = bufferData[i * stride + 3];
-					float ny = bufferData[i * stride + 4];
-					float nz = bufferData[i * stride + 5];
+		// pointers and enables are set once, the draws only bind the object
+		if (vertexArrayID) setupArrays();
 
-					// Draw line from vertex to vertex + normal*0.2
-					glVertex3f(x, y, z);
-					glVertex3f(x + nx * 0.2f, y + ny * 0.2f, z + nz * 0.2f);
-				}
-				glEnd();
+		unbindBuffers();
 
-				glUnmapBuffer(GL_ARRAY_BUFFER);
-			}
+		buffersInitialised = true;
+	}
+
+	// The finest level within OCCLUDER_TRIANGLES, pulled towards the center
+	// by that level's error so that it stays inside the full detail surface
+	// (exactly so for convex models) and never hides more than the model would
+	void buildOccluder() {
+
+		Lod range = lods.empty() ? Lod{ 0, packed.indexCount, 0.0f } : lods[0];
+		for (size_t level = 1; level < lods.size() && range.indexCount / 3 > OCCLUDER_TRIANGLES; level++)
+			range = lods[level];
+
+		const unsigned char* attribs = static_cast<const unsigned char*>(packed.attribs);
+		const size_t stride = packed.layout.stride();
+		const glm::vec3 center = boundingSphere().center;
 
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		std::vector<uint32_t> remap(packed.vertexCount, ~0u);
+		occluderPositions.clear();
+		occluderIndices.clear();
+		occluderIndices.reserve(range.indexCount);
+
+		for (size_t i = range.firstIndex; i < range.firstIndex + range.indexCount; i++) {
+			uint32_t v = (packed.indexSize == sizeof(unsigned short))
+				? static_cast<const unsigned short*>(packed.indices)[i]
+				: static_cast<const unsigned int*>(packed.indices)[i];
+
+			if (remap[v] == ~0u) {
+				remap[v] = static_cast<uint32_t>(occluderPositions.size());
+
+				glm::vec3 p = packed.layout.readPosition(attribs + v * stride);
+				float distance = glm::length(p - center);
+				if (distance > 0.0f) p = center + (p - center) * std::max(0.0f, 1.0f - range.error / distance);
+				occluderPositions.push_back(p);
+			}
+			occluderIndices.push_back(remap[v]);
 		}
+	}
 
-		glPopAttrib(); // GL_CURRENT_BIT
-		glPopAttrib(); // GL_LIGHTING_BIT
+	void cleanupBuffers() {
+		// the buffers themselves are the arena's
+		if (vertexArrayID) glDeleteVertexArrays(1, &vertexArrayID);
+		vertexArrayID = 0;
+		axesBatch.destroy();
+		buffersInitialised = false;
 
+		// some of them may have been bound
+		GLState::reset();
 	}
 
-	void initBuffers() {
-		if (buffersInitialised) return;
+	// Material, texture and vertex arrays shared by the plain and instanced draws
+	// The colours are stored as RGB and the GL reads four floats, so they go
+	// through opaque copies
+	static void applyMaterial(const Material& material) {
+		auto rgba = [](const GLfloat (&rgb)[3]) { return std::array<GLfloat, 4>{ rgb[0], rgb[1], rgb[2], 1.0f }; };
+		GLState::material(GL_FRONT, GL_DIFFUSE, rgba(material.diffuse).data());
+		GLState::material(GL_FRONT, GL_AMBIENT, rgba(material.ambient).data());
+		GLState::material(GL_FRONT, GL_SPECULAR, rgba(material.specular).data());
+		GLState::material(GL_FRONT, GL_SHININESS, material.shininess);
+		GLState::material(GL_FRONT, GL_EMISSION, rgba(material.emissive).data());
+	}
 
-		// Generate buffers
-		glGenBuffers(1, &vertexBufferID);
-		glGenBuffers(1, &indexBufferID);
+	// Vertex and index buffers with their client arrays, pointing at first
+	// (a byte offset into the arena's vertex buffer). Arrays the layout lacks
+	// are switched off, so it can follow another model's bind directly.
+	static void setupArrays(const VertexLayout& layout, size_t first) {
 
-		auto [interleavedVertexAttribs, elementIndices] = interleavedData();
+		const GLsizei stride = static_cast<GLsizei>(layout.stride());
 
-		// Upload interleaved vertex data
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER,
-			interleavedVertexAttribs.size() * sizeof(float),
-			interleavedVertexAttribs.data(),
-			GL_STATIC_DRAW);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, MeshArena::vertices.id);
 
-		// Upload index data
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-			elementIndices.size() * sizeof(unsigned int),
-			elementIndices.data(),
-			GL_STATIC_DRAW);
+		// Position, quantized positions are scaled back by the modelview
+		GLState::enableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(3, layout.positionType(), stride, (void*)first);
 
-		buffersInitialised = true;
+		// Normal
+		if (layout.normal != VertexLayout::Normal::NONE) {
+			GLState::enableClientState(GL_NORMAL_ARRAY);
+			glNormalPointer(layout.normalType(), stride, (void*)(first + layout.normalOffset()));
+		}
+		else GLState::disableClientState(GL_NORMAL_ARRAY);
+
+		// Texture coordinate
+		if (layout.texcoord != VertexLayout::Texcoord::NONE) {
+			GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+			glTexCoordPointer(2, layout.texcoordType(), stride, (void*)(first + layout.texcoordOffset()));
+		}
+		else GLState::disableClientState(GL_TEXTURE_COORD_ARRAY);
+
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, MeshArena::indices.id);
 	}
 
-	void cleanupBuffers() {
-		if (vertexBufferID) glDeleteBuffers(1, &vertexBufferID);
-		if (indexBufferID) glDeleteBuffers(1, &indexBufferID);
-		vertexBufferID = indexBufferID = 0;
-		buffersInitialised = false;
+	void setupArrays() const {
+		setupArrays(layout, vertexBase);
 	}
 
-	void draw(unsigned int textureID = 0, Material material = Material()) {
+	// the vertex array object, or the arrays set up by hand
+	void bindBuffers() const {
 
-		if (buffersInitialised == false) initBuffers();
-		if (showAxes) drawAxes();
+		if (vertexArrayID) GLState::bindVertexArray(vertexArrayID);
+		else setupArrays();
 
-		const size_t stride = 8 * sizeof(float);
+		// constants for missing attributes are current state, not array state
+		if (layout.normal == VertexLayout::Normal::NONE) glNormal3f(0.0f, 1.0f, 0.0f);
+		if (layout.texcoord == VertexLayout::Texcoord::NONE) glTexCoord2f(0.0f, 0.0f);
+	}
 
-		glPushAttrib(GL_LIGHTING_BIT);
-		
-		glMaterialfv(GL_FRONT, GL_DIFFUSE, material.diffuse);
-		glMaterialfv(GL_FRONT, GL_AMBIENT, material.ambient);
-		glMaterialfv(GL_FRONT, GL_SPECULAR, material.specular);
-		glMaterialfv(GL_FRONT, GL_SHININESS, material.shininess);
-		glMaterialfv(GL_FRONT, GL_EMISSION, material.emissive);
+	// back to no arrays, so nothing else can change a model's vertex array object
+	static void unbindBuffers() {
+		if (GLState::vertexArrays) {
+			GLState::bindVertexArray(0);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+		GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		GLState::disableClientState(GL_VERTEX_ARRAY);
+		GLState::disableClientState(GL_NORMAL_ARRAY);
+		GLState::disableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
 
-		// Bind the VBO and set up pointers
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	// every lit draw sets its own material, so it is left in place for the
+	// cache to skip next time instead of being pushed and popped around each draw
+	void bindArrays(unsigned int textureID, const Material& material) const {
+
+		applyMaterial(material);
+
+		GLState::enable(GL_TEXTURE_2D);
+		GLState::bindTexture(GL_TEXTURE_2D, (showTexture) ? textureID : 0);
+
+		bindBuffers();
+	}
+
+	void unbindArrays() const {
+		unbindBuffers();
+		GLState::disable(GL_TEXTURE_2D);
+	}
+
+	Lod lodRange(unsigned int lod) const {
+		return (lod < lods.size()) ? lods[lod] : Lod{ 0, elementCount, 0.0f };
+	}
+
+	const void* indexOffset(const Lod& range) const {
+		return (const void*)(indexBase + range.firstIndex * indexSize());
+	}
+
+	size_t indexSize() const {
+		return (elementType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+	}
 
-		// Position (offset 0)
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(3, GL_FLOAT, stride, 0);
+	void draw(unsigned int textureID = 0, Material material = Material(), unsigned int lod = 0) {
 
-		// Normal (offset 3 floats)
-		glEnableClientState(GL_NORMAL_ARRAY);
-		glNormalPointer(GL_FLOAT, stride, (void*)(3 * sizeof(float)));
+		if (buffersInitialised == false) initBuffers();
+		if (showAxes) axes().draw();
 
-		// Texture coordinate (offset 6 floats)
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, (showTexture) ? textureID : 0);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(2, GL_FLOAT, stride, (void*)(6 * sizeof(float)));
+		bindArrays(textureID, material);
 
 		// Draw elements
-		int vertexCount = vIndices.size();
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glDrawElements(GL_TRIANGLES, vertexCount, GL_UNSIGNED_INT, 0);
+		glPushMatrix();
+		layout.applyDecode();
+		Lod range = lodRange(lod);
+		glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(range.indexCount), elementType, indexOffset(range));
+		glPopMatrix();
 
-		// Clean up
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		glDisableClientState(GL_VERTEX_ARRAY);
-		glDisableClientState(GL_NORMAL_ARRAY);
-		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-		glDisable(GL_TEXTURE_2D);
+		trianglesDrawn += range.indexCount / 3;
+		drawCalls++;
 
-		glPopAttrib();
+		unbindArrays();
+	}
+
+	// One call for every instance, between bindArrays and unbindArrays. The
+	// caller sets up the instance attributes and the program that does the
+	// position decode and the per-instance transform (see InstanceBatcher)
+	void drawInstanced(unsigned int lod, size_t instances) {
+
+		Lod range = lodRange(lod);
+		glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(range.indexCount), elementType, indexOffset(range),
+			static_cast<GLsizei>(instances));
+
+		trianglesDrawn += range.indexCount / 3 * instances;
+		drawCalls++;
 	}
 };
 
@@ -1237,9 +1616,28 @@ struct ModelStorage {
 
 	inline static std::unordered_map<std::string, Model> models;
 
-	static void draw(std::string modelFilename, unsigned int textureID = 0, Material material = Material()) {
-		if (models.contains(modelFilename))
-			models[modelFilename].draw(textureID, material);
+	// run meshOptimizer on freshly parsed models (cached .3db entries already are)
+	inline static bool optimizeOnLoad = true;
+	// build a chain of simplified levels of detail for freshly parsed models
+	inline static bool lodsOnLoad = true;
+
+	// lod holds the level the calling instance drew last frame and is updated
+	static void draw(std::string modelFilename, unsigned int textureID = 0, Material material = Material(), unsigned int* lod = nullptr) {
+		auto it = models.find(modelFilename);
+		if (it == models.end()) return;
+
+		draw(it->second, textureID, material, lod);
+	}
+
+	static void draw(Model& model, unsigned int textureID, const Material& material, unsigned int* lod) {
+		unsigned int level = 0;
+		if (lod && model.buffersInitialised && model.lods.size() > 1) {
+			float modelview[16];
+			glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+			level = *lod = model.selectLod(*lod, glm::make_mat4(modelview));
+		}
+
+		model.draw(textureID, material, level);
 	}
 
 	static void initBuffers() {
@@ -1252,15 +1650,234 @@ struct ModelStorage {
 		for (auto& [filename, model] : models) {
 			model.cleanupBuffers();
 		}
+		MeshArena::cleanup();
 	}
 
+	// bumped whenever a model arrives, so cached scene bounds know to refresh
+	inline static unsigned int generation = 0;
+
 	static void load(std::string modelFilename, Model model) {
-		if (!models.contains(modelFilename))
-			models.emplace(modelFilename, model);
+		if (!models.contains(modelFilename)) {
+			models.emplace(modelFilename, std::move(model));
+			generation++;
+		}
+	}
+
+	static BoundingSphere bounds(const std::string& modelFilename) {
+		auto it = models.find(modelFilename);
+		return (it != models.end()) ? it->second.boundingSphere() : BoundingSphere();
 	}
 
 };
 
+// Plain (non instanced) draws are collected during the scene walk and sorted
+// by a 64 bit key before submission:
+//
+//   [pass:2][texture:12][material:12][mesh:14][depth:24]
+//
+// so draws sharing a texture, material and mesh end up next to each other,
+// nearest first. Texture, material and mesh are numbered per frame in order
+// of first appearance (values past a field's range share its last number,
+// which only makes the grouping coarser). Submission remembers what is bound
+// and skips the texture bind, the five glMaterialfv calls and the buffer and
+// client array setup whenever the next draw would set them to the same thing.
+struct RenderQueue {
+
+	inline static bool sorting = true;
+
+	// per frame statistics: texture, material and buffer switches issued, what
+	// the same draws would have needed in scene order, and without any tracking
+	// (all three on every draw)
+	inline static size_t stateChanges = 0;
+	inline static size_t sceneOrderChanges = 0;
+	inline static size_t untrackedChanges = 0;
+
+	enum class Pass : uint64_t { SOLID = 0 };
+
+	struct Item {
+		Model* model;
+		unsigned int textureID;
+		uint32_t material; // index into materials
+		unsigned int lod;
+		glm::mat4 modelview;
+	};
+
+	struct Entry {
+		uint64_t key;
+		uint32_t item;
+	};
+
+	// emptied (not freed) every frame
+	inline static std::vector<Item> items;
+	inline static std::vector<Entry> entries, scratch;
+	inline static std::vector<Material> materials;
+
+	inline static std::unordered_map<unsigned int, uint32_t> textureSlots;
+	inline static std::unordered_map<uint64_t, uint32_t> materialSlots; // by hash of the bytes
+	inline static std::unordered_map<const Model*, uint32_t> meshSlots;
+
+	static void toggleSorting() {
+		RenderQueue::sorting = !RenderQueue::sorting;
+	}
+
+	// same contract as ModelStorage::draw, with the modelview given instead of taken from the GL
+	static void add(Model& model, unsigned int textureID, const Material& material, unsigned int* lod, const glm::mat4& modelview) {
+		if (!model.buffersInitialised) model.initBuffers();
+
+		unsigned int level = 0;
+		if (model.lods.size() > 1)
+			level = *lod = model.selectLod(*lod, modelview);
+
+		push(model, textureID, material, level, modelview);
+	}
+
+	// a level already chosen
+	static void push(Model& model, unsigned int textureID, const Material& material, unsigned int lod, const glm::mat4& modelview) {
+
+		uint32_t texture = textureSlots.try_emplace(textureID, static_cast<uint32_t>(textureSlots.size())).first->second;
+		uint32_t mesh = meshSlots.try_emplace(&model, static_cast<uint32_t>(meshSlots.size())).first->second;
+		uint32_t slot = materialSlot(material);
+
+		float distance = -(modelview * glm::vec4(model.boundingSphere().center, 1.0f)).z;
+		float depth = distance / static_cast<float>(CameraController::currentProjection.far);
+
+		entries.push_back({ makeKey(Pass::SOLID, texture, slot, mesh, depth), static_cast<uint32_t>(items.size()) });
+		items.push_back({ &model, textureID, slot, lod, modelview });
+	}
+
+	static uint64_t makeKey(Pass pass, uint32_t texture, uint32_t material, uint32_t mesh, float depth) {
+		auto field = [](uint64_t value, int bits) { return std::min<uint64_t>(value, (uint64_t(1) << bits) - 1); };
+		uint64_t quantizedDepth = static_cast<uint64_t>(glm::clamp(depth, 0.0f, 1.0f) * double((1 << 24) - 1));
+
+		return (static_cast<uint64_t>(pass) << 62)
+			| (field(texture, 12) << 50)
+			| (field(material, 12) << 38)
+			| (field(mesh, 14) << 24)
+			| quantizedDepth;
+	}
+
+	// identical materials share a slot, so comparing slots is comparing materials
+	static uint32_t materialSlot(const Material& material) {
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(Material); i++) {
+			hash ^= reinterpret_cast<const unsigned char*>(&material)[i];
+			hash *= 1099511628211ull;
+		}
+
+		auto [it, added] = materialSlots.try_emplace(hash, static_cast<uint32_t>(materials.size()));
+		if (added) {
+			materials.push_back(material);
+		}
+		else if (std::memcmp(&materials[it->second], &material, sizeof(Material)) != 0) {
+			// hash collision, give it a slot of its own (only costs an extra upload)
+			materials.push_back(material);
+			return static_cast<uint32_t>(materials.size() - 1);
+		}
+		return it->second;
+	}
+
+	// LSD radix sort on the keys, one byte per pass, skipping bytes every key shares;
+	// stable, so equal keys keep scene order
+	static void sort() {
+		scratch.resize(entries.size());
+
+		for (int shift = 0; shift < 64; shift += 8) {
+			size_t counts[256] = {};
+			for (const auto& e : entries)
+				counts[(e.key >> shift) & 0xFF]++;
+
+			if (counts[(entries[0].key >> shift) & 0xFF] == entries.size()) continue;
+
+			size_t offset = 0;
+			for (auto& count : counts) {
+				size_t n = count;
+				count = offset;
+				offset += n;
+			}
+			for (const auto& e : entries)
+				scratch[counts[(e.key >> shift) & 0xFF]++] = e;
+
+			entries.swap(scratch);
+		}
+	}
+
+	// switches needed to draw the items as they were queued
+	static size_t countSceneOrderChanges() {
+		const Model* model = nullptr;
+		unsigned int texture = ~0u;
+		uint32_t material = ~0u;
+		size_t changes = 0;
+
+		for (const auto& item : items) {
+			changes += (item.model != model) + (item.textureID != texture) + (item.material != material);
+			model = item.model;
+			texture = item.textureID;
+			material = item.material;
+		}
+		return changes;
+	}
+
+	// leaves the view matrix loaded
+	static void flush(const glm::mat4& view) {
+
+		stateChanges = sceneOrderChanges = untrackedChanges = 0;
+		if (items.empty()) return;
+
+		if (sorting) sort();
+		sceneOrderChanges = countSceneOrderChanges();
+		untrackedChanges = 3 * items.size();
+
+		GLState::pushAttrib(GL_LIGHTING_BIT | GL_CURRENT_BIT | GL_ENABLE_BIT | GL_TEXTURE_BIT);
+		GLState::enable(GL_TEXTURE_2D);
+
+		const Model* boundModel = nullptr;
+		unsigned int boundTexture = ~0u;
+		uint32_t boundMaterial = ~0u;
+
+		for (const auto& entry : entries) {
+			const Item& item = items[entry.item];
+			Model& model = *item.model;
+
+			if (item.material != boundMaterial) {
+				Model::applyMaterial(materials[item.material]);
+				boundMaterial = item.material;
+				stateChanges++;
+			}
+			if (item.textureID != boundTexture) {
+				GLState::bindTexture(GL_TEXTURE_2D, (Model::showTexture) ? item.textureID : 0);
+				boundTexture = item.textureID;
+				stateChanges++;
+			}
+			if (&model != boundModel) {
+				model.bindBuffers();
+				boundModel = &model;
+				stateChanges++;
+			}
+
+			glLoadMatrixf(glm::value_ptr(item.modelview));
+			model.layout.applyDecode();
+
+			Model::Lod range = model.lodRange(item.lod);
+			glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(range.indexCount), model.elementType, model.indexOffset(range));
+
+			Model::trianglesDrawn += range.indexCount / 3;
+			Model::drawCalls++;
+		}
+
+		Model::unbindBuffers();
+
+		GLState::popAttrib();
+		glLoadMatrixf(glm::value_ptr(view));
+
+		items.clear();
+		entries.clear();
+		materials.clear();
+		textureSlots.clear();
+		materialSlots.clear();
+		meshSlots.clear();
+	}
+};
+
 struct Group {
 
 	struct ModelReference {
@@ -1269,6 +1886,8 @@ struct Group {
 		std::string textureFilename = "";
 		Material material = Material();
 
+		unsigned int lod = 0; // level drawn last frame
+
 	};
 
 	std::vector<Transform> transforms = {};
@@ -1276,6 +1895,12 @@ struct Group {
 
 	std::vector<ModelReference> modelReferences;
 
+	inline static bool cullingEnabled = true;
+
+	// per frame statistics
+	inline static size_t objectsDrawn = 0;
+	inline static size_t objectsCulled = 0;
+
 	inline static std::vector<Transform> debugTransforms = {
 		/*
 		AnimatedRotation{
@@ -1299,69 +1924,9 @@ struct Group {
 		
 	};
 
-	void applyTransforms(float tDelta) {
-
-		glPushAttrib(GL_LIGHTING_BIT);
-		glDisable(GL_LIGHTING);
-
-		struct TransformMapping {
-			float tDelta;
-
-			TransformMapping(float delta) : tDelta(delta) {}
-
-			void operator()(Translation& t)          { t.apply(); }
-			void operator()(Rotation& r)             { r.apply(); }
-			void operator()(Scaling& s)              { s.apply(); }
-			void operator()(AnimatedTranslation& at) { at.apply(tDelta); }
-			void operator()(AnimatedRotation& ar)    { ar.apply(tDelta); }
-		};
-
-		for (auto& t : transforms)
-			std::visit(TransformMapping(tDelta), t);
-
-		glPopAttrib();
-	}
-
-	void render(float tDelta) {
-
-		glPushMatrix();
-		glPushAttrib(GL_CURRENT_BIT);
-
-		applyTransforms(tDelta);
-
-		for (auto mref : modelReferences) {
-
-			std::string mtlString = std::format(
-				"Material( diff({},{},{}) amb({},{},{}) spc({},{},{}) ems({},{},{}) shine({}) )",
-				mref.material.diffuse[0],  mref.material.diffuse[1],  mref.material.diffuse[2],
-				mref.material.ambient[0],  mref.material.ambient[1],  mref.material.ambient[2],
-				mref.material.specular[0], mref.material.specular[1], mref.material.specular[2],
-				mref.material.emissive[0], mref.material.emissive[1], mref.material.emissive[2],
-				mref.material.shininess[0]
-			);
-
-			ModelStorage::draw(mref.modelFilename, Texture::id(mref.textureFilename), mref.material);
-		}
-
-		for (auto& subgroup : subgroups)
-			subgroup.render(tDelta);
-
-		glPopAttrib();
-		glPopMatrix();
+	static void toggleCulling() {
+		Group::cullingEnabled = !Group::cullingEnabled;
 	}
 };
 
-struct World {
-
-	std::vector<Group> groups = {};
-
-	void renderGroups(float tDelta) {
-
-		for (auto& g : groups)
-			g.render(tDelta);
-	}
-
-};
-
-
 #endif
\ No newline at end of file
@@ -0,0 +1,585 @@
+#ifndef CORERENDERER_H
+#define CORERENDERER_H
+
+#include <cmath>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <format>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "InstanceBatcher.h"
+#include "LightClusters.h"
+
+////////////////////////////////////////////////////////////
+// Programmable renderer
+//
+// Programmable alternative to the fixed function path, in GLSL 3.30 core:
+// nothing is read from the built-in matrix, light or material state. The
+// camera and the lights go into a uniform buffer once per frame, the light
+// positions already in eye space as glLightfv would have stored them.
+// Materials sit in a buffer texture that only changes when a new one shows
+// up, and all a draw carries is its object -> world matrix and an index into
+// it, in a per-frame buffer texture found through gl_InstanceID. Draws are
+// sorted by vertex format, texture and mesh, and each run of the same mesh
+// and level is one instanced call, so the loop is a vertex array bind per
+// format, a texture bind per texture and two uniforms and a draw per run.
+// Lights that reach the whole scene stay per vertex, as in the fixed
+// pipeline, which remains the default and is still used for comparison.
+// Lights with a range have no such limit of eight: they
+// are binned into LightClusters every frame and each fragment lights itself
+// with the ones listed for its cluster, so it pays for the lights around it
+// and not for every light in the scene.
+////////////////////////////////////////////////////////////
+
+struct CoreRenderer {
+
+	inline static bool enabled = false;
+	inline static bool supported = false;
+
+	static constexpr int MAX_LIGHTS = 8;
+	static constexpr GLuint FRAME_BINDING = 0;
+
+	static constexpr GLuint POSITION_LOCATION = 0;
+	static constexpr GLuint NORMAL_LOCATION = 1;
+	static constexpr GLuint TEXCOORD_LOCATION = 2;
+
+	// texture units, the diffuse map keeps unit 0 like everywhere else
+	static constexpr GLuint INSTANCE_UNIT = 1;
+	static constexpr GLuint MATERIAL_UNIT = 2;
+	static constexpr GLuint LIGHT_UNIT = 3;
+	static constexpr GLuint CLUSTER_UNIT = 4;
+	static constexpr GLuint LIGHT_INDEX_UNIT = 5;
+
+	// std140, as the Frame block in vertexSource
+	struct LightData {
+		glm::vec4 position;      // eye space, w = 0 for directional lights
+		glm::vec4 spotDirection; // eye space, w = cosine of the cutoff (-2 without one)
+		glm::vec4 attenuation;   // constant, linear, quadratic, spot exponent
+		glm::vec4 ambient, diffuse, specular;
+	};
+
+	struct FrameData {
+		glm::mat4 projection;
+		glm::mat4 view;
+		glm::vec4 sceneAmbient;
+		LightData lights[MAX_LIGHTS];
+		GLint lightCount;
+		GLint lighting;
+		GLint padding[2];
+		glm::vec4 clusterScale;  // pixels per tile x and y, slice scale and bias
+		glm::ivec4 clusterCount; // tiles x and y, slices, clustered lights
+	};
+
+	// three texels of the clustered light buffer
+	struct ClusteredLightData {
+		glm::vec4 position;      // eye space, w = range
+		glm::vec4 color;         // w = spot exponent
+		glm::vec4 spotDirection; // eye space, w = cosine of the cutoff (-2 without one)
+	};
+
+	// four texels of the material buffer
+	struct MaterialData {
+		glm::vec4 diffuse, ambient, specular, emission; // emission.w is the shininess
+	};
+
+	// five texels of the instance buffer: the matrix columns, then the material index in x
+	struct InstanceData {
+		glm::mat4 world;
+		glm::vec4 material;
+	};
+
+	struct Item {
+		Model* model;
+		unsigned int textureID;
+		unsigned int lod;
+		uint32_t material;
+		glm::mat4 world;
+	};
+
+	// shared by both stages, which must declare the block alike
+	inline static const char* frameSource = R"(
+		#version 330 core
+
+		struct Light {
+			vec4 position;
+			vec4 spotDirection;
+			vec4 attenuation;
+			vec4 ambient, diffuse, specular;
+		};
+
+		layout(std140) uniform Frame {
+			mat4 projection;
+			mat4 view;
+			vec4 sceneAmbient;
+			Light lights[8];
+			int lightCount;
+			int lighting;
+			vec4 clusterScale;
+			ivec4 clusterCount;
+		};
+	)";
+
+	inline static const char* vertexSource = R"(
+		uniform samplerBuffer instances;
+		uniform samplerBuffer materials;
+		uniform int instanceBase;
+		uniform vec4 decode; // quantized positions: offset xyz, scale w
+
+		layout(location = 0) in vec3 position;
+		layout(location = 1) in vec3 normal;
+		layout(location = 2) in vec2 texcoord;
+
+		out vec4 color;
+		out vec2 uv;
+		out vec3 eyePosition;
+		out vec3 eyeNormal;
+		flat out int materialOffset;
+
+		void main() {
+			int instance = (instanceBase + gl_InstanceID) * 5;
+			mat4 world = mat4(
+				texelFetch(instances, instance),
+				texelFetch(instances, instance + 1),
+				texelFetch(instances, instance + 2),
+				texelFetch(instances, instance + 3));
+
+			vec4 eye = view * (world * vec4(decode.xyz + decode.w * position, 1.0));
+			gl_Position = projection * eye;
+			uv = texcoord;
+			eyePosition = eye.xyz;
+
+			int material = materialOffset = int(texelFetch(instances, instance + 4).x) * 4;
+
+			if (lighting == 0) {
+				color = vec4(1.0);
+				eyeNormal = vec3(0.0, 0.0, 1.0);
+				return;
+			}
+
+			vec4 diffuseColor = texelFetch(materials, material);
+			vec4 ambientColor = texelFetch(materials, material + 1);
+			vec4 specularColor = texelFetch(materials, material + 2);
+			vec4 emission = texelFetch(materials, material + 3);
+			float shininess = emission.w;
+
+			// inverse transpose up to scale (cofactors), sign kept for mirroring transforms
+			mat3 m = mat3(world);
+			mat3 cofactors = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+			float handedness = sign(dot(m[0], cofactors[0]));
+			vec3 n = eyeNormal = normalize(mat3(view) * (handedness * (cofactors * normal)));
+
+			// GL_SINGLE_COLOR, non local viewer
+			vec4 sum = emission + ambientColor * sceneAmbient;
+			for (int i = 0; i < lightCount; i++) {
+
+				vec3 l;
+				float attenuation = 1.0;
+
+				if (lights[i].position.w == 0.0) {
+					l = normalize(lights[i].position.xyz);
+				}
+				else {
+					vec3 toLight = lights[i].position.xyz - eye.xyz;
+					float d = length(toLight);
+					l = toLight / d;
+					attenuation = 1.0 / dot(lights[i].attenuation.xyz, vec3(1.0, d, d * d));
+
+					float spot = dot(-l, normalize(lights[i].spotDirection.xyz));
+					float exponent = lights[i].attenuation.w;
+					attenuation *= (spot < lights[i].spotDirection.w) ? 0.0 : (exponent > 0.0) ? pow(spot, exponent) : 1.0;
+				}
+
+				float diffuse = max(dot(n, l), 0.0);
+				vec4 term = ambientColor * lights[i].ambient + diffuse * diffuseColor * lights[i].diffuse;
+				if (diffuse > 0.0) {
+					float highlight = max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0);
+					term += ((shininess > 0.0) ? pow(highlight, shininess) : 1.0) * specularColor * lights[i].specular;
+				}
+				sum += attenuation * term;
+			}
+
+			color = vec4(clamp(sum.rgb, 0.0, 1.0), diffuseColor.a);
+		}
+	)";
+
+	// the clustered lights on top of the vertex colour, then GL_MODULATE
+	inline static const char* fragmentSource = R"(
+		uniform sampler2D diffuseMap;
+		uniform bool textured;
+		uniform samplerBuffer materials;
+		uniform samplerBuffer clusteredLights;
+		uniform usamplerBuffer clusters;
+		uniform usamplerBuffer lightIndices;
+
+		in vec4 color;
+		in vec2 uv;
+		in vec3 eyePosition;
+		in vec3 eyeNormal;
+		flat in int materialOffset;
+
+		out vec4 fragColor;
+
+		vec3 clustered() {
+			ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterScale.xy), clusterCount.xy - 1);
+			int slice = clamp(int(log(-eyePosition.z) * clusterScale.z + clusterScale.w), 0, clusterCount.z - 1);
+			uvec2 cluster = texelFetch(clusters, tile.x + clusterCount.x * (tile.y + clusterCount.y * slice)).xy;
+			if (cluster.y == 0u) return vec3(0.0);
+
+			vec4 diffuseColor = texelFetch(materials, materialOffset);
+			vec4 specularColor = texelFetch(materials, materialOffset + 2);
+			float shininess = texelFetch(materials, materialOffset + 3).w;
+			vec3 n = normalize(eyeNormal);
+			if (!gl_FrontFacing) n = -n;
+
+			vec3 sum = vec3(0.0);
+			for (uint i = cluster.x; i < cluster.x + cluster.y; i++) {
+				int light = int(texelFetch(lightIndices, int(i)).x) * 3;
+				vec4 position = texelFetch(clusteredLights, light);
+
+				vec3 toLight = position.xyz - eyePosition;
+				float d = length(toLight) / position.w;
+				if (d >= 1.0) continue;
+
+				vec4 lightColor = texelFetch(clusteredLights, light + 1);
+				vec4 spotDirection = texelFetch(clusteredLights, light + 2);
+				vec3 l = normalize(toLight);
+
+				// the fixed pipeline's 1 / (1 + 9 (d / range)^2), windowed to reach 0 at the range
+				float window = clamp(1.0 - d * d * d * d, 0.0, 1.0);
+				float attenuation = window * window / (1.0 + 9.0 * d * d);
+
+				float spot = dot(-l, spotDirection.xyz);
+				attenuation *= (spot < spotDirection.w) ? 0.0 : (lightColor.w > 0.0) ? pow(spot, lightColor.w) : 1.0;
+
+				float diffuse = max(dot(n, l), 0.0);
+				if (diffuse <= 0.0 || attenuation <= 0.0) continue;
+
+				float highlight = max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0);
+				sum += attenuation * lightColor.rgb * (diffuse * diffuseColor.rgb + ((shininess > 0.0) ? pow(highlight, shininess) : 1.0) * specularColor.rgb);
+			}
+			return sum;
+		}
+
+		void main() {
+			vec4 lit = color;
+			if (lighting != 0 && clusterCount.w > 0)
+				lit.rgb = clamp(lit.rgb + clustered(), 0.0, 1.0);
+			fragColor = textured ? lit * texture(diffuseMap, uv) : lit;
+		}
+	)";
+
+	inline static ShaderProgram program;
+	inline static GLuint frameBufferID = 0;
+	inline static GLuint instanceBufferID = 0, instanceTextureID = 0;
+	inline static GLuint materialBufferID = 0, materialTextureID = 0;
+	inline static GLuint lightBufferID = 0, lightTextureID = 0;
+	inline static GLuint clusterBufferID = 0, clusterTextureID = 0;
+	inline static GLuint lightIndexBufferID = 0, lightIndexTextureID = 0;
+	inline static std::unordered_map<uint32_t, GLuint> formatArrays; // vertex array object per vertex format
+
+	// material bytes -> index, kept for the whole run
+	inline static std::unordered_map<std::string, uint32_t> materialIndices;
+	inline static std::vector<MaterialData> materialTable;
+	inline static bool materialsChanged = false;
+
+	// emptied (not freed) every frame
+	inline static std::vector<Item> items;
+	inline static std::vector<InstanceData> instances;
+	inline static std::vector<LightClusters::Light> boundedLights;
+	inline static std::vector<ClusteredLightData> clusteredLights;
+	inline static glm::mat4 view = glm::mat4(1.0f);
+
+	inline static LightClusters clusters; // also the binning statistics for the HUD
+
+	static bool active() {
+		return enabled && supported;
+	}
+
+	static void toggle() {
+		CoreRenderer::enabled = !CoreRenderer::enabled;
+	}
+
+	// after glewInit
+	static void detectSupport() {
+		supported = false;
+		if (!GLEW_VERSION_3_3) {
+			std::cout << "Programmable renderer unavailable (needs OpenGL 3.3), using the fixed function pipeline" << std::endl;
+			return;
+		}
+
+		try {
+			program = ShaderProgram::build((std::string(frameSource) + vertexSource).c_str(), (std::string(frameSource) + fragmentSource).c_str());
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << std::format("Programmable renderer disabled: {}", e.what()) << std::endl;
+			return;
+		}
+
+		glUniformBlockBinding(program.id, glGetUniformBlockIndex(program.id, "Frame"), FRAME_BINDING);
+		program.use();
+		glUniform1i(program.uniform("diffuseMap"), 0);
+		glUniform1i(program.uniform("instances"), INSTANCE_UNIT);
+		glUniform1i(program.uniform("materials"), MATERIAL_UNIT);
+		glUniform1i(program.uniform("clusteredLights"), LIGHT_UNIT);
+		glUniform1i(program.uniform("clusters"), CLUSTER_UNIT);
+		glUniform1i(program.uniform("lightIndices"), LIGHT_INDEX_UNIT);
+		GLState::useProgram(0);
+
+		glGenBuffers(1, &frameBufferID);
+		GLState::bindBuffer(GL_UNIFORM_BUFFER, frameBufferID);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr, GL_DYNAMIC_DRAW);
+
+		// the textures follow their buffers through every reallocation
+		struct BufferTexture { GLuint* buffer; GLuint* texture; GLenum format; };
+		for (auto [buffer, texture, format] : {
+			BufferTexture{ &instanceBufferID, &instanceTextureID, GL_RGBA32F },
+			BufferTexture{ &materialBufferID, &materialTextureID, GL_RGBA32F },
+			BufferTexture{ &lightBufferID, &lightTextureID, GL_RGBA32F },
+			BufferTexture{ &clusterBufferID, &clusterTextureID, GL_RG32UI },
+			BufferTexture{ &lightIndexBufferID, &lightIndexTextureID, GL_R32UI } }) {
+			glGenBuffers(1, buffer);
+			GLState::bindBuffer(GL_TEXTURE_BUFFER, *buffer);
+			glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+
+			glGenTextures(1, texture);
+			GLState::bindTexture(GL_TEXTURE_BUFFER, *texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+		}
+		GLState::bindTexture(GL_TEXTURE_BUFFER, 0);
+		GLState::bindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		supported = true;
+	}
+
+	static void cleanup() {
+		program.destroy();
+		for (auto& [_, vertexArray] : formatArrays)
+			glDeleteVertexArrays(1, &vertexArray);
+		formatArrays.clear();
+		for (GLuint* buffer : { &frameBufferID, &instanceBufferID, &materialBufferID, &lightBufferID, &clusterBufferID, &lightIndexBufferID }) {
+			if (*buffer) glDeleteBuffers(1, buffer);
+			*buffer = 0;
+		}
+		for (GLuint* texture : { &instanceTextureID, &materialTextureID, &lightTextureID, &clusterTextureID, &lightIndexTextureID }) {
+			if (*texture) glDeleteTextures(1, texture);
+			*texture = 0;
+		}
+		materialIndices.clear();
+		materialTable.clear();
+		supported = false;
+		GLState::reset();
+	}
+
+	// The camera and the lights for the frame, taken from LightCaster the way
+	// applyAll hands them to the GL: the first eight lights without a range
+	// per vertex, and every light with one binned into the clusters
+	static void begin(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
+
+		view = viewMatrix;
+		items.clear();
+
+		FrameData frame = {};
+		frame.projection = projectionMatrix;
+		frame.view = viewMatrix;
+		frame.sceneAmbient = glm::make_vec4(LightCaster::white);
+		frame.lighting = GLState::isEnabled(GL_LIGHTING);
+
+		boundedLights.clear();
+		clusteredLights.clear();
+
+		for (const LightCaster& light : LightCaster::lights) {
+
+			bool directional = light.type == LightCaster::Type::DIRECTIONAL;
+			bool spot = light.type == LightCaster::Type::SPOTLIGHT;
+
+			glm::vec4 position = viewMatrix * glm::make_vec4(directional ? light.dir : light.pos);
+			glm::vec4 spotDirection = spot
+				? glm::vec4(glm::normalize(glm::mat3(viewMatrix) * glm::make_vec3(light.dir)), std::cos(glm::radians(light.cutoffDegs)))
+				: glm::vec4(0.0f, 0.0f, 0.0f, -2.0f);
+			glm::vec4 color = glm::make_vec4(light.color);
+
+			if (light.bounded()) {
+				if (!frame.lighting) continue;
+				boundedLights.push_back({ glm::vec3(position), light.range });
+				clusteredLights.push_back({ glm::vec4(glm::vec3(position), light.range), glm::vec4(glm::vec3(color), spot ? light.exponent : 0.0f), spotDirection });
+				continue;
+			}
+
+			if (frame.lightCount == MAX_LIGHTS) continue;
+
+			LightData& data = frame.lights[frame.lightCount++];
+			data.position = position;
+			data.spotDirection = spotDirection;
+			data.attenuation = glm::vec4(1.0f, 0.0f, 0.0f, spot ? light.exponent : 0.0f);
+			data.ambient = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			data.diffuse = data.specular = color;
+		}
+
+		float nearPlane = static_cast<float>(CameraController::currentProjection.near);
+		float farPlane = static_cast<float>(CameraController::currentProjection.far);
+		clusters.build(boundedLights, projectionMatrix, nearPlane, farPlane);
+
+		frame.clusterScale = glm::vec4(
+			static_cast<float>(WindowState::currentWidth) / LightClusters::TILES_X,
+			static_cast<float>(WindowState::currentHeight) / LightClusters::TILES_Y,
+			clusters.sliceScale, clusters.sliceBias);
+		frame.clusterCount = glm::ivec4(LightClusters::TILES_X, LightClusters::TILES_Y, LightClusters::SLICES, static_cast<GLint>(clusteredLights.size()));
+
+		if (!clusteredLights.empty()) {
+			auto upload = [](GLuint buffer, const void* data, size_t bytes) {
+				GLState::bindBuffer(GL_TEXTURE_BUFFER, buffer);
+				glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, sizeof(uint32_t)), bytes ? data : nullptr, GL_STREAM_DRAW);
+			};
+			upload(lightBufferID, clusteredLights.data(), clusteredLights.size() * sizeof(ClusteredLightData));
+			upload(clusterBufferID, clusters.grid.data(), clusters.grid.size() * sizeof(uint32_t));
+			upload(lightIndexBufferID, clusters.indices.data(), clusters.indices.size() * sizeof(uint32_t));
+		}
+
+		GLState::bindBuffer(GL_UNIFORM_BUFFER, frameBufferID);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &frame);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameBufferID);
+	}
+
+	// same contract as InstanceBatcher::add
+	static void add(Model& model, unsigned int textureID, const Material& material, unsigned int* lod, const glm::mat4& world) {
+		if (!model.buffersInitialised) model.initBuffers();
+
+		unsigned int level = *lod = model.selectLod(*lod, view * world);
+		items.push_back({ &model, textureID, level, materialIndex(material), world });
+	}
+
+	static void flush() {
+
+		if (items.empty()) return;
+
+		// stable, so coplanar surfaces still resolve in scene order
+		std::stable_sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+			uint32_t formatA = InstanceBatcher::formatKey(a.model->layout), formatB = InstanceBatcher::formatKey(b.model->layout);
+			return std::tie(formatA, a.textureID, a.model, a.lod) < std::tie(formatB, b.textureID, b.model, b.lod);
+		});
+
+		instances.clear();
+		for (const Item& item : items)
+			instances.push_back({ item.world, glm::vec4(static_cast<float>(item.material), 0.0f, 0.0f, 0.0f) });
+
+		// whole frame in one upload, orphaning last frame's storage
+		GLState::bindBuffer(GL_TEXTURE_BUFFER, instanceBufferID);
+		glBufferData(GL_TEXTURE_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_STREAM_DRAW);
+
+		if (materialsChanged) {
+			GLState::bindBuffer(GL_TEXTURE_BUFFER, materialBufferID);
+			glBufferData(GL_TEXTURE_BUFFER, materialTable.size() * sizeof(MaterialData), materialTable.data(), GL_STATIC_DRAW);
+			materialsChanged = false;
+		}
+
+		glActiveTexture(GL_TEXTURE0 + INSTANCE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, instanceTextureID);
+		glActiveTexture(GL_TEXTURE0 + MATERIAL_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, materialTextureID);
+		glActiveTexture(GL_TEXTURE0 + LIGHT_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, lightTextureID);
+		glActiveTexture(GL_TEXTURE0 + CLUSTER_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, clusterTextureID);
+		glActiveTexture(GL_TEXTURE0 + LIGHT_INDEX_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, lightIndexTextureID);
+		glActiveTexture(GL_TEXTURE0);
+
+		program.use();
+
+		const VertexLayout* format = nullptr;
+		unsigned int texture = ~0u;
+
+		for (size_t first = 0; first < items.size();) {
+			const Item& item = items[first];
+			const Model& model = *item.model;
+
+			size_t last = first + 1;
+			while (last < items.size() && items[last].model == item.model && items[last].lod == item.lod && items[last].textureID == item.textureID)
+				last++;
+
+			if (!format || InstanceBatcher::formatKey(*format) != InstanceBatcher::formatKey(model.layout)) {
+				format = &model.layout;
+				GLState::bindVertexArray(formatArray(model.layout));
+				if (model.layout.normal == VertexLayout::Normal::NONE) glVertexAttrib3f(NORMAL_LOCATION, 0.0f, 1.0f, 0.0f);
+				if (model.layout.texcoord == VertexLayout::Texcoord::NONE) glVertexAttrib2f(TEXCOORD_LOCATION, 0.0f, 0.0f);
+			}
+
+			if (item.textureID != texture) {
+				texture = item.textureID;
+				GLState::bindTexture(GL_TEXTURE_2D, (Model::showTexture) ? texture : 0);
+				glUniform1i(program.uniform("textured"), Model::showTexture && texture != 0);
+			}
+
+			glUniform4fv(program.uniform("decode"), 1, glm::value_ptr(InstanceBatcher::decodeVector(model.layout)));
+			glUniform1i(program.uniform("instanceBase"), static_cast<GLint>(first));
+
+			Model::Lod range = model.lodRange(item.lod);
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(range.indexCount), model.elementType,
+				model.indexOffset(range), static_cast<GLsizei>(last - first), static_cast<GLint>(model.vertexBase / model.layout.stride()));
+
+			Model::trianglesDrawn += range.indexCount / 3 * (last - first);
+			Model::drawCalls++;
+
+			first = last;
+		}
+
+		GLState::bindVertexArray(0);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::useProgram(0);
+	}
+
+private:
+
+	static uint32_t materialIndex(const Material& material) {
+		auto [it, added] = materialIndices.try_emplace(std::string(reinterpret_cast<const char*>(&material), sizeof(Material)),
+			static_cast<uint32_t>(materialTable.size()));
+		if (added) {
+			materialTable.push_back({
+				InstanceBatcher::materialVector(material.diffuse),
+				InstanceBatcher::materialVector(material.ambient),
+				InstanceBatcher::materialVector(material.specular),
+				InstanceBatcher::materialVector(material.emissive, material.shininess[0])
+			});
+			materialsChanged = true;
+		}
+		return it->second;
+	}
+
+	// generic attributes over the arena at offset 0, each run's base vertex
+	// finds its mesh; built once per format, the arena keeps its names
+	static GLuint formatArray(const VertexLayout& layout) {
+
+		auto [it, added] = formatArrays.try_emplace(InstanceBatcher::formatKey(layout), 0);
+		if (!added) return it->second;
+
+		glGenVertexArrays(1, &it->second);
+		GLState::bindVertexArray(it->second);
+
+		const GLsizei stride = static_cast<GLsizei>(layout.stride());
+		GLState::bindBuffer(GL_ARRAY_BUFFER, MeshArena::vertices.id);
+
+		// quantized positions stay integers for the decode, normals are normalized
+		glEnableVertexAttribArray(POSITION_LOCATION);
+		glVertexAttribPointer(POSITION_LOCATION, 3, layout.positionType(), GL_FALSE, stride, (void*)0);
+
+		if (layout.normal != VertexLayout::Normal::NONE) {
+			glEnableVertexAttribArray(NORMAL_LOCATION);
+			glVertexAttribPointer(NORMAL_LOCATION, (layout.normal == VertexLayout::Normal::SNORM10) ? 4 : 3, layout.normalType(),
+				layout.normal != VertexLayout::Normal::FLOAT32, stride, (void*)(size_t)layout.normalOffset());
+		}
+
+		if (layout.texcoord != VertexLayout::Texcoord::NONE) {
+			glEnableVertexAttribArray(TEXCOORD_LOCATION);
+			glVertexAttribPointer(TEXCOORD_LOCATION, 2, layout.texcoordType(), GL_FALSE, stride, (void*)(size_t)layout.texcoordOffset());
+		}
+
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, MeshArena::indices.id);
+		return it->second;
+	}
+};
+
+#endif
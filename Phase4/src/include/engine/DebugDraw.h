@@ -0,0 +1,233 @@
+#ifndef DEBUGDRAW_H
+#define DEBUGDRAW_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GLState.h"
+
+////////////////////////////////////////////////////////////
+// Debug drawing
+//
+// Lines and points are collected into a Batch: one list of
+// coloured vertices per primitive and size, packed into a
+// single vertex buffer and drawn with one glDrawArrays per
+// list, through the fixed function pipeline with lighting
+// off. Debug visuals never go through glBegin/glEnd.
+//
+// The frame batch is in world space. Anything may add to it
+// while the frame is drawn, and flush() uploads it, drawing
+// it from the camera, and empties it for the next frame.
+// Geometry that does not change, such as a model's normals
+// or an animation path, is built into a Batch of its own
+// once and uploaded as static data. flush() draws it for
+// every object() it was queued with, or draw() puts it on
+// screen right away under the modelview in place.
+////////////////////////////////////////////////////////////
+
+struct DebugDraw {
+
+	struct Vertex {
+		glm::vec3 position;
+		GLubyte color[4];
+	};
+
+	class Batch {
+	public:
+
+		void line(const glm::vec3& a, const glm::vec3& b, const glm::vec3& color, float width = 1.0f) {
+			auto& vertices = part(GL_LINES, width).vertices;
+			vertices.push_back(vertex(a, color));
+			vertices.push_back(vertex(b, color));
+		}
+
+		// consecutive points joined, back to the first when closed
+		void polyline(const std::vector<glm::vec3>& points, const glm::vec3& color, bool closed = false, float width = 1.0f) {
+			for (size_t i = 0; i + 1 < points.size(); i++)
+				line(points[i], points[i + 1], color, width);
+			if (closed && points.size() > 2)
+				line(points.back(), points.front(), color, width);
+		}
+
+		void point(const glm::vec3& p, const glm::vec3& color, float size = 1.0f) {
+			part(GL_POINTS, size).vertices.push_back(vertex(p, color));
+		}
+
+		bool uploaded() const {
+			return bufferID != 0;
+		}
+
+		// emptied for reuse, the buffer and the capacity are kept
+		void clear() {
+			for (Part& p : parts) {
+				p.vertices.clear();
+				p.count = 0;
+			}
+		}
+
+		// Static batches upload once and drop their client copy. The frame
+		// batch orphans last frame's storage every time.
+		void upload(GLenum usage = GL_STATIC_DRAW) {
+
+			std::vector<Vertex> packed;
+			for (Part& p : parts) {
+				p.first = static_cast<GLint>(packed.size());
+				p.count = static_cast<GLsizei>(p.vertices.size());
+				packed.insert(packed.end(), p.vertices.begin(), p.vertices.end());
+			}
+
+			if (!bufferID) glGenBuffers(1, &bufferID);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, bufferID);
+			glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(Vertex), packed.empty() ? nullptr : packed.data(), usage);
+
+			if (usage == GL_STATIC_DRAW)
+				for (Part& p : parts)
+					std::vector<Vertex>().swap(p.vertices);
+		}
+
+		// under the modelview in place
+		void draw() const {
+			if (!bufferID) return;
+			begin();
+			bindArrays();
+			drawParts();
+			end();
+		}
+
+		void destroy() {
+			if (bufferID) glDeleteBuffers(1, &bufferID);
+			bufferID = 0;
+			parts.clear();
+		}
+
+	private:
+
+		friend struct DebugDraw;
+
+		struct Part {
+			GLenum mode;
+			float size; // point size or line width
+			std::vector<Vertex> vertices;
+			GLint first = 0;
+			GLsizei count = 0;
+		};
+
+		std::vector<Part> parts;
+		GLuint bufferID = 0;
+
+		static Vertex vertex(const glm::vec3& p, const glm::vec3& color) {
+			glm::vec3 c = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+			return { p, { static_cast<GLubyte>(c.r), static_cast<GLubyte>(c.g), static_cast<GLubyte>(c.b), 255 } };
+		}
+
+		// a handful per batch, searched in order
+		Part& part(GLenum mode, float size) {
+			for (Part& p : parts)
+				if (p.mode == mode && p.size == size) return p;
+			parts.push_back(Part{ mode, size, {} });
+			return parts.back();
+		}
+
+		// the arrays of this batch on no vertex array object
+		void bindArrays() const {
+			if (GLState::vertexArrays) GLState::bindVertexArray(0);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, bufferID);
+			GLState::enableClientState(GL_VERTEX_ARRAY);
+			GLState::enableClientState(GL_COLOR_ARRAY);
+			GLState::disableClientState(GL_NORMAL_ARRAY);
+			GLState::disableClientState(GL_TEXTURE_COORD_ARRAY);
+			glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (void*)offsetof(Vertex, position));
+			glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+		}
+
+		void drawParts() const {
+			for (const Part& p : parts) {
+				if (p.count == 0) continue;
+				if (p.mode == GL_POINTS) glPointSize(p.size);
+				else glLineWidth(p.size);
+				glDrawArrays(p.mode, p.first, p.count);
+				drawCalls++;
+			}
+		}
+	};
+
+	// per frame statistics
+	inline static size_t drawCalls = 0;
+
+	static Batch frame; // defined after the struct, where Batch can be constructed
+
+	// a static batch drawn at an object -> world transform when the frame is flushed
+	static void object(const Batch& batch, const glm::mat4& world) {
+		objects.push_back({ &batch, world });
+	}
+
+	// the frame batch and the queued objects, from the camera; leaves the view as the modelview
+	static void flush(const glm::mat4& view) {
+
+		bool any = !objects.empty();
+		for (const auto& p : frame.parts)
+			any = any || !p.vertices.empty();
+		if (!any) return;
+
+		begin();
+
+		// from one buffer, grouped by batch so each binds its arrays once
+		std::stable_sort(objects.begin(), objects.end(), [](const Object& a, const Object& b) { return a.batch < b.batch; });
+		const Batch* bound = nullptr;
+		for (const Object& o : objects) {
+			if (!o.batch->uploaded()) continue;
+			if (o.batch != bound) {
+				o.batch->bindArrays();
+				bound = o.batch;
+			}
+			glLoadMatrixf(glm::value_ptr(view * o.world));
+			o.batch->drawParts();
+		}
+		objects.clear();
+
+		frame.upload(GL_STREAM_DRAW);
+		frame.bindArrays();
+		glLoadMatrixf(glm::value_ptr(view));
+		frame.drawParts();
+		frame.clear();
+
+		end();
+	}
+
+	static void cleanup() {
+		frame.destroy();
+		objects.clear();
+		GLState::reset();
+	}
+
+private:
+
+	struct Object {
+		const Batch* batch;
+		glm::mat4 world;
+	};
+
+	inline static std::vector<Object> objects;
+
+	// unlit, untextured, vertex colours; the arrays are left off for everyone else
+	static void begin() {
+		GLState::pushAttrib(GL_CURRENT_BIT | GL_LIGHTING_BIT | GL_POINT_BIT | GL_LINE_BIT);
+		GLState::disable(GL_LIGHTING);
+		GLState::bindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	static void end() {
+		GLState::disableClientState(GL_COLOR_ARRAY);
+		GLState::disableClientState(GL_VERTEX_ARRAY);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::popAttrib();
+	}
+};
+
+inline DebugDraw::Batch DebugDraw::frame;
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <array>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+////////////////////////////////////////////////////////////
+// GL state cache
+//
+// Wrappers for the binds, enables and material calls the
+// engine makes. Each remembers the value it last set and
+// drops calls that would not change it. Calls issued and
+// elided are counted per frame.
+//
+// glPopAttrib restores state behind the cache's back, so
+// attribute pushes go through here as well and a pop
+// forgets whatever its groups cover. Anything else that
+// changes tracked state directly must call invalidate().
+// Client arrays and the element buffer belong to the bound
+// vertex array object and are forgotten when it changes.
+////////////////////////////////////////////////////////////
+
+struct GLState {
+
+	// per frame statistics
+	inline static size_t issued = 0;
+	inline static size_t elided = 0;
+
+	// vertex array objects (GL 3.0 or ARB_vertex_array_object)
+	inline static bool vertexArrays = false;
+
+	// after glewInit
+	static void detectSupport() {
+		vertexArrays = GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+		if (!vertexArrays)
+			std::cout << "Vertex array objects unavailable, setting up client arrays on every draw" << std::endl;
+	}
+
+	static void enable(GLenum cap) { setCap(cap, true); }
+	static void disable(GLenum cap) { setCap(cap, false); }
+
+	static bool isEnabled(GLenum cap) {
+		auto it = caps.find(cap);
+		if (it != caps.end()) return it->second;
+		return caps[cap] = glIsEnabled(cap);
+	}
+
+	static void enableClientState(GLenum array) { setClientArray(array, true); }
+	static void disableClientState(GLenum array) { setClientArray(array, false); }
+
+	static void bindBuffer(GLenum target, GLuint buffer) {
+		if (target != GL_ARRAY_BUFFER && target != GL_ELEMENT_ARRAY_BUFFER) {
+			glBindBuffer(target, buffer);
+			issued++;
+			return;
+		}
+		if (changed((target == GL_ARRAY_BUFFER) ? arrayBuffer : elementBuffer, buffer))
+			glBindBuffer(target, buffer);
+	}
+
+	// texture unit 0, the only one the engine uses
+	static void bindTexture(GLenum target, GLuint texture) {
+		if (target != GL_TEXTURE_2D) {
+			glBindTexture(target, texture);
+			issued++;
+			return;
+		}
+		if (changed(texture2D, texture))
+			glBindTexture(target, texture);
+	}
+
+	static void bindVertexArray(GLuint vertexArray) {
+		if (!changed(GLState::vertexArray, vertexArray)) return;
+		glBindVertexArray(vertexArray);
+		elementBuffer = UNKNOWN;
+		clientArrays.clear();
+	}
+
+	static void useProgram(GLuint program) {
+		if (changed(GLState::program, program))
+			glUseProgram(program);
+	}
+
+	static void material(GLenum face, GLenum pname, const GLfloat* values) {
+		if (face != GL_FRONT) {
+			glMaterialfv(face, pname, values);
+			issued++;
+			return;
+		}
+
+		// as many values as the GL reads for the parameter
+		size_t count = (pname == GL_SHININESS) ? 1 : 4;
+		std::array<GLfloat, 4> v = {};
+		std::memcpy(v.data(), values, count * sizeof(GLfloat));
+
+		auto [it, added] = materials.try_emplace(pname, v);
+		if (!added && it->second == v) {
+			elided++;
+			return;
+		}
+		it->second = v;
+		glMaterialfv(face, pname, values);
+		issued++;
+	}
+
+	static void pushAttrib(GLbitfield mask) {
+		glPushAttrib(mask);
+		attribStack.push_back(mask);
+		issued++;
+	}
+
+	static void popAttrib() {
+		glPopAttrib();
+		issued++;
+		if (attribStack.empty()) return invalidate();
+		invalidate(attribStack.back());
+		attribStack.pop_back();
+	}
+
+	// forgets the state the given attribute groups cover
+	static void invalidate(GLbitfield mask = GL_ALL_ATTRIB_BITS) {
+		if (mask & GL_ENABLE_BIT) caps.clear();
+		if (mask & GL_LIGHTING_BIT) {
+			materials.clear();
+			forgetCaps({ GL_LIGHTING, GL_COLOR_MATERIAL });
+			for (GLenum light = GL_LIGHT0; light < GL_LIGHT0 + 8; light++)
+				caps.erase(light);
+		}
+		if (mask & GL_TEXTURE_BIT) {
+			texture2D = UNKNOWN;
+			caps.erase(GL_TEXTURE_2D);
+		}
+		if (mask & GL_DEPTH_BUFFER_BIT) caps.erase(GL_DEPTH_TEST);
+		if (mask & GL_POLYGON_BIT) caps.erase(GL_CULL_FACE);
+		if (mask & GL_TRANSFORM_BIT) forgetCaps({ GL_NORMALIZE, GL_RESCALE_NORMAL });
+	}
+
+	// after deleting objects that may be bound, or raw GL calls of unknown effect
+	static void reset() {
+		invalidate();
+		clientArrays.clear();
+		arrayBuffer = elementBuffer = vertexArray = program = UNKNOWN;
+	}
+
+private:
+
+	static constexpr GLuint UNKNOWN = ~0u;
+
+	inline static std::unordered_map<GLenum, bool> caps;
+	inline static std::unordered_map<GLenum, bool> clientArrays; // of the bound vertex array object
+	inline static std::unordered_map<GLenum, std::array<GLfloat, 4>> materials; // GL_FRONT
+
+	inline static GLuint arrayBuffer = UNKNOWN;
+	inline static GLuint elementBuffer = UNKNOWN;
+	inline static GLuint texture2D = UNKNOWN;
+	inline static GLuint vertexArray = UNKNOWN;
+	inline static GLuint program = UNKNOWN;
+
+	inline static std::vector<GLbitfield> attribStack;
+
+	static bool changed(GLuint& cached, GLuint value) {
+		if (cached == value) {
+			elided++;
+			return false;
+		}
+		cached = value;
+		issued++;
+		return true;
+	}
+
+	static void setCap(GLenum cap, bool on) {
+		auto [it, added] = caps.try_emplace(cap, on);
+		if (!added && it->second == on) {
+			elided++;
+			return;
+		}
+		it->second = on;
+		issued++;
+		if (on) glEnable(cap); else glDisable(cap);
+	}
+
+	static void setClientArray(GLenum array, bool on) {
+		auto [it, added] = clientArrays.try_emplace(array, on);
+		if (!added && it->second == on) {
+			elided++;
+			return;
+		}
+		it->second = on;
+		issued++;
+		if (on) glEnableClientState(array); else glDisableClientState(array);
+	}
+
+	static void forgetCaps(std::initializer_list<GLenum> list) {
+		for (GLenum cap : list)
+			caps.erase(cap);
+	}
+};
+
+#endif
@@ -0,0 +1,507 @@
+#ifndef GPUCULLING_H
+#define GPUCULLING_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <format>
+#include <utility>
+#include <iterator>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "SceneGraph.h"
+
+////////////////////////////////////////////////////////////
+// GPU driven culling
+//
+// Optional GPU driven path for very large scenes: culling, level of detail
+// selection and command building move to a compute shader, so the CPU cost
+// no longer grows with the object count. Node world matrices live in a
+// storage buffer (each frame only the dynamic nodes are uploaded again) next
+// to one Object per model reference and one DrawSet per (mesh, texture,
+// material). The shader tests every object's sphere against the frustum,
+// picks its level the way Model::selectLod does (the level drawn last frame
+// stays in the object, for the hysteresis) and appends the object's index
+// to that level's indirect command with an atomic counter; each command has
+// room for every object of its set. The CPU then issues a fixed number of
+// glMultiDrawElementsIndirect calls, one per vertex format, index type and
+// texture. The counts for the statistics go to a small ring of counter
+// buffers, each fenced after its dispatch and read only once the fence has
+// signalled, so the CPU never waits on the GL for them.
+// Debug drawing (axes, animation paths) needs the CPU walk and turns it off.
+////////////////////////////////////////////////////////////
+
+struct GpuCulling {
+
+	inline static bool enabled = false;
+	inline static bool supported = false;
+
+	static constexpr uint32_t MAX_LODS = 8;
+	static constexpr GLuint WORKGROUP_SIZE = 64;
+	static constexpr size_t COUNTER_RING = 3;
+	static constexpr GLuint OBJECT_INDEX_LOCATION = 1;
+
+	// storage buffer binding points, as in the shaders
+	enum Binding : GLuint { WORLD_MATRICES, OBJECTS, DRAW_SETS, COMMANDS, VISIBLE, COUNTERS };
+
+	// laid out as the std430 structs in declarations
+	struct Object {
+		uint32_t node;
+		uint32_t set;
+		uint32_t lod; // level drawn last frame, written by the shader
+		uint32_t unused;
+	};
+
+	struct DrawSet {
+		glm::vec4 decode;
+		glm::vec4 diffuse, ambient, specular, emission; // as in InstanceBatcher::DrawData
+		glm::vec4 bounds;       // the model's bounding sphere: center xyz, radius w
+		glm::vec4 lodErrors[2]; // MAX_LODS levels, model units
+		uint32_t firstCommand;  // one command per level
+		uint32_t lodCount;
+		uint32_t unused[2];
+	};
+
+	// commands drawn by one glMultiDrawElementsIndirect
+	struct Submission {
+		VertexLayout layout;
+		GLenum elementType;
+		unsigned int textureID;
+		size_t firstCommand, commandCount;
+	};
+
+	// shared by the culling and the drawing shaders
+	inline static const char* declarations = R"(
+		struct Object {
+			uint node;
+			uint set;
+			uint lod;
+			uint unused;
+		};
+
+		struct DrawSet {
+			vec4 decode;
+			vec4 diffuse, ambient, specular, emission;
+			vec4 bounds;
+			vec4 lodErrors[2];
+			uint firstCommand;
+			uint lodCount;
+			uint unused[2];
+		};
+
+		layout(std430, binding = 0) readonly buffer WorldMatrices { mat4 worldMatrices[]; };
+		layout(std430, binding = 1) buffer Objects { Object objects[]; };
+		layout(std430, binding = 2) readonly buffer DrawSets { DrawSet drawSets[]; };
+	)";
+
+	inline static const char* cullSource = R"(
+		layout(local_size_x = 64) in;
+
+		struct DrawCommand {
+			uint count;
+			uint instanceCount;
+			uint firstIndex;
+			int baseVertex;
+			uint baseInstance;
+		};
+
+		layout(std430, binding = 3) buffer Commands { DrawCommand commands[]; };
+		layout(std430, binding = 4) writeonly buffer Visible { uint visible[]; };
+		layout(std430, binding = 5) buffer Counters { uint objectsDrawn; uint trianglesDrawn; };
+
+		uniform uint objectCount;
+		uniform bool culling;
+		uniform vec4 planes[6]; // world space, normals pointing inwards
+		uniform mat4 view;
+
+		uniform bool lodEnabled;
+		uniform float lodThreshold;
+		uniform float lodHysteresis;
+		uniform float nearPlane;
+		uniform float pixelsPerUnit; // at unit distance
+
+		float maxScale(mat4 m) {
+			return max(length(m[0].xyz), max(length(m[1].xyz), length(m[2].xyz)));
+		}
+
+		float lodError(DrawSet set, uint level) {
+			return set.lodErrors[level / 4u][level % 4u];
+		}
+
+		void main() {
+			uint i = gl_GlobalInvocationID.x;
+			if (i >= objectCount) return;
+
+			Object object = objects[i];
+			DrawSet set = drawSets[object.set];
+			mat4 world = worldMatrices[object.node];
+
+			// BoundingSphere::transformed, Frustum::intersects
+			vec3 center = (world * vec4(set.bounds.xyz, 1.0)).xyz;
+			float radius = set.bounds.w * maxScale(world);
+			if (culling)
+				for (int p = 0; p < 6; p++)
+					if (dot(planes[p].xyz, center) + planes[p].w < -radius) return;
+
+			// Model::selectLod
+			uint level = 0u;
+			if (lodEnabled && set.lodCount > 1u) {
+				mat4 modelview = view * world;
+				float scale = maxScale(modelview);
+				vec3 eye = (modelview * vec4(set.bounds.xyz, 1.0)).xyz;
+				float distance = max(length(eye) - set.bounds.w * scale, nearPlane);
+				float errorToPixels = scale * pixelsPerUnit / distance;
+
+				level = min(object.lod, set.lodCount - 1u);
+				while (level > 0u && lodError(set, level) * errorToPixels > lodThreshold)
+					level--;
+				while (level + 1u < set.lodCount && lodError(set, level + 1u) * errorToPixels < lodThreshold * (1.0 - lodHysteresis))
+					level++;
+			}
+			objects[i].lod = level;
+
+			uint command = set.firstCommand + level;
+			uint slot = atomicAdd(commands[command].instanceCount, 1u);
+			visible[commands[command].baseInstance + slot] = i;
+
+			atomicAdd(objectsDrawn, 1u);
+			atomicAdd(trianglesDrawn, commands[command].count / 3u);
+		}
+	)";
+
+	inline static ShaderProgram cullProgram;
+	inline static ShaderProgram drawProgram;
+
+	inline static GLuint worldMatrixBuffer = 0;
+	inline static GLuint objectBuffer = 0;
+	inline static GLuint drawSetBuffer = 0;
+	inline static GLuint commandBuffer = 0;
+	inline static GLuint commandTemplateBuffer = 0; // the commands with no instances
+	inline static GLuint visibleBuffer = 0;         // object indices, read as an instanced attribute
+
+	// drawn objects and triangles of the frames in flight
+	inline static GLuint counterBuffers[COUNTER_RING] = {};
+	inline static GLsync counterFences[COUNTER_RING] = {};
+	inline static size_t counterSlot = 0;  // written next, the oldest frame in flight
+	inline static uint32_t lastCounters[2] = { 0, 0 };
+	inline static bool countersRead = false; // lastCounters are of the current build
+
+	inline static std::vector<Submission> submissions;
+	inline static std::vector<std::pair<uint32_t, uint32_t>> dynamicRuns; // first node, count
+	inline static std::unordered_map<uint32_t, GLuint> formatArrays;     // vertex array object per vertex format
+	inline static size_t objectCount = 0;
+	inline static size_t referenceCount = 0; // objects plus references whose model has not arrived
+	inline static size_t commandCount = 0;
+
+	// what the buffers were built from
+	inline static const SceneGraph* builtFor = nullptr;
+	inline static unsigned int modelGeneration = ~0u;
+	inline static size_t textureCount = ~size_t(0);
+
+	static bool active() {
+		return enabled && supported && !Model::showAxes && !AnimatedTranslation::showPath;
+	}
+
+	static void toggle() {
+		GpuCulling::enabled = !GpuCulling::enabled;
+	}
+
+	// after glewInit and InstanceBatcher::detectSupport; needs compute shaders
+	// and storage buffers (GL 4.3)
+	static void detectSupport() {
+		supported = false;
+		if (!GLEW_VERSION_4_3) {
+			std::cout << "GPU culling unavailable (needs OpenGL 4.3)" << std::endl;
+			return;
+		}
+
+		std::string header = std::string("#version 430 compatibility\n") + declarations;
+		try {
+			cullProgram = ShaderProgram::buildCompute((std::string("#version 430\n") + declarations + cullSource).c_str());
+			drawProgram = ShaderProgram::build((header + "#define GPU_DRIVEN\n" + InstanceBatcher::vertexSource).c_str(),
+				(std::string("#version 430 compatibility\n") + InstanceBatcher::fragmentSource).c_str(),
+				{ { OBJECT_INDEX_LOCATION, "objectIndex" } });
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << std::format("GPU culling disabled: {}", e.what()) << std::endl;
+			cullProgram.destroy();
+			return;
+		}
+
+		for (GLuint* buffer : { &worldMatrixBuffer, &objectBuffer, &drawSetBuffer, &commandBuffer, &commandTemplateBuffer, &visibleBuffer })
+			glGenBuffers(1, buffer);
+		glGenBuffers(COUNTER_RING, counterBuffers);
+		supported = true;
+	}
+
+	static void cleanup() {
+		cullProgram.destroy();
+		drawProgram.destroy();
+		for (auto& [_, vertexArray] : formatArrays)
+			glDeleteVertexArrays(1, &vertexArray);
+		formatArrays.clear();
+		for (GLuint* buffer : { &worldMatrixBuffer, &objectBuffer, &drawSetBuffer, &commandBuffer, &commandTemplateBuffer, &visibleBuffer }) {
+			if (*buffer) glDeleteBuffers(1, buffer);
+			*buffer = 0;
+		}
+		dropCounters();
+		if (counterBuffers[0]) glDeleteBuffers(COUNTER_RING, counterBuffers);
+		std::fill(std::begin(counterBuffers), std::end(counterBuffers), 0);
+		builtFor = nullptr;
+		supported = false;
+		GLState::reset();
+	}
+
+	// again whenever the scene's models or textures change
+	static void build(SceneGraph& scene) {
+
+		using Key = InstanceBatcher::Key;
+
+		std::vector<Object> objects;
+		std::vector<DrawSet> sets;
+		std::vector<Key> setKeys;
+		std::vector<uint32_t> setObjects;
+		std::unordered_map<Key, uint32_t, InstanceBatcher::KeyHash> setIndex;
+
+		for (uint32_t n = 0; n < scene.size(); n++) {
+			for (uint32_t r = scene.firstReference[n]; r < scene.firstReference[n] + scene.referenceCount[n]; r++) {
+				if (!scene.model[r]) continue;
+
+				Model& model = *scene.model[r];
+				if (!model.buffersInitialised) model.initBuffers();
+
+				auto [it, added] = setIndex.try_emplace({ &model, scene.textureID[r], 0, scene.material[r] }, static_cast<uint32_t>(sets.size()));
+				if (added) {
+					sets.push_back({});
+					setKeys.push_back(it->first);
+					setObjects.push_back(0);
+				}
+				setObjects[it->second]++;
+				objects.push_back({ n, it->second, scene.lod[r], 0 });
+			}
+		}
+
+		// sets drawn by the same call get consecutive commands
+		std::vector<uint32_t> order(sets.size());
+		for (uint32_t s = 0; s < order.size(); s++) order[s] = s;
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return InstanceBatcher::submissionKey(*setKeys[a].model, setKeys[a].textureID)
+				< InstanceBatcher::submissionKey(*setKeys[b].model, setKeys[b].textureID);
+		});
+
+		std::vector<InstanceBatcher::DrawCommand> commands;
+		submissions.clear();
+		uint64_t lastSubmission = ~0ull;
+		GLuint instances = 0;
+
+		for (uint32_t s : order) {
+			const Key& key = setKeys[s];
+			const Model& model = *key.model;
+
+			uint64_t submission = InstanceBatcher::submissionKey(model, key.textureID);
+			if (submission != lastSubmission)
+				submissions.push_back({ model.layout, model.elementType, key.textureID, commands.size(), 0 });
+			lastSubmission = submission;
+
+			BoundingSphere bounds = model.boundingSphere();
+			DrawSet& set = sets[s];
+			set = {
+				.decode = InstanceBatcher::decodeVector(model.layout),
+				.diffuse = InstanceBatcher::materialVector(key.material.diffuse),
+				.ambient = InstanceBatcher::materialVector(key.material.ambient),
+				.specular = InstanceBatcher::materialVector(key.material.specular),
+				.emission = InstanceBatcher::materialVector(key.material.emissive, key.material.shininess[0]),
+				.bounds = glm::vec4(bounds.center, bounds.radius),
+				.lodErrors = {},
+				.firstCommand = static_cast<uint32_t>(commands.size()),
+				.lodCount = static_cast<uint32_t>(std::clamp<size_t>(model.lods.size(), 1, MAX_LODS)),
+				.unused = {}
+			};
+
+			for (uint32_t level = 0; level < set.lodCount; level++) {
+				Model::Lod range = model.lodRange(level);
+				set.lodErrors[level / 4][level % 4] = range.error;
+				commands.push_back({
+					static_cast<GLuint>(range.indexCount),
+					0,
+					static_cast<GLuint>(model.indexBase / model.indexSize() + range.firstIndex),
+					static_cast<GLint>(model.vertexBase / model.layout.stride()),
+					instances
+				});
+				instances += setObjects[s];
+			}
+			submissions.back().commandCount += set.lodCount;
+		}
+
+		auto upload = [](GLuint buffer, size_t bytes, const void* data, GLenum usage) {
+			GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(bytes, 4), data, usage);
+		};
+
+		uint32_t zeros[2] = { 0, 0 };
+		upload(worldMatrixBuffer, scene.worldMatrix.size() * sizeof(glm::mat4), scene.worldMatrix.data(), GL_DYNAMIC_DRAW);
+		upload(objectBuffer, objects.size() * sizeof(Object), objects.data(), GL_STATIC_DRAW);
+		upload(drawSetBuffer, sets.size() * sizeof(DrawSet), sets.data(), GL_STATIC_DRAW);
+		upload(commandTemplateBuffer, commands.size() * sizeof(InstanceBatcher::DrawCommand), commands.data(), GL_STATIC_DRAW);
+		upload(commandBuffer, commands.size() * sizeof(InstanceBatcher::DrawCommand), nullptr, GL_DYNAMIC_COPY);
+		upload(visibleBuffer, instances * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+		for (GLuint counterBuffer : counterBuffers)
+			upload(counterBuffer, sizeof(zeros), zeros, GL_DYNAMIC_COPY);
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		dropCounters();
+
+		// dynamic subtrees are index ranges, so the nodes come in runs
+		dynamicRuns.clear();
+		for (uint32_t n : scene.dynamicNodes) {
+			if (!dynamicRuns.empty() && dynamicRuns.back().first + dynamicRuns.back().second == n) dynamicRuns.back().second++;
+			else dynamicRuns.push_back({ n, 1 });
+		}
+
+		objectCount = objects.size();
+		referenceCount = scene.model.size();
+		commandCount = commands.size();
+		builtFor = &scene;
+		modelGeneration = scene.modelGeneration;
+		textureCount = scene.textureCount;
+
+		std::cout
+			<< std::format("GPU culling: {} objects in {} sets, {} commands in {} submissions",
+				objectCount, sets.size(), commandCount, submissions.size())
+			<< std::endl;
+	}
+
+	// replaces SceneGraph::render; the GL modelview must hold the view matrix
+	static void render(SceneGraph& scene, const Frustum& frustum, const glm::mat4& view) {
+
+		if (builtFor != &scene || modelGeneration != scene.modelGeneration || textureCount != scene.textureCount)
+			build(scene);
+		if (objectCount == 0) return;
+
+		readStatistics();
+
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, worldMatrixBuffer);
+		for (const auto& [first, count] : dynamicRuns)
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(glm::mat4), count * sizeof(glm::mat4), &scene.worldMatrix[first]);
+
+		// no instances in any command, counters at zero
+		GLuint counterBuffer = counterBuffers[counterSlot];
+		uint32_t zeros[2] = { 0, 0 };
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, commandTemplateBuffer);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commandCount * sizeof(InstanceBatcher::DrawCommand));
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WORLD_MATRICES, worldMatrixBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECTS, objectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_SETS, drawSetBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMANDS, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE, visibleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COUNTERS, counterBuffer);
+
+		float fovY = glm::radians(static_cast<float>(CameraController::currentProjection.fov));
+
+		cullProgram.use();
+		glUniform1ui(cullProgram.uniform("objectCount"), static_cast<GLuint>(objectCount));
+		glUniform1i(cullProgram.uniform("culling"), Group::cullingEnabled);
+		glUniform4fv(cullProgram.uniform("planes"), 6, glm::value_ptr(frustum.planes[0]));
+		glUniformMatrix4fv(cullProgram.uniform("view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniform1i(cullProgram.uniform("lodEnabled"), Model::lodEnabled);
+		glUniform1f(cullProgram.uniform("lodThreshold"), Model::lodThreshold);
+		glUniform1f(cullProgram.uniform("lodHysteresis"), Model::lodHysteresis);
+		glUniform1f(cullProgram.uniform("nearPlane"), static_cast<float>(CameraController::currentProjection.near));
+		glUniform1f(cullProgram.uniform("pixelsPerUnit"), WindowState::currentHeight / (2.0f * std::tan(fovY / 2.0f)));
+
+		glDispatchCompute(static_cast<GLuint>((objectCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		counterFences[counterSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		counterSlot = (counterSlot + 1) % COUNTER_RING;
+
+		InstanceBatcher::useProgram(drawProgram);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+		for (const auto& submission : submissions) {
+			GLState::bindVertexArray(formatArray(submission.layout));
+			if (submission.layout.normal == VertexLayout::Normal::NONE) glNormal3f(0.0f, 1.0f, 0.0f);
+			if (submission.layout.texcoord == VertexLayout::Texcoord::NONE) glTexCoord2f(0.0f, 0.0f);
+
+			GLState::bindTexture(GL_TEXTURE_2D, (Model::showTexture) ? submission.textureID : 0);
+			glUniform1i(drawProgram.uniform("textured"), Model::showTexture && submission.textureID != 0);
+
+			glMultiDrawElementsIndirect(GL_TRIANGLES, submission.elementType,
+				(const void*)(submission.firstCommand * sizeof(InstanceBatcher::DrawCommand)),
+				static_cast<GLsizei>(submission.commandCount), 0);
+			Model::drawCalls++;
+		}
+
+		Model::unbindBuffers();
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		GLState::useProgram(0);
+	}
+
+private:
+
+	// the newest counts whose fence has signalled, the frames before them repeat
+	// those; nothing is counted until the first fence of a build signals
+	static void readStatistics() {
+
+		// oldest frame first, the later ones can't be done before it
+		for (size_t i = 0; i < COUNTER_RING; i++) {
+			size_t slot = (counterSlot + i) % COUNTER_RING;
+			if (!counterFences[slot]) continue;
+
+			GLenum status = glClientWaitSync(counterFences[slot], 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+			GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffers[slot]);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(lastCounters), lastCounters);
+			glDeleteSync(counterFences[slot]);
+			counterFences[slot] = nullptr;
+			countersRead = true;
+		}
+
+		// the GL is a whole ring behind: the oldest frame's counts are given up for this one
+		if (counterFences[counterSlot]) {
+			glDeleteSync(counterFences[counterSlot]);
+			counterFences[counterSlot] = nullptr;
+		}
+
+		if (!countersRead) return;
+		Group::objectsDrawn += lastCounters[0];
+		Group::objectsCulled += referenceCount - lastCounters[0];
+		Model::trianglesDrawn += lastCounters[1];
+	}
+
+	// counts of frames in flight belong to the buffers as they were
+	static void dropCounters() {
+		for (GLsync& fence : counterFences) {
+			if (fence) glDeleteSync(fence);
+			fence = nullptr;
+		}
+		countersRead = false;
+	}
+
+	// arena arrays at offset 0 and the object index, advancing once per instance
+	static GLuint formatArray(const VertexLayout& layout) {
+
+		auto [it, added] = formatArrays.try_emplace(InstanceBatcher::formatKey(layout), 0);
+		if (!added) return it->second;
+
+		glGenVertexArrays(1, &it->second);
+		GLState::bindVertexArray(it->second);
+		Model::setupArrays(layout, 0);
+
+		GLState::bindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+		glEnableVertexAttribArray(OBJECT_INDEX_LOCATION);
+		glVertexAttribDivisor(OBJECT_INDEX_LOCATION, 1);
+		glVertexAttribIPointer(OBJECT_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0, nullptr);
+
+		return it->second;
+	}
+};
+
+#endif
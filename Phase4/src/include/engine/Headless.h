@@ -0,0 +1,213 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <mutex>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef ENGINE_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "Parsing.h"
+
+////////////////////////////////////////////////////////////
+// Headless rendering
+//
+// With --headless the engine makes no window. An EGL context
+// with no surface (or a tiny pbuffer where the driver needs
+// one) is made current and the frames are drawn into a
+// framebuffer object of the requested size. This needs no X
+// server, so Mesa's llvmpipe can run the engine on build
+// machines. main draws a fixed number of frames with a fixed
+// time step, which puts the same images out on every run,
+// and can save them as PNG files through DevIL.
+//
+// The GLUT fonts need glutInit, so there is no HUD text; the
+// statistics are printed when the run ends instead.
+//
+// EGL is only linked where CMake finds it (ENGINE_HEADLESS).
+////////////////////////////////////////////////////////////
+
+struct Headless {
+
+	inline static bool enabled = false;
+	inline static int frames = 300;
+	inline static float frameStepMs = 1000.0f / 60.0f;
+
+	// --size, over the window size in the scene file; 0 keeps that
+	inline static int width = 0;
+	inline static int height = 0;
+
+	// a std::format pattern with the frame number, e.g. "frame{:04}.png"; empty saves nothing
+	inline static std::string framePattern;
+
+	static void parseSize(const std::string& size) {
+		int consumed = 0;
+		if (std::sscanf(size.c_str(), "%dx%d%n", &width, &height, &consumed) != 2
+			|| consumed != static_cast<int>(size.size()) || width <= 0 || height <= 0)
+			throw std::runtime_error(std::format("Invalid size '{}', expected WIDTHxHEIGHT", size));
+	}
+
+	// formatted once here, so a bad pattern stops the run before the first frame
+	static void parseFramePattern(const std::string& pattern) {
+		try {
+			if (pattern.empty() || std::vformat(pattern, std::make_format_args(frames)).empty())
+				throw std::format_error("empty file name");
+		}
+		catch (const std::format_error& e) {
+			throw std::runtime_error(std::format("Invalid frame file pattern '{}': {}", pattern, e.what()));
+		}
+		framePattern = pattern;
+	}
+
+	// before glewInit
+	static void createContext() {
+#ifdef ENGINE_HEADLESS
+		const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		bool surfaceless = extensions && std::string(extensions).find("EGL_MESA_platform_surfaceless") != std::string::npos;
+
+		auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		display = (surfaceless && getPlatformDisplay)
+			? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+			: eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major, minor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+			throw std::runtime_error(std::format("Could not initialize EGL (error 0x{:x})", eglGetError()));
+		if (!eglBindAPI(EGL_OPENGL_API))
+			throw std::runtime_error("EGL has no desktop OpenGL");
+
+		const EGLint configAttributes[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint configs = 0;
+		eglChooseConfig(display, configAttributes, &config, 1, &configs);
+		if (configs == 0)
+			throw std::runtime_error("No EGL config renders desktop OpenGL");
+
+		// no version asked for: the highest compatibility profile the driver has
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+		if (context == EGL_NO_CONTEXT)
+			throw std::runtime_error(std::format("Could not create an EGL context (error 0x{:x})", eglGetError()));
+
+		std::string clientExtensions = eglQueryString(display, EGL_EXTENSIONS);
+		if (clientExtensions.find("EGL_KHR_surfaceless_context") == std::string::npos) {
+			const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+			surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+		}
+
+		if (!eglMakeCurrent(display, surface, surface, context))
+			throw std::runtime_error(std::format("Could not make the EGL context current (error 0x{:x})", eglGetError()));
+
+		std::cout << std::format("Headless EGL {}.{}: {} ({})", major, minor,
+			reinterpret_cast<const char*>(glGetString(GL_RENDERER)), reinterpret_cast<const char*>(glGetString(GL_VERSION))) << std::endl;
+#else
+		throw std::runtime_error("This engine was built without EGL, headless rendering is unavailable");
+#endif
+	}
+
+	// after glewInit; the framebuffer stays bound for the whole run
+	static void createTarget() {
+
+		if (!width || !height) {
+			width = WindowState::initialWidth;
+			height = WindowState::initialHeight;
+		}
+
+		if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object)
+			throw std::runtime_error("Headless rendering needs framebuffer objects");
+
+		glGenFramebuffers(1, &framebufferID);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+
+		glGenRenderbuffers(2, renderbufferIDs);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbufferIDs[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbufferIDs[0]);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbufferIDs[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbufferIDs[1]);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			throw std::runtime_error("Headless framebuffer is incomplete");
+
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+		WindowState::changeSize(width, height);
+	}
+
+	// waits for the frame to finish; false when the file could not be written
+	static bool saveFrame(int frame) {
+
+		if (framePattern.empty()) return true;
+
+		std::vector<unsigned char> pixels(size_t(width) * height * 4);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+		// opaque, whatever the clear colour's alpha
+		for (size_t i = 3; i < pixels.size(); i += 4)
+			pixels[i] = 255;
+
+		std::string filename = std::vformat(framePattern, std::make_format_args(frame));
+
+		std::lock_guard<std::mutex> lock(modelFileManagement::ilMutex);
+		modelFileManagement::initDevIL();
+		ilEnable(IL_FILE_OVERWRITE);
+
+		ILuint imageID;
+		ilGenImages(1, &imageID);
+		ilBindImage(imageID);
+		bool saved = ilTexImage(width, height, 1, 4, IL_RGBA, IL_UNSIGNED_BYTE, pixels.data())
+			&& ilSave(IL_PNG, const_cast<char*>(filename.c_str()));
+		ilDeleteImages(1, &imageID);
+
+		if (!saved)
+			std::cerr << std::format("Failed to save frame {} to {}", frame, filename) << std::endl;
+		return saved;
+	}
+
+	static void cleanup() {
+		if (framebufferID) {
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glDeleteRenderbuffers(2, renderbufferIDs);
+			glDeleteFramebuffers(1, &framebufferID);
+			framebufferID = 0;
+		}
+#ifdef ENGINE_HEADLESS
+		if (display != EGL_NO_DISPLAY) {
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+			if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+			eglTerminate(display);
+			display = EGL_NO_DISPLAY;
+			surface = EGL_NO_SURFACE;
+			context = EGL_NO_CONTEXT;
+		}
+#endif
+	}
+
+private:
+
+	inline static GLuint framebufferID = 0;
+	inline static GLuint renderbufferIDs[2] = { 0, 0 };
+
+#ifdef ENGINE_HEADLESS
+	inline static EGLDisplay display = EGL_NO_DISPLAY;
+	inline static EGLSurface surface = EGL_NO_SURFACE;
+	inline static EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+#endif
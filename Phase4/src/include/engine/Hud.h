@@ -0,0 +1,275 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <array>
+#include <string>
+#include <vector>
+#include <format>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include "GLState.h"
+#include "DebugDraw.h"
+
+////////////////////////////////////////////////////////////
+// Heads-up display
+//
+// Text goes through a glyph atlas: the printable ASCII
+// characters of a GLUT bitmap font are rasterized once with
+// glutBitmapCharacter, copied into a texture and measured
+// with glutBitmapWidth. A Line keeps its text in a vertex
+// buffer of textured quads in pixels, relative to its
+// baseline, and rebuilds it only when the text changes, so
+// a frame costs one draw per line. Quads sit on whole
+// pixels and sample the atlas unfiltered, which puts the
+// same pixels on screen as the bitmap calls did.
+//
+// FrameTimes keeps the last few seconds of frame times for
+// the HUD, with their minimum, mean and 99th percentile and
+// a bar graph of them.
+////////////////////////////////////////////////////////////
+
+struct HudText {
+
+	static constexpr int FIRST_CHARACTER = 32;
+	static constexpr int LAST_CHARACTER = 126;
+	static constexpr int COLUMNS = 16;
+	static constexpr int ROWS = (LAST_CHARACTER - FIRST_CHARACTER + COLUMNS) / COLUMNS;
+	static constexpr int CELL = 16;     // pixels, enough for the 12 and 13 point fonts
+	static constexpr int BASELINE = 4;  // room below the baseline for descenders
+	static constexpr int LEFT = 2;      // and to the left of the origin
+
+	inline static GLuint atlasID = 0;
+	inline static std::array<int, LAST_CHARACTER + 1> advance = {};
+
+	static bool ready() {
+		return atlasID != 0;
+	}
+
+	// Draws the glyphs into the bottom left corner of the current draw buffer
+	// and copies them out, so it belongs before the frame's glClear
+	static void buildAtlas(void* font) {
+
+		const int width = COLUMNS * CELL, height = ROWS * CELL;
+
+		GLState::pushAttrib(GL_ALL_ATTRIB_BITS);
+		glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity();
+		glOrtho(0, width, 0, height, -1, 1);
+		glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
+
+		glViewport(0, 0, width, height);
+		glDisable(GL_LIGHTING);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_TEXTURE_2D);
+		glDisable(GL_BLEND);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(0, 0, width, height);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glColor3f(1.0f, 1.0f, 1.0f);
+		for (int c = FIRST_CHARACTER; c <= LAST_CHARACTER; c++) {
+			auto [x, y] = cell(c);
+			glRasterPos2i(x + LEFT, y + BASELINE);
+			glutBitmapCharacter(font, c);
+			advance[c] = glutBitmapWidth(font, c);
+		}
+
+		// white on black: the red channel is the coverage, as intensity it is the alpha too
+		if (!atlasID) glGenTextures(1, &atlasID);
+		GLState::bindTexture(GL_TEXTURE_2D, atlasID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_INTENSITY8, 0, 0, width, height, 0);
+		GLState::bindTexture(GL_TEXTURE_2D, 0);
+
+		glMatrixMode(GL_PROJECTION); glPopMatrix();
+		glMatrixMode(GL_MODELVIEW); glPopMatrix();
+		GLState::popAttrib();
+	}
+
+	class Line {
+	public:
+
+		void set(const std::string& text) {
+			if (bufferID && text == current) return;
+			current = text;
+			rebuild();
+		}
+
+		// baseline at (x, y) in window pixels, between begin() and end()
+		void draw(int x, int y) const {
+			if (!vertexCount) return;
+			glLoadIdentity();
+			glTranslatef(static_cast<float>(x), static_cast<float>(y), 0.0f);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, bufferID);
+			glVertexPointer(2, GL_FLOAT, sizeof(Vertex), (void*)offsetof(Vertex, x));
+			glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (void*)offsetof(Vertex, u));
+			glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+			drawCalls++;
+		}
+
+		void destroy() {
+			if (bufferID) glDeleteBuffers(1, &bufferID);
+			bufferID = 0;
+			vertexCount = 0;
+			current.clear();
+		}
+
+	private:
+
+		struct Vertex {
+			float x, y, u, v;
+		};
+
+		std::string current;
+		GLuint bufferID = 0;
+		GLsizei vertexCount = 0;
+
+		void rebuild() {
+
+			std::vector<Vertex> vertices;
+			vertices.reserve(current.size() * 6);
+
+			const float atlasWidth = COLUMNS * CELL, atlasHeight = ROWS * CELL;
+			int pen = 0;
+			for (char ch : current) {
+				int c = static_cast<unsigned char>(ch);
+				if (c < FIRST_CHARACTER || c > LAST_CHARACTER) continue;
+
+				auto [cx, cy] = cell(c);
+				float x0 = static_cast<float>(pen - LEFT), x1 = x0 + CELL;
+				float y0 = static_cast<float>(-BASELINE), y1 = y0 + CELL;
+				float u0 = cx / atlasWidth, u1 = (cx + CELL) / atlasWidth;
+				float v0 = cy / atlasHeight, v1 = (cy + CELL) / atlasHeight;
+
+				vertices.insert(vertices.end(), {
+					{ x0, y0, u0, v0 }, { x1, y0, u1, v0 }, { x1, y1, u1, v1 },
+					{ x0, y0, u0, v0 }, { x1, y1, u1, v1 }, { x0, y1, u0, v1 }
+				});
+				pen += advance[c];
+			}
+
+			if (!bufferID) glGenBuffers(1, &bufferID);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, bufferID);
+			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.empty() ? nullptr : vertices.data(), GL_DYNAMIC_DRAW);
+			vertexCount = static_cast<GLsizei>(vertices.size());
+			rebuilds++;
+		}
+	};
+
+	// per frame statistics
+	inline static size_t drawCalls = 0;
+	inline static size_t rebuilds = 0;
+
+	// Pixel coordinates with the origin at the bottom left of the window, the
+	// atlas bound and blended; lines then set their colour with glColor
+	static void begin(int windowWidth, int windowHeight) {
+
+		GLState::pushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT | GL_POLYGON_BIT | GL_LIGHTING_BIT | GL_DEPTH_BUFFER_BIT);
+		GLState::disable(GL_LIGHTING);
+		GLState::disable(GL_DEPTH_TEST);
+		GLState::disable(GL_CULL_FACE);
+		GLState::enable(GL_TEXTURE_2D);
+		GLState::enable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+		GLState::bindTexture(GL_TEXTURE_2D, atlasID);
+
+		glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity();
+		glOrtho(0, windowWidth, 0, windowHeight, -1, 1);
+		glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
+
+		if (GLState::vertexArrays) GLState::bindVertexArray(0);
+		GLState::enableClientState(GL_VERTEX_ARRAY);
+		GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+		GLState::disableClientState(GL_NORMAL_ARRAY);
+		GLState::disableClientState(GL_COLOR_ARRAY);
+	}
+
+	static void end() {
+		GLState::disableClientState(GL_VERTEX_ARRAY);
+		GLState::disableClientState(GL_TEXTURE_COORD_ARRAY);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::bindTexture(GL_TEXTURE_2D, 0);
+
+		glMatrixMode(GL_PROJECTION); glPopMatrix();
+		glMatrixMode(GL_MODELVIEW); glPopMatrix();
+		GLState::popAttrib();
+	}
+
+	static void cleanup() {
+		if (atlasID) glDeleteTextures(1, &atlasID);
+		atlasID = 0;
+		GLState::reset();
+	}
+
+private:
+
+	// bottom left corner of a character's cell in the atlas
+	static std::pair<int, int> cell(int c) {
+		int i = c - FIRST_CHARACTER;
+		return { (i % COLUMNS) * CELL, (i / COLUMNS) * CELL };
+	}
+};
+
+struct FrameTimes {
+
+	static constexpr size_t SAMPLES = 240;
+
+	// over the samples held
+	float minMs = 0.0f;
+	float averageMs = 0.0f;
+	float p99Ms = 0.0f;
+
+	void record(float ms) {
+		samples[next] = ms;
+		next = (next + 1) % SAMPLES;
+		count = std::min(count + 1, SAMPLES);
+
+		sorted.assign(samples.begin(), samples.begin() + count);
+		size_t rank = std::min(count - 1, static_cast<size_t>(std::ceil(0.99 * count)) - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+		p99Ms = sorted[rank];
+		minMs = *std::min_element(sorted.begin(), sorted.end());
+		averageMs = std::accumulate(sorted.begin(), sorted.end(), 0.0f) / count;
+	}
+
+	std::string hudString() const {
+		return std::format("Frame time: {:.1f} min, {:.1f} avg, {:.1f} p99 ms", minMs, averageMs, p99Ms);
+	}
+
+	// One bar per frame, oldest on the left, in a width x height pixel box
+	// from (x, y) that tops out at maxMs; green within 60 Hz, yellow within
+	// 30 Hz, red beyond, with the 60 and 30 Hz budgets marked
+	void graph(DebugDraw::Batch& batch, float x, float y, float width, float height, float maxMs = 50.0f) const {
+
+		auto level = [&](float ms) { return y + height * std::min(ms, maxMs) / maxMs; };
+
+		const glm::vec3 frame = { 0.4f, 0.4f, 0.4f };
+		batch.polyline({ { x, y, 0.0f }, { x + width, y, 0.0f }, { x + width, y + height, 0.0f }, { x, y + height, 0.0f } }, frame, true);
+		for (float budget : { 1000.0f / 60.0f, 1000.0f / 30.0f })
+			batch.line({ x, level(budget), 0.0f }, { x + width, level(budget), 0.0f }, frame);
+
+		float step = width / SAMPLES;
+		for (size_t i = 0; i < count; i++) {
+			float ms = samples[(next + SAMPLES - count + i) % SAMPLES];
+			glm::vec3 color = (ms <= 1000.0f / 60.0f) ? glm::vec3(0.0f, 1.0f, 0.0f) : (ms <= 1000.0f / 30.0f) ? glm::vec3(1.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+			float bar = x + (SAMPLES - count + i + 0.5f) * step;
+			batch.line({ bar, y, 0.0f }, { bar, level(ms), 0.0f }, color, std::max(1.0f, std::floor(step)));
+		}
+	}
+
+private:
+
+	std::array<float, SAMPLES> samples = {};
+	std::vector<float> sorted;
+	size_t next = 0;
+	size_t count = 0;
+};
+
+#endif
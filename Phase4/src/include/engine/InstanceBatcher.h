@@ -0,0 +1,587 @@
+#ifndef INSTANCEBATCHER_H
+#define INSTANCEBATCHER_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "Config.h"
+#include "Shader.h"
+
+////////////////////////////////////////////////////////////
+// Instanced and multi-draw batching
+//
+// Collects the visible references of each (mesh, texture, material, level)
+// during the scene walk and draws each set with a single instanced call.
+// The fixed function pipeline has no per-instance transform, so these draws
+// go through a small GLSL program that reproduces its lighting from the
+// built-in light and material state. Sets smaller than minInstances, and
+// GLs without instanced arrays, take the plain path.
+//
+// With multi-draw indirect (GL 4.3, or its two ARB extensions) every set,
+// single objects included, becomes one command in a per-frame indirect
+// buffer instead. Each instance's matrix, position decode and material sit
+// in a per-frame buffer of DrawData read as instanced attributes, so the
+// command's baseInstance is the index of its first draw. All meshes live in
+// the MeshArena buffers, so commands sharing a vertex format, index type
+// and texture are submitted together in one glMultiDrawElementsIndirect.
+////////////////////////////////////////////////////////////
+
+struct InstanceBatcher {
+
+	inline static bool enabled = true;
+	inline static bool supported = false;
+	inline static size_t minInstances = 2;
+
+	inline static bool multiDraw = true;
+	inline static bool multiDrawSupported = false;
+
+	// per frame statistics
+	inline static size_t batches = 0;
+	inline static size_t instancesDrawn = 0;
+
+	// mat4 attribute, takes 4 consecutive locations (clear of the aliased fixed function ones)
+	static constexpr GLuint INSTANCE_MATRIX_LOCATION = 10;
+
+	// the rest of DrawData, clear of position (0), normal (2), color (3) and texcoord 0 (8)
+	static constexpr GLuint DRAW_DECODE_LOCATION = 1;
+	static constexpr GLuint DRAW_DIFFUSE_LOCATION = 4;
+	static constexpr GLuint DRAW_AMBIENT_LOCATION = 5;
+	static constexpr GLuint DRAW_SPECULAR_LOCATION = 6;
+	static constexpr GLuint DRAW_EMISSION_LOCATION = 7;
+
+	// Built with PER_DRAW defined for multi-draw, where the decode and material
+	// come from attributes instead of a uniform and the fixed function state,
+	// and with GPU_DRIVEN for GpuCulling, where an object index is the only
+	// attribute and the rest is read from the storage buffers it declares
+	inline static const char* vertexSource = R"(
+	#if defined(GPU_DRIVEN)
+		in uint objectIndex;
+
+		mat4 instanceMatrix;
+		vec4 drawDecode, drawDiffuse, drawAmbient, drawSpecular, drawEmission;
+
+		void fetch() {
+			Object object = objects[objectIndex];
+			DrawSet set = drawSets[object.set];
+			instanceMatrix = worldMatrices[object.node];
+			drawDecode = set.decode;
+			drawDiffuse = set.diffuse;
+			drawAmbient = set.ambient;
+			drawSpecular = set.specular;
+			drawEmission = set.emission;
+		}
+		#define PER_DRAW
+	#elif defined(PER_DRAW)
+		attribute mat4 instanceMatrix; // object -> world
+		attribute vec4 drawDecode;
+		attribute vec4 drawDiffuse;
+		attribute vec4 drawAmbient;
+		attribute vec4 drawSpecular;
+		attribute vec4 drawEmission; // w is the shininess
+	#else
+		attribute mat4 instanceMatrix; // object -> world
+	#endif
+
+		uniform int lightCount;
+		uniform bool lighting;
+
+	#ifdef PER_DRAW
+		#define DECODE drawDecode
+		#define SCENE_COLOR (drawEmission + drawAmbient * gl_LightModel.ambient)
+		#define AMBIENT_PRODUCT(i) (drawAmbient * gl_LightSource[i].ambient)
+		#define DIFFUSE_PRODUCT(i) (drawDiffuse * gl_LightSource[i].diffuse)
+		#define SPECULAR_PRODUCT(i) (drawSpecular * gl_LightSource[i].specular)
+		#define SHININESS drawEmission.w
+		#define ALPHA drawDiffuse.a
+	#else
+		uniform vec4 decode; // quantized positions: offset xyz, scale w
+
+		#define DECODE decode
+		#define SCENE_COLOR gl_FrontLightModelProduct.sceneColor
+		#define AMBIENT_PRODUCT(i) gl_FrontLightProduct[i].ambient
+		#define DIFFUSE_PRODUCT(i) gl_FrontLightProduct[i].diffuse
+		#define SPECULAR_PRODUCT(i) gl_FrontLightProduct[i].specular
+		#define SHININESS gl_FrontMaterial.shininess
+		#define ALPHA gl_FrontMaterial.diffuse.a
+	#endif
+
+		void main() {
+		#ifdef GPU_DRIVEN
+			fetch();
+		#endif
+			vec4 object = vec4(DECODE.xyz + DECODE.w * gl_Vertex.xyz, 1.0);
+			vec4 eye = gl_ModelViewMatrix * (instanceMatrix * object);
+			gl_Position = gl_ProjectionMatrix * eye;
+			gl_TexCoord[0] = gl_MultiTexCoord0;
+
+			if (!lighting) {
+				gl_FrontColor = gl_Color;
+				return;
+			}
+
+			// inverse transpose up to scale (cofactors), sign kept for mirroring transforms
+			mat3 m = mat3(instanceMatrix);
+			mat3 cofactors = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+			float handedness = sign(dot(m[0], cofactors[0]));
+			vec3 n = normalize(gl_NormalMatrix * (handedness * (cofactors * gl_Normal)));
+
+			// GL_SINGLE_COLOR, non local viewer
+			vec4 color = SCENE_COLOR;
+			for (int i = 0; i < lightCount; i++) {
+
+				vec3 l;
+				float attenuation = 1.0;
+
+				if (gl_LightSource[i].position.w == 0.0) {
+					l = normalize(gl_LightSource[i].position.xyz);
+				}
+				else {
+					vec3 toLight = gl_LightSource[i].position.xyz - eye.xyz;
+					float d = length(toLight);
+					l = toLight / d;
+					attenuation = 1.0 / (gl_LightSource[i].constantAttenuation
+						+ gl_LightSource[i].linearAttenuation * d
+						+ gl_LightSource[i].quadraticAttenuation * d * d);
+
+					if (gl_LightSource[i].spotCutoff <= 90.0) {
+						float spot = dot(-l, normalize(gl_LightSource[i].spotDirection));
+						attenuation *= (spot < gl_LightSource[i].spotCosCutoff) ? 0.0
+							: (gl_LightSource[i].spotExponent > 0.0) ? pow(spot, gl_LightSource[i].spotExponent) : 1.0;
+					}
+				}
+
+				float diffuse = max(dot(n, l), 0.0);
+				vec4 term = AMBIENT_PRODUCT(i) + diffuse * DIFFUSE_PRODUCT(i);
+				if (diffuse > 0.0) {
+					float highlight = max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0);
+					term += ((SHININESS > 0.0) ? pow(highlight, SHININESS) : 1.0) * SPECULAR_PRODUCT(i);
+				}
+				color += attenuation * term;
+			}
+
+			gl_FrontColor = vec4(clamp(color.rgb, 0.0, 1.0), ALPHA);
+		}
+	)";
+
+	// GL_MODULATE
+	inline static const char* fragmentSource = R"(
+		uniform sampler2D diffuseMap;
+		uniform bool textured;
+
+		void main() {
+			vec4 color = gl_Color;
+			if (textured) color *= texture2D(diffuseMap, gl_TexCoord[0].st);
+			gl_FragColor = color;
+		}
+	)";
+
+	struct Key {
+		Model* model;
+		unsigned int textureID;
+		unsigned int lod;
+		Material material;
+
+		bool operator==(const Key& o) const {
+			return model == o.model && textureID == o.textureID && lod == o.lod
+				&& std::memcmp(&material, &o.material, sizeof(Material)) == 0;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& k) const {
+			uint64_t hash = 14695981039346656037ull;
+			auto mix = [&](const void* data, size_t size) {
+				for (size_t i = 0; i < size; i++) {
+					hash ^= static_cast<const unsigned char*>(data)[i];
+					hash *= 1099511628211ull;
+				}
+			};
+			mix(&k.model, sizeof(k.model));
+			mix(&k.textureID, sizeof(k.textureID));
+			mix(&k.lod, sizeof(k.lod));
+			mix(&k.material, sizeof(Material));
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	// one per instance drawn through multi-draw; emission.w is the shininess
+	struct DrawData {
+		glm::mat4 world;
+		glm::vec4 decode;
+		glm::vec4 diffuse, ambient, specular, emission;
+	};
+
+	// laid out as the GL reads it from the indirect buffer
+	struct DrawCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// commands drawn by one glMultiDrawElementsIndirect
+	struct Submission {
+		VertexLayout layout;
+		GLenum elementType;
+		unsigned int textureID;
+		std::vector<DrawCommand> commands;
+	};
+
+	// object -> world matrices of each set, emptied (not freed) every frame
+	inline static std::unordered_map<Key, std::vector<glm::mat4>, KeyHash> pending;
+	inline static std::vector<glm::mat4> uploads;
+	inline static glm::mat4 view = glm::mat4(1.0f);
+
+	// multi-draw, also emptied every frame
+	inline static std::unordered_map<uint64_t, Submission> submissions;
+	inline static std::vector<DrawData> drawData;
+	inline static std::vector<DrawCommand> commands;
+
+	inline static ShaderProgram program;
+	inline static GLuint instanceBufferID = 0;
+
+	inline static ShaderProgram multiDrawProgram;
+	inline static GLuint drawBufferID = 0;
+	inline static GLuint commandBufferID = 0;
+	inline static std::unordered_map<uint32_t, GLuint> formatArrays; // vertex array object per vertex format
+
+	static bool active() {
+		return enabled && supported;
+	}
+
+	static bool multiDrawActive() {
+		return active() && multiDraw && multiDrawSupported;
+	}
+
+	// after glewInit; leaves the plain path on anything short of GL 3.3
+	static void detectSupport() {
+		supported = false;
+		if (!GLEW_VERSION_3_3) {
+			std::cout << "Instancing unavailable (needs OpenGL 3.3), drawing every object separately" << std::endl;
+			return;
+		}
+
+		try {
+			program = ShaderProgram::build((std::string("#version 120\n") + vertexSource).c_str(),
+				(std::string("#version 120\n") + fragmentSource).c_str(), { { INSTANCE_MATRIX_LOCATION, "instanceMatrix" } });
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << std::format("Instancing disabled: {}", e.what()) << std::endl;
+			return;
+		}
+
+		glGenBuffers(1, &instanceBufferID);
+		supported = true;
+
+		detectMultiDrawSupport();
+	}
+
+	static void detectMultiDrawSupport() {
+		multiDrawSupported = false;
+		if (!GLEW_VERSION_4_3 && !(GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance)) {
+			std::cout << "Multi-draw indirect unavailable (needs OpenGL 4.3), one instanced call per set" << std::endl;
+			return;
+		}
+
+		try {
+			multiDrawProgram = ShaderProgram::build((std::string("#version 120\n#define PER_DRAW\n") + vertexSource).c_str(),
+				(std::string("#version 120\n") + fragmentSource).c_str(), {
+				{ INSTANCE_MATRIX_LOCATION, "instanceMatrix" },
+				{ DRAW_DECODE_LOCATION, "drawDecode" },
+				{ DRAW_DIFFUSE_LOCATION, "drawDiffuse" },
+				{ DRAW_AMBIENT_LOCATION, "drawAmbient" },
+				{ DRAW_SPECULAR_LOCATION, "drawSpecular" },
+				{ DRAW_EMISSION_LOCATION, "drawEmission" } });
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << std::format("Multi-draw disabled: {}", e.what()) << std::endl;
+			return;
+		}
+
+		glGenBuffers(1, &drawBufferID);
+		glGenBuffers(1, &commandBufferID);
+		multiDrawSupported = true;
+	}
+
+	static void cleanup() {
+		program.destroy();
+		multiDrawProgram.destroy();
+		for (auto& [_, vertexArray] : formatArrays)
+			glDeleteVertexArrays(1, &vertexArray);
+		formatArrays.clear();
+		for (GLuint* buffer : { &instanceBufferID, &drawBufferID, &commandBufferID }) {
+			if (*buffer) glDeleteBuffers(1, buffer);
+			*buffer = 0;
+		}
+		supported = multiDrawSupported = false;
+		GLState::reset();
+	}
+
+	// multi-draw -> one instanced call per set -> off
+	static void toggle() {
+		if (enabled && multiDraw && multiDrawSupported) multiDraw = false;
+		else if (enabled) enabled = false;
+		else enabled = multiDraw = true;
+	}
+
+	static std::string modeName() {
+		if (!supported) return "Unsupported";
+		if (!enabled) return "Off";
+		return (multiDraw && multiDrawSupported) ? "Multi-draw indirect" : "On";
+	}
+
+	// viewMatrix must be the modelview in place when flush() runs
+	static void begin(const glm::mat4& viewMatrix) {
+		view = viewMatrix;
+		for (auto& [_, matrices] : pending)
+			matrices.clear();
+	}
+
+	// same contract as ModelStorage::draw, with the object -> world matrix given
+	// instead of taken from the GL
+	static void add(const std::string& modelFilename, unsigned int textureID, const Material& material, unsigned int* lod, const glm::mat4& world) {
+		auto it = ModelStorage::models.find(modelFilename);
+		if (it == ModelStorage::models.end()) return;
+
+		add(it->second, textureID, material, lod, world);
+	}
+
+	static void add(Model& model, unsigned int textureID, const Material& material, unsigned int* lod, const glm::mat4& world) {
+		if (!model.buffersInitialised) model.initBuffers();
+
+		unsigned int level = *lod = model.selectLod(*lod, view * world);
+		pending[{ &model, textureID, level, material }].push_back(world);
+	}
+
+	static void flush() {
+
+		if (multiDrawActive()) return flushMultiDraw();
+
+		struct Batch {
+			const Key* key;
+			size_t first, count;
+		};
+
+		std::vector<Batch> instanced;
+		uploads.clear();
+
+		for (auto& [key, matrices] : pending) {
+			if (matrices.empty()) continue;
+
+			// too few to be worth the attribute setup
+			if (matrices.size() < minInstances) {
+				for (const auto& m : matrices)
+					RenderQueue::push(*key.model, key.textureID, key.material, key.lod, view * m);
+				continue;
+			}
+
+			instanced.push_back({ &key, uploads.size(), matrices.size() });
+			uploads.insert(uploads.end(), matrices.begin(), matrices.end());
+		}
+
+		if (instanced.empty()) return;
+
+		// whole frame in one upload, orphaning last frame's storage
+		GLState::bindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+		glBufferData(GL_ARRAY_BUFFER, uploads.size() * sizeof(glm::mat4), uploads.data(), GL_STREAM_DRAW);
+
+		useProgram(program);
+
+		for (const auto& batch : instanced) {
+			const Key& key = *batch.key;
+			const VertexLayout& layout = key.model->layout;
+
+			key.model->bindArrays(key.textureID, key.material);
+
+			// on the model's vertex array object, and taken off it again after the draw
+			GLState::bindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+			for (GLuint column = 0; column < 4; column++) {
+				glEnableVertexAttribArray(INSTANCE_MATRIX_LOCATION + column);
+				glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + column, 1);
+				glVertexAttribPointer(INSTANCE_MATRIX_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+					(void*)((batch.first * sizeof(glm::mat4)) + column * sizeof(glm::vec4)));
+			}
+
+			bool quantized = layout.position != VertexLayout::Position::FLOAT32;
+			glUniform4f(program.uniform("decode"),
+				quantized ? layout.positionOffset.x : 0.0f,
+				quantized ? layout.positionOffset.y : 0.0f,
+				quantized ? layout.positionOffset.z : 0.0f,
+				quantized ? layout.positionScale : 1.0f);
+			glUniform1i(program.uniform("textured"), Model::showTexture && key.textureID != 0);
+
+			key.model->drawInstanced(key.lod, batch.count);
+
+			for (GLuint column = 0; column < 4; column++) {
+				glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + column, 0);
+				glDisableVertexAttribArray(INSTANCE_MATRIX_LOCATION + column);
+			}
+
+			key.model->unbindArrays();
+
+			batches++;
+			instancesDrawn += batch.count;
+		}
+
+		GLState::useProgram(0);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	static void flushMultiDraw() {
+
+		drawData.clear();
+		commands.clear();
+		for (auto& [_, submission] : submissions)
+			submission.commands.clear();
+
+		for (auto& [key, matrices] : pending) {
+			if (matrices.empty()) continue;
+
+			const Model& model = *key.model;
+			Model::Lod range = model.lodRange(key.lod);
+
+			Submission& submission = submissions[submissionKey(model, key.textureID)];
+			submission.layout = model.layout;
+			submission.elementType = model.elementType;
+			submission.textureID = key.textureID;
+			submission.commands.push_back({
+				static_cast<GLuint>(range.indexCount),
+				static_cast<GLuint>(matrices.size()),
+				static_cast<GLuint>(model.indexBase / model.indexSize() + range.firstIndex),
+				static_cast<GLint>(model.vertexBase / model.layout.stride()),
+				static_cast<GLuint>(drawData.size())
+			});
+
+			DrawData draw = {
+				.world = glm::mat4(1.0f),
+				.decode = decodeVector(model.layout),
+				.diffuse = materialVector(key.material.diffuse),
+				.ambient = materialVector(key.material.ambient),
+				.specular = materialVector(key.material.specular),
+				.emission = materialVector(key.material.emissive, key.material.shininess[0])
+			};
+			for (const auto& m : matrices) {
+				draw.world = m;
+				drawData.push_back(draw);
+			}
+
+			Model::trianglesDrawn += range.indexCount / 3 * matrices.size();
+			batches++;
+			instancesDrawn += matrices.size();
+		}
+
+		if (drawData.empty()) return;
+
+		// each submission's commands consecutive, then the frame in two uploads
+		struct Call {
+			const Submission* submission;
+			size_t first;
+		};
+
+		std::vector<Call> calls;
+		for (const auto& [_, submission] : submissions) {
+			if (submission.commands.empty()) continue;
+			calls.push_back({ &submission, commands.size() });
+			commands.insert(commands.end(), submission.commands.begin(), submission.commands.end());
+		}
+
+		GLState::bindBuffer(GL_ARRAY_BUFFER, drawBufferID);
+		glBufferData(GL_ARRAY_BUFFER, drawData.size() * sizeof(DrawData), drawData.data(), GL_STREAM_DRAW);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferID);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_STREAM_DRAW);
+
+		useProgram(multiDrawProgram);
+
+		for (const auto& call : calls) {
+			const Submission& submission = *call.submission;
+
+			GLState::bindVertexArray(formatArray(submission.layout));
+			if (submission.layout.normal == VertexLayout::Normal::NONE) glNormal3f(0.0f, 1.0f, 0.0f);
+			if (submission.layout.texcoord == VertexLayout::Texcoord::NONE) glTexCoord2f(0.0f, 0.0f);
+
+			GLState::bindTexture(GL_TEXTURE_2D, (Model::showTexture) ? submission.textureID : 0);
+			glUniform1i(multiDrawProgram.uniform("textured"), Model::showTexture && submission.textureID != 0);
+
+			glMultiDrawElementsIndirect(GL_TRIANGLES, submission.elementType, (const void*)(call.first * sizeof(DrawCommand)),
+				static_cast<GLsizei>(submission.commands.size()), 0);
+			Model::drawCalls++;
+		}
+
+		Model::unbindBuffers();
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		GLState::useProgram(0);
+	}
+
+	// lighting state shared by every program built from vertexSource
+	static void useProgram(ShaderProgram& shader) {
+		GLint lightCount = 0;
+		while (lightCount < 8 && GLState::isEnabled(GL_LIGHT0 + lightCount)) lightCount++;
+
+		shader.use();
+		glUniform1i(shader.uniform("lightCount"), lightCount);
+		glUniform1i(shader.uniform("lighting"), GLState::isEnabled(GL_LIGHTING));
+		glUniform1i(shader.uniform("diffuseMap"), 0);
+	}
+
+	static glm::vec4 decodeVector(const VertexLayout& layout) {
+		if (layout.position == VertexLayout::Position::FLOAT32) return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		return glm::vec4(layout.positionOffset, layout.positionScale);
+	}
+
+	// a material colour with the fourth component the GL defaults it to
+	static glm::vec4 materialVector(const GLfloat (&values)[3], float w = 1.0f) {
+		return glm::vec4(values[0], values[1], values[2], w);
+	}
+
+	static uint32_t formatKey(const VertexLayout& layout) {
+		return static_cast<uint32_t>(layout.position)
+			| (static_cast<uint32_t>(layout.normal) << 8)
+			| (static_cast<uint32_t>(layout.texcoord) << 16);
+	}
+
+	static uint64_t submissionKey(const Model& model, unsigned int textureID) {
+		return formatKey(model.layout)
+			| (uint64_t(model.elementType == GL_UNSIGNED_SHORT) << 24)
+			| (uint64_t(textureID) << 32);
+	}
+
+private:
+
+	// Arena arrays at offset 0 (commands carry the base vertex) and the
+	// DrawData attributes, advancing once per instance. Both buffers keep
+	// their names when they grow, so the object is built once per format.
+	static GLuint formatArray(const VertexLayout& layout) {
+
+		auto [it, added] = formatArrays.try_emplace(formatKey(layout), 0);
+		if (!added) return it->second;
+
+		glGenVertexArrays(1, &it->second);
+		GLState::bindVertexArray(it->second);
+		Model::setupArrays(layout, 0);
+
+		auto attribute = [](GLuint location, size_t offset) {
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void*)offset);
+		};
+
+		GLState::bindBuffer(GL_ARRAY_BUFFER, drawBufferID);
+		for (GLuint column = 0; column < 4; column++)
+			attribute(INSTANCE_MATRIX_LOCATION + column, offsetof(DrawData, world) + column * sizeof(glm::vec4));
+		attribute(DRAW_DECODE_LOCATION, offsetof(DrawData, decode));
+		attribute(DRAW_DIFFUSE_LOCATION, offsetof(DrawData, diffuse));
+		attribute(DRAW_AMBIENT_LOCATION, offsetof(DrawData, ambient));
+		attribute(DRAW_SPECULAR_LOCATION, offsetof(DrawData, specular));
+		attribute(DRAW_EMISSION_LOCATION, offsetof(DrawData, emission));
+
+		return it->second;
+	}
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "WorkerPool.h"
+
+////////////////////////////////////////////////////////////
+// Clustered light binning
+//
+// The view frustum is cut into a grid of clusters: screen
+// tiles across, and slices along the view depth spaced
+// exponentially between the near and far planes, so that
+// near clusters are not stretched thin. Every light with a
+// finite range is entered in each cluster its sphere may
+// touch, and a fragment only has to visit the lights of the
+// cluster it falls in, which keeps its cost with the lights
+// around it instead of with every light in the scene.
+//
+// A light covers a box of clusters: the slices its sphere
+// spans in depth and the tiles of its projected bounding
+// box (the whole screen when it reaches the near plane).
+// The output is one (offset, count) pair per cluster into
+// a shared list of light indices, filled in two passes,
+// counting and then scattering, by workers that each own
+// a band of slices and so never touch the same cluster.
+////////////////////////////////////////////////////////////
+
+struct LightClusters {
+
+	static constexpr int TILES_X = 16;
+	static constexpr int TILES_Y = 9;
+	static constexpr int SLICES = 24;
+	static constexpr int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+
+	// fewer lights are binned on the calling thread alone
+	static constexpr size_t PARALLEL_LIGHTS = 64;
+
+	// view space
+	struct Light {
+		glm::vec3 position;
+		float range;
+	};
+
+	// per cluster (offset, count) into indices, x fastest then y then slice
+	std::vector<uint32_t> grid = std::vector<uint32_t>(2 * CLUSTER_COUNT, 0);
+	std::vector<uint32_t> indices;
+
+	// slice = log(depth) * sliceScale + sliceBias
+	float sliceScale = 0.0f;
+	float sliceBias = 0.0f;
+
+	// statistics of the last build
+	size_t maxPerCluster = 0;
+	float buildMs = 0.0f;
+
+	void build(const std::vector<Light>& lights, const glm::mat4& projection, float nearPlane, float farPlane) {
+
+		auto start = std::chrono::steady_clock::now();
+
+		sliceScale = SLICES / std::log(farPlane / nearPlane);
+		sliceBias = -std::log(nearPlane) * sliceScale;
+
+		if (lights.empty()) {
+			std::fill(grid.begin(), grid.end(), 0u);
+			indices.clear();
+			maxPerCluster = 0;
+			buildMs = 0.0f;
+			return;
+		}
+
+		// cluster box of every light, empty (first > last) when it is out of view
+		std::vector<Box> boxes(lights.size());
+		WorkerPool::parallel(lights.size(), 256, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+				boxes[i] = coverage(lights[i], projection, nearPlane, farPlane);
+		});
+
+		// counting pass, prefix sum, then the same walk again writing indices
+		size_t sliceChunk = (lights.size() < PARALLEL_LIGHTS) ? SLICES : 1;
+		std::vector<uint32_t> counts(CLUSTER_COUNT, 0);
+		WorkerPool::parallel(SLICES, sliceChunk, [&](size_t first, size_t last) {
+			for (const Box& box : boxes)
+				forEachCluster(box, first, last, [&](int cluster) { counts[cluster]++; });
+		});
+
+		uint32_t offset = 0;
+		maxPerCluster = 0;
+		for (int c = 0; c < CLUSTER_COUNT; c++) {
+			grid[2 * c] = offset;
+			grid[2 * c + 1] = counts[c];
+			offset += counts[c];
+			maxPerCluster = std::max<size_t>(maxPerCluster, counts[c]);
+		}
+		indices.resize(offset);
+
+		WorkerPool::parallel(SLICES, sliceChunk, [&](size_t first, size_t last) {
+			std::vector<uint32_t> cursor(CLUSTER_COUNT, 0);
+			for (uint32_t i = 0; i < boxes.size(); i++)
+				forEachCluster(boxes[i], first, last, [&](int cluster) {
+					indices[grid[2 * cluster] + cursor[cluster]++] = i;
+				});
+		});
+
+		buildMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+
+	struct Box {
+		int x0 = 0, x1 = -1;
+		int y0 = 0, y1 = -1;
+		int z0 = 0, z1 = -1;
+	};
+
+	int slice(float depth) const {
+		return std::clamp(static_cast<int>(std::floor(std::log(depth) * sliceScale + sliceBias)), 0, SLICES - 1);
+	}
+
+	Box coverage(const Light& light, const glm::mat4& projection, float nearPlane, float farPlane) const {
+
+		Box box;
+		float depth = -light.position.z;
+		if (depth + light.range < nearPlane || depth - light.range > farPlane) return box;
+
+		box.z0 = slice(std::max(depth - light.range, nearPlane));
+		box.z1 = slice(std::min(depth + light.range, farPlane));
+
+		box.x0 = box.y0 = 0;
+		box.x1 = TILES_X - 1;
+		box.y1 = TILES_Y - 1;
+		if (depth - light.range <= nearPlane) return box;
+
+		// projected corners of the sphere's bounding box, all in front of the camera
+		glm::vec2 low(1.0f), high(-1.0f);
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 offset((corner & 1) ? light.range : -light.range, (corner & 2) ? light.range : -light.range, (corner & 4) ? light.range : -light.range);
+			glm::vec4 clip = projection * glm::vec4(light.position + offset, 1.0f);
+			glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+			low = glm::min(low, ndc);
+			high = glm::max(high, ndc);
+		}
+		if (high.x < -1.0f || high.y < -1.0f || low.x > 1.0f || low.y > 1.0f) return Box();
+
+		auto tile = [](float ndc, int count) {
+			return std::clamp(static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * count)), 0, count - 1);
+		};
+		box.x0 = tile(low.x, TILES_X);
+		box.x1 = tile(high.x, TILES_X);
+		box.y0 = tile(low.y, TILES_Y);
+		box.y1 = tile(high.y, TILES_Y);
+		return box;
+	}
+
+	// the clusters of box within slices [first, last)
+	template <typename Visit>
+	static void forEachCluster(const Box& box, size_t first, size_t last, Visit visit) {
+		int z0 = std::max(box.z0, static_cast<int>(first));
+		int z1 = std::min(box.z1, static_cast<int>(last) - 1);
+		for (int z = z0; z <= z1; z++)
+			for (int y = box.y0; y <= box.y1; y++)
+				for (int x = box.x0; x <= box.x1; x++)
+					visit(x + TILES_X * (y + TILES_Y * z));
+	}
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include <vector>
+#include <algorithm>
+
+#include "GLState.h"
+
+////////////////////////////////////////////////////////////
+// Mesh arena
+//
+// One vertex buffer and one index buffer that every model
+// is sub-allocated from, so draws never switch buffers and
+// any set of meshes can go out in one multi-draw call.
+// Blocks are appended and never freed (models live until
+// shutdown) and are addressed by byte offset. Vertex blocks
+// start on a multiple of their stride and index blocks on
+// a multiple of their index size, which makes every offset
+// a whole base vertex or first index as well.
+//
+// Growing reallocates the same buffer objects instead of
+// creating new ones, so vertex array objects that recorded
+// them stay valid.
+////////////////////////////////////////////////////////////
+
+struct MeshArena {
+
+	struct Region {
+		GLenum target;
+		GLuint id = 0;
+		size_t size = 0;     // bytes in use
+		size_t capacity = 0; // bytes allocated
+	};
+
+	inline static Region vertices = { GL_ARRAY_BUFFER, 0, 0, 0 };
+	inline static Region indices = { GL_ELEMENT_ARRAY_BUFFER, 0, 0, 0 };
+
+	// returns the byte offset of the block
+	static size_t addVertices(const void* data, size_t bytes, size_t stride) {
+		return append(vertices, data, bytes, stride);
+	}
+
+	// binds the index buffer, which a bound vertex array object records
+	static size_t addIndices(const void* data, size_t bytes, size_t indexSize) {
+		return append(indices, data, bytes, indexSize);
+	}
+
+	// copies a block back out, for load time passes over uploaded meshes
+	static std::vector<unsigned char> read(const Region& region, size_t offset, size_t bytes) {
+		std::vector<unsigned char> data(bytes);
+		GLState::bindBuffer(region.target, region.id);
+		if (bytes) glGetBufferSubData(region.target, offset, bytes, data.data());
+		return data;
+	}
+
+	static void cleanup() {
+		for (Region* region : { &vertices, &indices }) {
+			if (region->id) glDeleteBuffers(1, &region->id);
+			region->id = 0;
+			region->size = region->capacity = 0;
+		}
+		GLState::reset();
+	}
+
+private:
+
+	static constexpr size_t INITIAL_CAPACITY = 1 << 20;
+
+	static size_t append(Region& region, const void* data, size_t bytes, size_t alignment) {
+
+		size_t offset = (region.size + alignment - 1) / alignment * alignment;
+		if (offset + bytes > region.capacity)
+			grow(region, std::max({ region.capacity * 2, offset + bytes, INITIAL_CAPACITY }));
+
+		GLState::bindBuffer(region.target, region.id);
+		glBufferSubData(region.target, offset, bytes, data);
+
+		region.size = offset + bytes;
+		return offset;
+	}
+
+	// through client memory, which any GL with buffer objects can do; it
+	// only happens a handful of times while models load
+	static void grow(Region& region, size_t capacity) {
+
+		if (!region.id) glGenBuffers(1, &region.id);
+		GLState::bindBuffer(region.target, region.id);
+
+		std::vector<unsigned char> kept(region.size);
+		if (!kept.empty()) glGetBufferSubData(region.target, 0, kept.size(), kept.data());
+
+		glBufferData(region.target, capacity, nullptr, GL_STATIC_DRAW);
+		if (!kept.empty()) glBufferSubData(region.target, 0, kept.size(), kept.data());
+
+		region.capacity = capacity;
+	}
+};
+
+#endif
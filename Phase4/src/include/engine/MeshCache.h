@@ -0,0 +1,345 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Config.h"
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+
+	const char* bytes = nullptr;
+	size_t length = 0;
+
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = nullptr;
+#endif
+
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+	static std::shared_ptr<MappedFile> open(const std::filesystem::path& filepath) {
+
+		auto mapped = std::make_shared<MappedFile>();
+
+#ifdef _WIN32
+		mapped->fileHandle = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (mapped->fileHandle == INVALID_HANDLE_VALUE) return nullptr;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(mapped->fileHandle, &fileSize)) return nullptr;
+		mapped->length = static_cast<size_t>(fileSize.QuadPart);
+		if (mapped->length == 0) return mapped;
+
+		mapped->mappingHandle = CreateFileMappingW(mapped->fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapped->mappingHandle) return nullptr;
+
+		mapped->bytes = static_cast<const char*>(MapViewOfFile(mapped->mappingHandle, FILE_MAP_READ, 0, 0, 0));
+		if (!mapped->bytes) return nullptr;
+#else
+		int fd = ::open(filepath.c_str(), O_RDONLY);
+		if (fd < 0) return nullptr;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0) { ::close(fd); return nullptr; }
+		mapped->length = static_cast<size_t>(info.st_size);
+
+		if (mapped->length > 0) {
+			void* address = mmap(nullptr, mapped->length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address == MAP_FAILED) { ::close(fd); return nullptr; }
+			mapped->bytes = static_cast<const char*>(address);
+		}
+
+		::close(fd); // the mapping stays valid after closing the descriptor
+#endif
+
+		return mapped;
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mappingHandle) CloseHandle(mappingHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+#else
+		if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+	}
+};
+
+////////////////////////////////////////////////////////////
+// .3db - binary mesh cache stored next to each .3d model
+//
+// [Header][interleaved vertex stream][element indices]
+//
+// Holds exactly what Model::initBuffers hands to glBufferData,
+// so a warm start maps the file and uploads it without parsing.
+////////////////////////////////////////////////////////////
+
+namespace meshCache {
+
+	using namespace std::filesystem;
+
+	constexpr char MAGIC[4] = { '3', 'D', 'B', 'M' };
+	constexpr uint32_t VERSION = 5;
+	constexpr uint32_t MAX_LODS = 8;
+
+	// processing applied before packing - an entry only matches the same key
+	constexpr uint64_t OPTIMIZED = 1ull << 0;
+	constexpr uint64_t LODS = 1ull << 1;
+
+	uint64_t processingKey(bool optimized, bool lods) {
+		uint64_t flags = (optimized ? OPTIMIZED : 0) | (lods ? LODS : 0);
+		return flags | (VertexQuantization::fingerprint() << 2);
+	}
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+
+		// source stamp - any mismatch invalidates the entry
+		uint64_t sourceSize;
+		int64_t sourceMTime;
+		uint64_t sourceHash;
+		uint64_t processing;
+
+		uint32_t vertexStride;
+		uint32_t indexSize;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+
+		// VertexLayout
+		uint8_t positionFormat;
+		uint8_t normalFormat;
+		uint8_t texcoordFormat;
+		float positionOffset[3];
+		float positionScale;
+
+		float boundsMin[3];
+		float boundsMax[3];
+
+		uint32_t lodCount;
+		struct {
+			uint64_t firstIndex;
+			uint64_t indexCount;
+			float error;
+		} lods[MAX_LODS];
+
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+	};
+
+	struct SourceStamp {
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		uint64_t hash = 0;
+	};
+
+	// FNV-1a, 64 bit
+	uint64_t hashBytes(const char* data, size_t size) {
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	path cacheFile(const path& source) {
+		path cached = source;
+		cached.replace_extension(".3db");
+		return cached;
+	}
+
+	std::optional<SourceStamp> stamp(const path& source) {
+		std::error_code ec;
+
+		SourceStamp s;
+		s.size = file_size(source, ec);
+		if (ec) return std::nullopt;
+
+		s.mtime = last_write_time(source, ec).time_since_epoch().count();
+		if (ec) return std::nullopt;
+
+		auto mapped = MappedFile::open(source);
+		if (!mapped) return std::nullopt;
+		s.hash = hashBytes(mapped->data(), mapped->size());
+
+		return s;
+	}
+
+	constexpr uint64_t align16(uint64_t offset) {
+		return (offset + 15) & ~uint64_t(15);
+	}
+
+	// Returns a model whose packed buffers point straight into the mapped cache file,
+	// or nothing if there is no valid entry for the source
+	std::optional<Model> load(const path& source, uint64_t processing) {
+
+		path cached = cacheFile(source);
+		if (!exists(cached)) return std::nullopt;
+
+		auto mapped = MappedFile::open(cached);
+		if (!mapped || mapped->size() < sizeof(Header)) return std::nullopt;
+
+		Header header;
+		std::memcpy(&header, mapped->data(), sizeof(Header));
+
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+			|| header.processing != processing
+			|| header.positionFormat > uint8_t(VertexLayout::Position::SNORM16)
+			|| header.normalFormat > uint8_t(VertexLayout::Normal::SNORM10)
+			|| header.texcoordFormat > uint8_t(VertexLayout::Texcoord::HALF16)
+			|| (header.indexSize != sizeof(unsigned short) && header.indexSize != sizeof(unsigned int))
+			|| header.lodCount == 0 || header.lodCount > MAX_LODS)
+			return std::nullopt;
+
+		VertexLayout layout;
+		layout.position = VertexLayout::Position(header.positionFormat);
+		layout.normal = VertexLayout::Normal(header.normalFormat);
+		layout.texcoord = VertexLayout::Texcoord(header.texcoordFormat);
+		layout.positionOffset = { header.positionOffset[0], header.positionOffset[1], header.positionOffset[2] };
+		layout.positionScale = header.positionScale;
+		if (layout.stride() != header.vertexStride) return std::nullopt;
+
+		std::error_code ec;
+		if (header.sourceSize != file_size(source, ec) || ec) return std::nullopt;
+		if (header.sourceMTime != last_write_time(source, ec).time_since_epoch().count() || ec) return std::nullopt;
+
+		auto sourceStamp = stamp(source);
+		if (!sourceStamp || sourceStamp->hash != header.sourceHash) return std::nullopt;
+
+		uint64_t vertexBytes = header.vertexCount * header.vertexStride;
+		uint64_t indexBytes = header.indexCount * header.indexSize;
+		if (header.vertexOffset + vertexBytes > mapped->size() || header.indexOffset + indexBytes > mapped->size())
+			return std::nullopt;
+
+		Model model;
+		model.boundsMin = { header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] };
+		model.boundsMax = { header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] };
+		for (uint32_t i = 0; i < header.lodCount; i++) {
+			if (header.lods[i].firstIndex + header.lods[i].indexCount > header.indexCount) return std::nullopt;
+			model.lods.push_back({
+				static_cast<size_t>(header.lods[i].firstIndex),
+				static_cast<size_t>(header.lods[i].indexCount),
+				header.lods[i].error
+			});
+		}
+		model.packed = {
+			.storage = mapped,
+			.attribs = mapped->data() + header.vertexOffset,
+			.indices = mapped->data() + header.indexOffset,
+			.indexSize = header.indexSize,
+			.vertexCount = static_cast<size_t>(header.vertexCount),
+			.indexCount = static_cast<size_t>(header.indexCount),
+			.layout = layout
+		};
+
+		std::cout
+			<< std::format(
+				"Mapped {} from cache ({:.1f} KB)",
+				cached.filename().string(),
+				mapped->size() / 1024.0)
+			<< std::endl;
+
+		return model;
+	}
+
+	// Writes the model's packed buffers for the source file (written to a temporary and renamed into place)
+	bool store(const path& source, const Model& model, uint64_t processing) {
+
+		if (!model.packed.attribs || model.lods.empty() || model.lods.size() > MAX_LODS) return false;
+
+		auto sourceStamp = stamp(source);
+		if (!sourceStamp) return false;
+
+		Header header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.sourceSize = sourceStamp->size;
+		header.sourceMTime = sourceStamp->mtime;
+		header.sourceHash = sourceStamp->hash;
+		header.processing = processing;
+		header.vertexStride = model.packed.layout.stride();
+		header.indexSize = static_cast<uint32_t>(model.packed.indexSize);
+		header.vertexCount = model.packed.vertexCount;
+		header.indexCount = model.packed.indexCount;
+		header.positionFormat = uint8_t(model.packed.layout.position);
+		header.normalFormat = uint8_t(model.packed.layout.normal);
+		header.texcoordFormat = uint8_t(model.packed.layout.texcoord);
+		for (int i = 0; i < 3; i++) header.positionOffset[i] = model.packed.layout.positionOffset[i];
+		header.positionScale = model.packed.layout.positionScale;
+		header.lodCount = static_cast<uint32_t>(model.lods.size());
+		for (size_t i = 0; i < model.lods.size(); i++)
+			header.lods[i] = { model.lods[i].firstIndex, model.lods[i].indexCount, model.lods[i].error };
+		for (int i = 0; i < 3; i++) {
+			header.boundsMin[i] = model.boundsMin[i];
+			header.boundsMax[i] = model.boundsMax[i];
+		}
+		header.vertexOffset = align16(sizeof(Header));
+		header.indexOffset = align16(header.vertexOffset + header.vertexCount * header.vertexStride);
+
+		path cached = cacheFile(source);
+		path temporary = cached;
+		temporary += ".tmp";
+
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			if (!file) return false;
+
+			static const char padding[16] = {};
+			auto padTo = [&](uint64_t offset) {
+				file.write(padding, offset - static_cast<uint64_t>(file.tellp()));
+			};
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			padTo(header.vertexOffset);
+			file.write(reinterpret_cast<const char*>(model.packed.attribs), header.vertexCount * header.vertexStride);
+			padTo(header.indexOffset);
+			file.write(reinterpret_cast<const char*>(model.packed.indices), header.indexCount * header.indexSize);
+
+			if (!file) {
+				std::cerr << "Warning: could not write mesh cache " << temporary << std::endl;
+				return false;
+			}
+		}
+
+		std::error_code ec;
+		rename(temporary, cached, ec);
+		if (ec) {
+			remove(temporary, ec);
+			return false;
+		}
+
+		return true;
+	}
+};
+
+#endif
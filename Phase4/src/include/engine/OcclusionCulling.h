@@ -0,0 +1,300 @@
+#ifndef OCCLUSIONCULLING_H
+#define OCCLUSIONCULLING_H
+
+#include <array>
+#include <cmath>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "WorkerPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////
+// Software occlusion culling
+//
+// A few large occluder meshes are rasterized on the CPU into
+// a small depth buffer (normalized device depth, nearest
+// kept), four pixels at a time with SSE2 where available.
+// A hierarchical Z pyramid is built from it, every level
+// keeping the farthest depth of the texels below. An object
+// is occluded when the nearest point of its bounding box
+// lies behind the farthest depth of every texel its screen
+// rectangle touches, on the level where that rectangle
+// covers at most 2x2 texels.
+//
+// Pixels are counted as covered from their centre, so the
+// tested rectangle is grown by a pixel on every side to keep
+// objects peeking past an occluder's silhouette.
+////////////////////////////////////////////////////////////
+
+struct OcclusionBuffer {
+
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 128;
+
+	struct Level {
+		int width, height;
+		std::vector<float> depth;
+	};
+
+	// level 0 is the rasterized buffer itself
+	std::vector<Level> levels;
+
+	OcclusionBuffer() {
+		for (int w = WIDTH, h = HEIGHT; ; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+			levels.push_back({ w, h, std::vector<float>(size_t(w) * h, 1.0f) });
+			if (w == 1 && h == 1) break;
+		}
+	}
+
+	void clear() {
+		std::fill(levels[0].depth.begin(), levels[0].depth.end(), 1.0f);
+	}
+
+	void rasterize(const glm::mat4& clipFromObject, const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices) {
+
+		clip.resize(positions.size());
+		for (size_t i = 0; i < positions.size(); i++)
+			clip[i] = clipFromObject * glm::vec4(positions[i], 1.0f);
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+
+			// Sutherland-Hodgman against the near plane (z >= -w), which also
+			// keeps w positive for the divide
+			std::array<glm::vec4, 4> polygon;
+			int count = 0;
+			for (int k = 0; k < 3; k++) {
+				const glm::vec4& a = clip[indices[i + k]];
+				const glm::vec4& b = clip[indices[i + (k + 1) % 3]];
+				float da = a.z + a.w, db = b.z + b.w;
+				if (da >= 0.0f) polygon[count++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f)) polygon[count++] = a + (b - a) * (da / (da - db));
+			}
+
+			for (int k = 1; k + 1 < count; k++)
+				drawTriangle(toScreen(polygon[0]), toScreen(polygon[k]), toScreen(polygon[k + 1]));
+		}
+	}
+
+	void buildPyramid() {
+		for (size_t l = 1; l < levels.size(); l++) {
+			const Level& below = levels[l - 1];
+			Level& level = levels[l];
+
+			for (int y = 0; y < level.height; y++) {
+				int y0 = std::min(2 * y, below.height - 1), y1 = std::min(2 * y + 1, below.height - 1);
+				for (int x = 0; x < level.width; x++) {
+					int x0 = std::min(2 * x, below.width - 1), x1 = std::min(2 * x + 1, below.width - 1);
+					level.depth[size_t(y) * level.width + x] = std::max(
+						std::max(below.depth[size_t(y0) * below.width + x0], below.depth[size_t(y0) * below.width + x1]),
+						std::max(below.depth[size_t(y1) * below.width + x0], below.depth[size_t(y1) * below.width + x1]));
+				}
+			}
+		}
+	}
+
+	// false for anything crossing the near plane or off screen, which the
+	// frustum test already handles
+	bool occluded(const glm::mat4& viewProjection, const BoundingSphere& sphere) const {
+		if (sphere.empty()) return false;
+
+		// corners of the sphere's box: center +- radius along each axis
+		glm::vec4 center = viewProjection * glm::vec4(sphere.center, 1.0f);
+		glm::vec4 axes[3] = {
+			viewProjection[0] * sphere.radius,
+			viewProjection[1] * sphere.radius,
+			viewProjection[2] * sphere.radius
+		};
+
+		float minX = std::numeric_limits<float>::max(), minY = minX, nearest = minX;
+		float maxX = -minX, maxY = -minX;
+
+		for (int i = 0; i < 8; i++) {
+			glm::vec4 corner = center
+				+ ((i & 1) ? axes[0] : -axes[0])
+				+ ((i & 2) ? axes[1] : -axes[1])
+				+ ((i & 4) ? axes[2] : -axes[2]);
+			if (corner.z < -corner.w) return false;
+
+			float inv = 1.0f / corner.w;
+			minX = std::min(minX, corner.x * inv); maxX = std::max(maxX, corner.x * inv);
+			minY = std::min(minY, corner.y * inv); maxY = std::max(maxY, corner.y * inv);
+			nearest = std::min(nearest, corner.z * inv);
+		}
+
+		if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f) return false;
+
+		auto pixel = [](float ndc, int size) {
+			return std::clamp(static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * size)), 0, size - 1);
+		};
+		int x0 = std::max(pixel(minX, WIDTH) - 1, 0), x1 = std::min(pixel(maxX, WIDTH) + 1, WIDTH - 1);
+		int y0 = std::max(pixel(minY, HEIGHT) - 1, 0), y1 = std::min(pixel(maxY, HEIGHT) + 1, HEIGHT - 1);
+
+		size_t l = 0;
+		while (l + 1 < levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1))
+			l++;
+
+		const Level& level = levels[l];
+		float farthest = -1.0f;
+		for (int y = std::min(y0 >> l, level.height - 1); y <= std::min(y1 >> l, level.height - 1); y++)
+			for (int x = std::min(x0 >> l, level.width - 1); x <= std::min(x1 >> l, level.width - 1); x++)
+				farthest = std::max(farthest, level.depth[size_t(y) * level.width + x]);
+
+		return nearest > farthest;
+	}
+
+private:
+
+	std::vector<glm::vec4> clip; // scratch
+
+	static glm::vec3 toScreen(const glm::vec4& c) {
+		float inv = 1.0f / c.w;
+		return { (c.x * inv * 0.5f + 0.5f) * WIDTH, (c.y * inv * 0.5f + 0.5f) * HEIGHT, c.z * inv };
+	}
+
+	// either winding; pixel centres inside or on an edge are covered
+	void drawTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (area == 0.0f || !std::isfinite(area)) return;
+		if (area < 0.0f) {
+			std::swap(b, c);
+			area = -area;
+		}
+
+		int minX = std::max(static_cast<int>(std::floor(std::min({ a.x, b.x, c.x }))), 0);
+		int maxX = std::min(static_cast<int>(std::ceil(std::max({ a.x, b.x, c.x }))), WIDTH - 1);
+		int minY = std::max(static_cast<int>(std::floor(std::min({ a.y, b.y, c.y }))), 0);
+		int maxY = std::min(static_cast<int>(std::ceil(std::max({ a.y, b.y, c.y }))), HEIGHT - 1);
+		if (minX > maxX || minY > maxY) return;
+
+		// edge functions E(p) = A p.x + B p.y + C, positive inside; edge k is opposite vertex k
+		struct Edge { float A, B, C; };
+		auto edge = [](const glm::vec3& u, const glm::vec3& v) {
+			float A = u.y - v.y, B = v.x - u.x;
+			return Edge{ A, B, -(A * u.x + B * u.y) };
+		};
+		Edge e[3] = { edge(b, c), edge(c, a), edge(a, b) };
+
+		// depth is affine in screen space: z = a.z + (E1 (b.z - a.z) + E2 (c.z - a.z)) / area
+		float dzb = (b.z - a.z) / area, dzc = (c.z - a.z) / area;
+		float zA = e[1].A * dzb + e[2].A * dzc;
+		float zB = e[1].B * dzb + e[2].B * dzc;
+		float zC = a.z + e[1].C * dzb + e[2].C * dzc;
+
+		std::vector<float>& depth = levels[0].depth;
+		int startX = minX & ~3;
+
+		for (int y = minY; y <= maxY; y++) {
+			float py = y + 0.5f;
+			float* row = depth.data() + size_t(y) * WIDTH;
+
+#ifdef OCCLUSION_SSE2
+			__m128 px = _mm_add_ps(_mm_set1_ps(startX + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+			__m128 step = _mm_set1_ps(4.0f);
+			__m128 zero = _mm_setzero_ps();
+
+			for (int x = startX; x <= maxX; x += 4) {
+				__m128 inside = _mm_cmpeq_ps(zero, zero); // all ones
+				for (const Edge& ed : e) {
+					__m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ed.A), px), _mm_set1_ps(ed.B * py + ed.C));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(value, zero));
+				}
+
+				__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), px), _mm_set1_ps(zB * py + zC));
+				__m128 stored = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(stored, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+
+				px = _mm_add_ps(px, step);
+			}
+#else
+			for (int x = minX; x <= maxX; x++) {
+				float px = x + 0.5f;
+				bool inside = true;
+				for (const Edge& ed : e)
+					inside &= ed.A * px + ed.B * py + ed.C >= 0.0f;
+				if (inside) row[x] = std::min(row[x], zA * px + zB * py + zC);
+			}
+#endif
+		}
+	}
+};
+
+// Per frame driver: the occluders are rasterized on a WorkerPool thread while
+// the render thread walks the scene, then the objects that survived the
+// frustum are tested on every core before anything is submitted.
+struct OcclusionCulling {
+
+	inline static bool enabled = true;
+
+	// occluders: at most maxOccluders, each covering at least minOccluderSize
+	// (radius over distance) of the view
+	inline static size_t maxOccluders = 16;
+	inline static float minOccluderSize = 0.05f;
+
+	// per frame statistics
+	inline static size_t objectsOccluded = 0;
+	inline static size_t occludersDrawn = 0;
+	inline static float rasterMs = 0.0f;
+	inline static float testMs = 0.0f;
+
+	struct Occluder {
+		const std::vector<glm::vec3>* positions;
+		const std::vector<uint32_t>* indices;
+		glm::mat4 clipFromObject;
+	};
+
+	inline static OcclusionBuffer buffer;
+	inline static std::future<void> rasterization;
+
+	static void toggle() {
+		OcclusionCulling::enabled = !OcclusionCulling::enabled;
+	}
+
+	// the meshes must stay alive until test() returns
+	static void begin(std::vector<Occluder> occluders) {
+		occludersDrawn = occluders.size();
+
+		rasterization = WorkerPool::submit([occluders = std::move(occluders)]() {
+			auto start = std::chrono::steady_clock::now();
+
+			buffer.clear();
+			for (const auto& occluder : occluders)
+				buffer.rasterize(occluder.clipFromObject, *occluder.positions, *occluder.indices);
+			buffer.buildPyramid();
+
+			rasterMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		});
+	}
+
+	// visible[i] tells whether spheres[i] may be seen; waits for begin()'s rasterization
+	static void test(const glm::mat4& viewProjection, const std::vector<BoundingSphere>& spheres, std::vector<uint8_t>& visible) {
+
+		rasterization.get();
+		auto start = std::chrono::steady_clock::now();
+
+		visible.resize(spheres.size());
+		auto run = [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+				visible[i] = !buffer.occluded(viewProjection, spheres[i]);
+		};
+
+		WorkerPool::parallel(spheres.size(), 1024, run);
+
+		objectsOccluded = static_cast<size_t>(std::count(visible.begin(), visible.end(), uint8_t(0)));
+		testMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+#endif
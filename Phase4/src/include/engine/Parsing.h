@@ -6,8 +6,20 @@
 #include <fstream>
 #include <sstream>
 #include <filesystem>
-
-#include "Config.h"
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+#include "World.h"
+#include "MeshCache.h"
+#include "SceneCache.h"
+#include "MeshOptimizer.h"
+#include "ObjParser.h"
 #include <pugixml.hpp>
 
 namespace modelFileManagement {
@@ -70,87 +82,26 @@ namespace modelFileManagement {
 		file.close();
 	}
 	
+	// files at least this big are parsed on several threads
+	size_t parallelImportThreshold = 4 * 1024 * 1024;
+	unsigned int importThreads = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+
 	Model importOBJ(const std::string& filename) {
 		Model model;
 
-		using namespace std::filesystem;
-		using namespace modelFileManagement;
-
-		auto filepath = ModelsFolder() / filename;
-		std::ifstream file(filepath);
-		if (!file) throw std::runtime_error("Failed to open file: " + filepath.string());
-
-		std::string line;
-		long lineno = -1;
-
-		while (std::getline(file, line)) {
-			lineno++;
-			if (line.empty() || line[0] == '#') continue;
-
-
-			std::istringstream iss(line);
-			std::string prefix;
-			iss >> prefix;
-
-			// Parse vertex coords
-			if (prefix == "v") {
-				glm::vec3 v;
-				if (!(iss >> v.x >> v.y >> v.z))
-					throw std::runtime_error("Failed to parse vertex line: " + line);
-				model.vertices.push_back(v);
-			}
-			// Parse normal coords
-			else if (prefix == "vn") {
-				//std::cout << std::format("OBJ {}, line {} - loading vn", filename, lineno) << std::endl;
-				glm::vec3 vn;
-				if (!(iss >> vn.x >> vn.y >> vn.z))
-					throw std::runtime_error("Failed to parse normal line: " + line);
-				model.normals.push_back(vn);
-			}
-			// Parse tex coords
-			else if (prefix == "vt") {
-				//std::cout << std::format("OBJ {}, line {} - loading vt", filename, lineno) << std::endl;
-				glm::vec2 vt;
-				if (!(iss >> vt.x >> vt.y))
-					throw std::runtime_error("Failed to parse texcoords line: " + line);
-				model.texcoords.push_back(vt);
-			}
-			// Parse tri face indices
-			else if (prefix == "f") {
-
-				//std::cout << std::format("OBJ {}, line {} - loading face", filename, lineno) << std::endl;
-
-				std::vector<std::string> faceTokens;
-				std::string token;
-				while (iss >> token) {
-					faceTokens.push_back(token);
-				}
-
-				if (faceTokens.size() != 3) {
-					throw std::runtime_error("Only triangular faces are supported");
-				}
+		auto start = std::chrono::steady_clock::now();
 
-				for (const auto& token : faceTokens) {
-					std::istringstream viss(token);
-					std::string vPart, vtPart, vnPart;
+		// the whole file goes into one buffer and is scanned in place
+		std::string buffer = objParser::readFileBuffer(ModelsFolder() / filename);
+		const char* begin = buffer.data();
+		const char* end = begin + buffer.size();
 
-					// Parse vertex index
-					std::getline(viss, vPart, '/');
-					if (vPart.empty()) throw std::runtime_error("Vertex index is required");
-					model.vIndices.push_back(std::stoul(vPart) - 1);  // OBJ indices are 1-based
+		unsigned int threads = (buffer.size() >= parallelImportThreshold) ? std::max(importThreads, 1u) : 1;
 
-					// Parse texture coordinate index if exists
-					if (std::getline(viss, vtPart, '/') && !vtPart.empty()) {
-						model.vtIndices.push_back(std::stoul(vtPart) - 1);
-					}
-
-					// Parse normal index if exists (after second slash)
-					if (std::getline(viss, vnPart, '/') && !vnPart.empty()) {
-						model.vnIndices.push_back(std::stoul(vnPart) - 1);
-					}
-				}
-			}
-		}
+		if (threads > 1)
+			objParser::parseParallel(begin, end, threads, model);
+		else
+			objParser::parseReserved(begin, end, model);
 
 		// Validate that we have matching counts for indices
 		if (!model.vtIndices.empty() && model.vtIndices.size() != model.vIndices.size()) {
@@ -160,19 +111,73 @@ namespace modelFileManagement {
 			throw std::runtime_error("Vertex normal indices count doesn't match vertex indices count");
 		}
 
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		double megabytes = buffer.size() / (1024.0 * 1024.0);
+
+		std::cout
+			<< std::format(
+				"Parsed {} ({:.1f} KB, {} tris, {} thread{}) in {:.2f} ms ({:.1f} MB/s)",
+				filename,
+				buffer.size() / 1024.0,
+				model.vIndices.size() / 3,
+				threads, (threads > 1) ? "s" : "",
+				elapsed.count() * 1000.0,
+				(elapsed.count() > 0.0) ? megabytes / elapsed.count() : 0.0)
+			<< std::endl;
+
 		return model;
 	}
 	
+	// Maps the model's .3db cache when it is still valid for the .3d source,
+	// otherwise parses the source and writes a fresh cache entry next to it
+	Model importModel(const std::string& filename) {
+
+		path source = ModelsFolder() / filename;
+		uint64_t processing = meshCache::processingKey(ModelStorage::optimizeOnLoad, ModelStorage::lodsOnLoad);
+
+		if (auto cached = meshCache::load(source, processing))
+			return std::move(*cached);
+
+		Model model = importOBJ(filename);
+		if (ModelStorage::optimizeOnLoad)
+			meshOptimizer::optimize(model, filename);
+		model.pack(ModelStorage::lodsOnLoad);
+
+		if (!meshCache::store(source, model, processing))
+			std::cerr << "Warning: could not cache " << filename << std::endl;
+
+		return model;
+	}
+
 	Model exportThenImportOBJ(std::string filename, Model inputModel) {
 		exportOBJ(filename, inputModel);
 		return importOBJ(filename);
 	}
 	
-	unsigned int importTexture(std::string filename) {
+	struct Image {
+		unsigned int width = 0;
+		unsigned int height = 0;
+		std::vector<unsigned char> texels = {}; // RGBA8, origin lower left
+	};
+
+	// DevIL keeps a global "bound image", so decodes are serialised
+	std::mutex ilMutex;
+
+	// once, with ilMutex held; images are stored bottom row first, as GL has them
+	void initDevIL() {
+		static bool ilReady = false;
+		if (!ilReady) {
+			ilInit();
+			ilEnable(IL_ORIGIN_SET);
+			ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+			ilReady = true;
+		}
+	}
 
-		ilInit();
-		ilEnable(IL_ORIGIN_SET);
-		ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+	bool decodeTexture(const std::string& filename, Image& image) {
+
+		std::lock_guard<std::mutex> lock(ilMutex);
+		initDevIL();
 
 		ILuint imageID;
 		ilGenImages(1, &imageID);
@@ -181,21 +186,26 @@ namespace modelFileManagement {
 		bool imageLoaded = ilLoadImage(const_cast<char*>((modelFileManagement::TexturesFolder() / filename).string().c_str()));
 		if (!imageLoaded) {
 			std::cout << "Failed to load texture: " << filename << std::endl;
+			ilDeleteImages(1, &imageID);
 			return false;
 		}
 
-		// IL
-
 		ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
-		unsigned int imageWidth = ilGetInteger(IL_IMAGE_WIDTH);
-		unsigned int imageHeight = ilGetInteger(IL_IMAGE_HEIGHT);
-		void* imageTexels = ilGetData();
+		image.width = ilGetInteger(IL_IMAGE_WIDTH);
+		image.height = ilGetInteger(IL_IMAGE_HEIGHT);
 
-		// GLEW
+		const unsigned char* texels = ilGetData();
+		image.texels.assign(texels, texels + size_t(image.width) * image.height * 4);
+
+		ilDeleteImages(1, &imageID);
+		return true;
+	}
+
+	unsigned int uploadTexture(const Image& image) {
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		GLState::bindTexture(GL_TEXTURE_2D, textureID);
 
 		///////////////////////////////////////////////////////
 		// filters using original texture
@@ -219,17 +229,25 @@ namespace modelFileManagement {
 		const int LOD = 0;
 		glTexImage2D(
 			GL_TEXTURE_2D, LOD, GL_RGBA,
-			imageWidth, imageHeight, 0,
-			GL_RGBA, GL_UNSIGNED_BYTE, imageTexels
+			image.width, image.height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, image.texels.data()
 		);
 
 		glGenerateMipmap(GL_TEXTURE_2D);
 
-		glBindTexture(GL_TEXTURE_2D, 0);
-		ilDeleteImages(1, &imageID);
+		GLState::bindTexture(GL_TEXTURE_2D, 0);
 
 		return textureID;
 	}
+
+	unsigned int importTexture(std::string filename) {
+
+		Image image;
+		if (!decodeTexture(filename, image))
+			return false;
+
+		return uploadTexture(image);
+	}
 };
 
 bool saysTrue(const std::string& input) {
@@ -247,6 +265,13 @@ namespace configParser {
 	
 	pugi::xml_document doc;
 
+	// models and textures the loaded scene refers to, for the asset loader
+	std::vector<std::string> requestedModels;
+	std::vector<std::string> requestedTextures;
+
+	// load compiled .xmlb scenes while they are fresh, recompile them otherwise
+	bool useCompiledScenes = true;
+
 	static path ConfigFile(const std::string& filename) {
 		return current_path().parent_path() / "xml" / filename;
 	}
@@ -282,6 +307,24 @@ namespace configParser {
 		return filenames_vector;
 	}
 
+	// only warnings, errors and the load summary get printed
+	bool quiet = false;
+
+	// Attribute as a float, fallback when absent; anything unparsable is an error
+	float readFloat(const pugi::xml_node& node, const char* name, float fallback = 0.0f) {
+		pugi::xml_attribute attribute = node.attribute(name);
+		if (!attribute) return fallback;
+
+		const char* p = attribute.value();
+		const char* end = p + std::strlen(p);
+
+		float value;
+		if (!objText::parseFloat(p, end, value) || objText::skipBlanks(p, end) != end)
+			throw std::runtime_error(std::format(
+				"Invalid number \"{}\" for attribute {} of <{}>", attribute.value(), name, node.name()));
+		return value;
+	}
+
 	void printIndent(int depth) {
 		for (int i = 0; i < depth; ++i) {
 			std::cout << " || ";
@@ -325,6 +368,15 @@ namespace configParser {
 					lightNode.attribute("cutoff").as_float(DEFAULT_CUTOFF)
 					);
 			}
+			else continue;
+
+			// optional, a light without them is white and lights the whole scene
+			LightCaster& light = LightCaster::lights.back();
+			if (type != "directional")
+				light.range = std::max(lightNode.attribute("range").as_float(0.0f), 0.0f);
+			light.color[0] = lightNode.attribute("R").as_float(255.0f) / 255.0f;
+			light.color[1] = lightNode.attribute("G").as_float(255.0f) / 255.0f;
+			light.color[2] = lightNode.attribute("B").as_float(255.0f) / 255.0f;
 		}
 	}
 	
@@ -356,7 +408,7 @@ namespace configParser {
 
 				if (childNode.attribute("time")) {
 					
-					float time = std::stof(childNode.attribute("time").value());
+					float time = readFloat(childNode, "time");
 					
 					bool aligned = childNode.attribute("align") &&
 						saysTrue(childNode.attribute("align").value());
@@ -364,9 +416,9 @@ namespace configParser {
 					std::vector<glm::vec3> controlPoints;
 					for (pugi::xml_node pointNode : childNode.children("point")) {
 						controlPoints.emplace_back(
-							std::stof(pointNode.attribute("x").value()),
-							std::stof(pointNode.attribute("y").value()),
-							std::stof(pointNode.attribute("z").value())
+							readFloat(pointNode, "x"),
+							readFloat(pointNode, "y"),
+							readFloat(pointNode, "z")
 						);
 					}
 
@@ -382,8 +434,8 @@ namespace configParser {
 					//	<< std::endl;
 
 					if (controlPoints.size() >= 4)
-						detectedTransforms.push_back(AnimatedTranslation(
-							controlPoints, time, aligned
+						detectedTransforms.emplace_back(AnimatedTranslation(
+							std::move(controlPoints), time, aligned
 						));
 					else 
 						std::cerr 
@@ -393,10 +445,10 @@ namespace configParser {
 							<< std::endl;
 				}
 				else {
-				detectedTransforms.push_back(Translation(
-					std::stof(childNode.attribute("x").value()),
-					std::stof(childNode.attribute("y").value()),
-					std::stof(childNode.attribute("z").value())
+				detectedTransforms.emplace_back(Translation(
+					readFloat(childNode, "x"),
+					readFloat(childNode, "y"),
+					readFloat(childNode, "z")
 				));
 				}
 			}
@@ -406,11 +458,11 @@ namespace configParser {
 				if (childNode.attribute("time")) {
 
 					// Animated rotation
-					float time = std::stof(childNode.attribute("time").value());
+					float time = readFloat(childNode, "time");
 					glm::vec3 axis(
-						std::stof(childNode.attribute("x").value()),
-						std::stof(childNode.attribute("y").value()),
-						std::stof(childNode.attribute("z").value())
+						readFloat(childNode, "x"),
+						readFloat(childNode, "y"),
+						readFloat(childNode, "z")
 					);
 
 					//std::cout 
@@ -420,7 +472,7 @@ namespace configParser {
 					//		axis.x, axis.y, axis.z) 
 					//	<< std::endl;
 
-					detectedTransforms.push_back(AnimatedRotation(axis, time));
+					detectedTransforms.emplace_back(AnimatedRotation(axis, time));
 				}
 				else {
 
@@ -435,11 +487,11 @@ namespace configParser {
 						<< std::endl;
 					*/
 
-					detectedTransforms.push_back(Rotation(
-						std::stof(childNode.attribute("angle").value()),
-						std::stof(childNode.attribute("x").value()),
-						std::stof(childNode.attribute("y").value()),
-						std::stof(childNode.attribute("z").value())
+					detectedTransforms.emplace_back(Rotation(
+						readFloat(childNode, "angle"),
+						readFloat(childNode, "x"),
+						readFloat(childNode, "y"),
+						readFloat(childNode, "z")
 					));
 				}
 			}
@@ -455,10 +507,10 @@ namespace configParser {
 					<< std::endl;
 				*/
 
-				detectedTransforms.push_back(Scaling(
-					std::stof(childNode.attribute("x").value()),
-					std::stof(childNode.attribute("y").value()),
-					std::stof(childNode.attribute("z").value())
+				detectedTransforms.emplace_back(Scaling(
+					readFloat(childNode, "x"),
+					readFloat(childNode, "y"),
+					readFloat(childNode, "z")
 				));
 			}
 		}
@@ -480,32 +532,32 @@ namespace configParser {
 
 			if (std::strcmp(childNode.name(), "diffuse") == 0) {
 
-				mtl.diffuse[0] = std::stof(childNode.attribute("R").value()) / 255.0f;
-				mtl.diffuse[1] = std::stof(childNode.attribute("G").value()) / 255.0f;
-				mtl.diffuse[2] = std::stof(childNode.attribute("B").value()) / 255.0f;
+				mtl.diffuse[0] = readFloat(childNode, "R") / 255.0f;
+				mtl.diffuse[1] = readFloat(childNode, "G") / 255.0f;
+				mtl.diffuse[2] = readFloat(childNode, "B") / 255.0f;
 			}
 			else if (std::strcmp(childNode.name(), "ambient") == 0) {
 
-				mtl.ambient[0] = std::stof(childNode.attribute("R").value()) / 255.0f;
-				mtl.ambient[1] = std::stof(childNode.attribute("G").value()) / 255.0f;
-				mtl.ambient[2] = std::stof(childNode.attribute("B").value()) / 255.0f;
+				mtl.ambient[0] = readFloat(childNode, "R") / 255.0f;
+				mtl.ambient[1] = readFloat(childNode, "G") / 255.0f;
+				mtl.ambient[2] = readFloat(childNode, "B") / 255.0f;
 				
 			}
 			else if (std::strcmp(childNode.name(), "specular") == 0) {
 
-				mtl.specular[0] = std::stof(childNode.attribute("R").value()) / 255.0f;
-				mtl.specular[1] = std::stof(childNode.attribute("G").value()) / 255.0f;
-				mtl.specular[2] = std::stof(childNode.attribute("B").value()) / 255.0f;
+				mtl.specular[0] = readFloat(childNode, "R") / 255.0f;
+				mtl.specular[1] = readFloat(childNode, "G") / 255.0f;
+				mtl.specular[2] = readFloat(childNode, "B") / 255.0f;
 			}
 			else if (std::strcmp(childNode.name(), "emissive") == 0) {
 
-				mtl.emissive[0] = std::stof(childNode.attribute("R").value()) / 255.0f;
-				mtl.emissive[1] = std::stof(childNode.attribute("G").value()) / 255.0f;
-				mtl.emissive[2] = std::stof(childNode.attribute("B").value()) / 255.0f;
+				mtl.emissive[0] = readFloat(childNode, "R") / 255.0f;
+				mtl.emissive[1] = readFloat(childNode, "G") / 255.0f;
+				mtl.emissive[2] = readFloat(childNode, "B") / 255.0f;
 			}
 			else if (std::strcmp(childNode.name(), "shininess") == 0) {
 
-				mtl.shininess[0] = std::stof(childNode.attribute("value").value());
+				mtl.shininess[0] = readFloat(childNode, "value");
 			}
 		}
 
@@ -549,54 +601,52 @@ namespace configParser {
 
 	std::vector<Group::ModelReference> readModelReferences(const pugi::xml_node& modelsNode, int depth) {
 
-		std::cout
-			<< "Models:"
-			<< std::endl;
+		if (!quiet) std::cout << "Models:\n";
 
 		std::vector<Group::ModelReference> detectedModelRefs;
 
 		for (pugi::xml_node modelNode : modelsNode.children("model")) {
 
-			Group::ModelReference mref;
+			Group::ModelReference& mref = detectedModelRefs.emplace_back();
 			mref.modelFilename = modelNode.attribute("file").value();
 			
-			printIndent(depth + 1);
-			std::cout
-				<< std::format(
-					"Model \"{}\" ",
-					mref.modelFilename);
+			if (!quiet) {
+				printIndent(depth + 1);
+				std::cout
+					<< std::format(
+						"Model \"{}\" ",
+						mref.modelFilename);
+			}
 
 			for (pugi::xml_node childNode : modelNode.children()) {
 
-			
-				std::string texFilename = "";
-				Material mtl;
-
 				if (std::strcmp(childNode.name(), "texture") == 0) {
 					mref.textureFilename = childNode.attribute("file").value();
 					
-					std::cout
-						<< std::format(
-							"(tex: \"{}\") ",
-							mref.textureFilename);
+					if (!quiet)
+						std::cout
+							<< std::format(
+								"(tex: \"{}\") ",
+								mref.textureFilename);
 				}
 				else if (std::strcmp(childNode.name(), "color") == 0) {
 					mref.material = readMaterial(childNode, depth);
-					std::cout
-						<< std::format(
-							"(mtl: diffuse({},{},{}) ambient({},{},{}) specular({},{},{}) emissive({},{},{}) shininess={})",
-							mref.material.diffuse[0], mref.material.diffuse[1], mref.material.diffuse[2],
-							mref.material.ambient[0], mref.material.ambient[1], mref.material.ambient[2],
-							mref.material.specular[0], mref.material.specular[1], mref.material.specular[2],
-							mref.material.emissive[0], mref.material.emissive[1], mref.material.emissive[2],
-							mref.material.shininess[0]
-							);
+
+					if (!quiet)
+						std::cout
+							<< std::format(
+								"(mtl: diffuse({},{},{}) ambient({},{},{}) specular({},{},{}) emissive({},{},{}) shininess={})",
+								mref.material.diffuse[0], mref.material.diffuse[1], mref.material.diffuse[2],
+								mref.material.ambient[0], mref.material.ambient[1], mref.material.ambient[2],
+								mref.material.specular[0], mref.material.specular[1], mref.material.specular[2],
+								mref.material.emissive[0], mref.material.emissive[1], mref.material.emissive[2],
+								mref.material.shininess[0]
+								);
 				}
 				
 			}
 
-			std::cout << std::endl;
-			detectedModelRefs.push_back(mref);
+			if (!quiet) std::cout << '\n';
 		}
 
 		return detectedModelRefs;
@@ -615,24 +665,27 @@ namespace configParser {
 		return detectedGroups;
 	}
 
+	// Every node is visited once, subgroups are parsed straight into their parent
 	Group readGroup(const pugi::xml_node& groupNode, int depth) {
 
 		Group group;
 
-		printIndent(depth);
-		if (depth == 0) std::cout << std::endl;
-		std::cout
-			<< std::format("Group ({}):", depth)
-			<< std::endl;
+		if (!quiet) {
+			printIndent(depth);
+			if (depth == 0) std::cout << '\n';
+			std::cout
+				<< std::format("Group ({}):", depth)
+				<< '\n';
 
-		if (!groupNode.attribute("desc").empty()) {
+			if (!groupNode.attribute("desc").empty()) {
 
-			printIndent(depth+1);
-			std::cout
-				<< std::format(
-					"Description: {}",
-					groupNode.attribute("desc").value())
-				<< std::endl;
+				printIndent(depth+1);
+				std::cout
+					<< std::format(
+						"Description: {}",
+						groupNode.attribute("desc").value())
+					<< '\n';
+			}
 		}
 
 		for (pugi::xml_node childNode : groupNode.children()) {
@@ -648,20 +701,20 @@ namespace configParser {
 
 			if (std::strcmp(childNode.name(), "transform") == 0) {
 
-				printIndent(depth + 1);
+				if (!quiet) printIndent(depth + 1);
 
 				group.transforms = readTransforms(childNode, depth + 1);
 			}
 			else if (std::strcmp(childNode.name(), "models") == 0) {
 
-				printIndent(depth + 1);
+				if (!quiet) printIndent(depth + 1);
 	
 				group.modelReferences = readModelReferences(childNode, depth + 1);
 				//group.modelFilenames = readModels(childNode, depth + 1);
 			}
 			else if (std::strcmp(childNode.name(), "group") == 0) {
 
-				group.subgroups = readGroups(groupNode, depth + 1);
+				group.subgroups.push_back(readGroup(childNode, depth + 1));
 			}
 		}
 
@@ -719,10 +772,16 @@ namespace configParser {
 		
 	}
 
-	World loadWorld(std::string configFilename) {
+	void countGroups(const std::vector<Group>& groups, size_t& groupCount, size_t& modelCount) {
+		for (const auto& g : groups) {
+			groupCount++;
+			modelCount += g.modelReferences.size();
+			countGroups(g.subgroups, groupCount, modelCount);
+		}
+	}
+
+	World parseWorld(const path& configPath) {
 
-		path configPath = ConfigFile(configFilename);
-		
 		if (!doc.load_file(configPath.string().c_str())) {
 			std::cerr
 				<< "Could not load XML file at: " << configPath
@@ -738,35 +797,224 @@ namespace configParser {
 		readCamera(doc.child("world").child("camera"));
 		w.groups = readGroups(doc.child("world"), 0);
 
+		requestedModels = getUniqueModelFilenames(doc);
+		requestedTextures = getUniqueTextureFilenames(doc);
+
 		return w;
 	}
 
-	void importModels() {
-		std::vector<std::string> modelFilenames = getUniqueModelFilenames(doc);
+	World loadWorld(std::string configFilename) {
 
-		std::cout << std::format("Requested Models ({}):\n", modelFilenames.size());
-		for (auto& m : modelFilenames) std::cout << m << std::endl;
-		std::cout << std::endl;
+		auto start = std::chrono::steady_clock::now();
 
-		for (auto& modelName : modelFilenames) ModelStorage::load(modelName, modelFileManagement::importOBJ(modelName));
-		std::cout << std::format("Loaded Models ({}):\n", ModelStorage::models.size());
-		for (auto& [modelName, model] : ModelStorage::models) std::cout << modelName << std::endl;
-		std::cout << std::endl;
+		path configPath = ConfigFile(configFilename);
+		
+		World w;
+		bool compiled = false;
+
+		if (useCompiledScenes) {
+			if (auto image = sceneCache::load(configPath)) {
+				w = std::move(image->world);
+				requestedModels = std::move(image->modelFilenames);
+				requestedTextures = std::move(image->textureFilenames);
+				compiled = true;
+			}
+		}
+
+		if (!compiled) {
+			w = parseWorld(configPath);
+			if (useCompiledScenes && !sceneCache::store(configPath, w))
+				std::cerr << std::format("Warning: could not compile {}", configFilename) << std::endl;
+		}
+
+		size_t groupCount = 0, modelCount = 0;
+		countGroups(w.groups, groupCount, modelCount);
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		std::cout
+			<< std::format(
+				"Loaded {} from {} ({} groups, {} model references) in {:.2f} ms",
+				configFilename, compiled ? "compiled scene" : "XML",
+				groupCount, modelCount, elapsed.count() * 1000.0)
+			<< std::endl;
+
+		return w;
+	}
+
+	// the offline steps refuse a missing config rather than compiling an empty scene
+	bool configExists(const path& configPath) {
+		std::error_code ec;
+		if (is_regular_file(configPath, ec)) return true;
+		std::cerr << std::format("No scene file at {}", configPath.string()) << std::endl;
+		return false;
 	}
 
-	void importTextures() {
-		std::vector<std::string> textureFilenames = getUniqueTextureFilenames(doc);
+	// --compile-scene [xml]: writes the .xmlb for the config
+	bool compileScene(std::string configFilename) {
+		path configPath = ConfigFile(configFilename);
+		if (!configExists(configPath)) return false;
+		World w = parseWorld(configPath);
+
+		if (!sceneCache::store(configPath, w)) {
+			std::cerr << std::format("Could not compile {}", configFilename) << std::endl;
+			return false;
+		}
+
+		std::cout << std::format("Compiled {} -> {}", configFilename, sceneCache::imageFile(configPath).filename().string()) << std::endl;
+		return true;
+	}
 
-		std::cout << std::format("Requested Textures ({}):\n", textureFilenames.size());
-		for (auto& t : textureFilenames) std::cout << t << std::endl;
-		std::cout << std::endl;
+	// What parseWorld leaves in the globals besides the groups
+	struct SceneSettings {
+		std::vector<LightCaster> lights;
+		CameraController::Placement placement;
+		CameraController::Projection projection;
+		int windowWidth, windowHeight;
+		std::vector<std::string> models, textures; // sorted
+
+		static SceneSettings current() {
+			auto sorted = [](std::vector<std::string> names) {
+				std::sort(names.begin(), names.end());
+				return names;
+			};
+			return {
+				LightCaster::lights,
+				CameraController::initialPlacement,
+				CameraController::initialProjection,
+				WindowState::initialWidth, WindowState::initialHeight,
+				sorted(requestedModels), sorted(requestedTextures)
+			};
+		}
+	};
+
+	// Field by field, exactly: the compiled scene stores the floats the XML gave
+
+	template<size_t N>
+	bool sameArray(const GLfloat (&a)[N], const GLfloat (&b)[N]) {
+		return std::equal(a, a + N, b);
+	}
+
+	bool sameTransform(const Translation& a, const Translation& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+	bool sameTransform(const Scaling& a, const Scaling& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+	bool sameTransform(const Rotation& a, const Rotation& b) { return a.angle == b.angle && a.x == b.x && a.y == b.y && a.z == b.z; }
+	bool sameTransform(const AnimatedRotation& a, const AnimatedRotation& b) { return a.axis == b.axis && a.tPeriod == b.tPeriod; }
+	bool sameTransform(const AnimatedTranslation& a, const AnimatedTranslation& b) {
+		return a.controlPoints == b.controlPoints && a.tPeriod == b.tPeriod && a.aligned == b.aligned;
+	}
+
+	bool sameMaterial(const Material& a, const Material& b) {
+		return sameArray(a.diffuse, b.diffuse) && sameArray(a.ambient, b.ambient) && sameArray(a.specular, b.specular)
+			&& sameArray(a.emissive, b.emissive) && sameArray(a.shininess, b.shininess);
+	}
+
+	bool sameLight(const LightCaster& a, const LightCaster& b) {
+		return a.type == b.type && sameArray(a.pos, b.pos) && sameArray(a.dir, b.dir)
+			&& a.cutoffDegs == b.cutoffDegs && a.exponent == b.exponent
+			&& a.constantAttenuation == b.constantAttenuation && a.linearAttenuation == b.linearAttenuation
+			&& a.quadraticAttenuation == b.quadraticAttenuation && a.range == b.range && sameArray(a.color, b.color);
+	}
+
+	// where the group trees first differ, empty when they match
+	std::string groupDifference(const std::vector<Group>& a, const std::vector<Group>& b, const std::string& where) {
+
+		if (a.size() != b.size())
+			return std::format("{}: {} groups instead of {}", where, b.size(), a.size());
+
+		for (size_t g = 0; g < a.size(); g++) {
+			const Group& x = a[g];
+			const Group& y = b[g];
+			std::string group = std::format("{}/group {}", where, g);
+
+			if (x.transforms.size() != y.transforms.size())
+				return std::format("{}: {} transforms instead of {}", group, y.transforms.size(), x.transforms.size());
+			for (size_t t = 0; t < x.transforms.size(); t++) {
+				bool same = x.transforms[t].index() == y.transforms[t].index() && std::visit([&](const auto& transform) {
+					return sameTransform(transform, std::get<std::decay_t<decltype(transform)>>(y.transforms[t]));
+				}, x.transforms[t]);
+				if (!same)
+					return std::format("{}: transform {} is {} instead of {}", group, t, TransformToString(y.transforms[t]), TransformToString(x.transforms[t]));
+			}
+
+			if (x.modelReferences.size() != y.modelReferences.size())
+				return std::format("{}: {} models instead of {}", group, y.modelReferences.size(), x.modelReferences.size());
+			for (size_t m = 0; m < x.modelReferences.size(); m++) {
+				const auto& r = x.modelReferences[m];
+				const auto& s = y.modelReferences[m];
+				if (r.modelFilename != s.modelFilename || r.textureFilename != s.textureFilename)
+					return std::format("{}: model {} is {} ({}) instead of {} ({})", group, m, s.modelFilename, s.textureFilename, r.modelFilename, r.textureFilename);
+				if (!sameMaterial(r.material, s.material))
+					return std::format("{}: model {} ({}) has another material", group, m, r.modelFilename);
+			}
+
+			std::string difference = groupDifference(x.subgroups, y.subgroups, group);
+			if (!difference.empty()) return difference;
+		}
+
+		return {};
+	}
+
+	std::string settingsDifference(const SceneSettings& a, const SceneSettings& b) {
+
+		if (a.lights.size() != b.lights.size())
+			return std::format("{} lights instead of {}", b.lights.size(), a.lights.size());
+		for (size_t i = 0; i < a.lights.size(); i++)
+			if (!sameLight(a.lights[i], b.lights[i]))
+				return std::format("light {} differs", i);
+
+		if (a.placement.pos != b.placement.pos || a.placement.target != b.placement.target || a.placement.up != b.placement.up)
+			return "camera placement differs";
+		if (a.projection.fov != b.projection.fov || a.projection.near != b.projection.near || a.projection.far != b.projection.far)
+			return "camera projection differs";
+		if (a.windowWidth != b.windowWidth || a.windowHeight != b.windowHeight)
+			return std::format("window is {}x{} instead of {}x{}", b.windowWidth, b.windowHeight, a.windowWidth, a.windowHeight);
+
+		if (a.models != b.models) return "requested models differ";
+		if (a.textures != b.textures) return "requested textures differ";
+		return {};
+	}
+
+	// --verify-scene [xml]: compiles the config, loads it back through the engine's path and
+	// compares the result field by field with what the XML parser made of it
+	bool verifyCompiledScene(std::string configFilename) {
+
+		path configPath = ConfigFile(configFilename);
+		if (!configExists(configPath)) return false;
+
+		World parsed = parseWorld(configPath);
+		SceneSettings expected = SceneSettings::current();
+
+		if (!sceneCache::store(configPath, parsed)) {
+			std::cerr << std::format("Could not compile {}", configFilename) << std::endl;
+			return false;
+		}
+
+		// sets the lights, camera and window again, from the image
+		auto image = sceneCache::load(configPath);
+		if (!image) {
+			std::cerr << std::format("Compiled {} did not load back", configFilename) << std::endl;
+			return false;
+		}
+		requestedModels = std::move(image->modelFilenames);
+		requestedTextures = std::move(image->textureFilenames);
+
+		std::string difference = groupDifference(parsed.groups, image->world.groups, "world");
+		if (difference.empty())
+			difference = settingsDifference(expected, SceneSettings::current());
+
+		size_t groupCount = 0, modelCount = 0;
+		countGroups(image->world.groups, groupCount, modelCount);
+
+		std::cout
+			<< std::format(
+				"Compiled {} ({} groups, {} model references) {} the XML",
+				configFilename, groupCount, modelCount,
+				difference.empty() ? "matches" : "DOES NOT match")
+			<< std::endl;
+		if (!difference.empty())
+			std::cerr << std::format("First difference: {}", difference) << std::endl;
 
-		for (auto& texName : textureFilenames)
-			Texture::load(texName, modelFileManagement::importTexture(texName));
-		std::cout << std::format("Loaded Textures ({}):\n", Texture::textureIDs.size());
-		for (auto& [filename, id] : Texture::textureIDs)
-			std::cout << std::format("{} (id {})", filename, id) << std::endl;
-		std::cout << std::endl;
+		return difference.empty();
 	}
 	
 }
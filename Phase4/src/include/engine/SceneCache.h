@@ -0,0 +1,453 @@
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <optional>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_map>
+
+#include "World.h"
+#include "MeshCache.h"
+
+////////////////////////////////////////////////////////////
+// .xmlb - compiled scene stored next to each config .xml
+//
+// [Header][lights][nodes][transforms][control points]
+// [model references][materials][string offsets][string bytes]
+//
+// Groups are flattened depth first: each node is followed by
+// its whole subtree and childCount says how many direct
+// children to read back. Model and texture filenames become
+// indices into one string table (models first, then textures)
+// and identical materials are stored once.
+// Loading is a single mapping and a linear walk, no XML.
+////////////////////////////////////////////////////////////
+
+namespace sceneCache {
+
+	using namespace std::filesystem;
+
+	constexpr char MAGIC[4] = { '3', 'D', 'B', 'S' };
+	constexpr uint32_t VERSION = 2;
+	constexpr uint32_t NONE = ~0u;
+
+	struct Section {
+		uint64_t offset;
+		uint64_t count;
+	};
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+
+		// the XML it was compiled from
+		uint64_t sourceSize;
+		int64_t sourceMTime;
+
+		double fov, near, far;
+		float cameraPosition[3];
+		float cameraTarget[3];
+		float cameraUp[3];
+		int32_t windowWidth, windowHeight;
+
+		uint32_t rootCount;      // top level groups
+		uint32_t modelNameCount; // strings before the texture filenames
+
+		Section lights, nodes, transforms, points, references, materials, stringOffsets, stringBytes;
+	};
+
+	struct LightRecord {
+		uint32_t type;
+		float pos[4];
+		float dir[4];
+		float cutoffDegs, exponent;
+		float constantAttenuation, linearAttenuation, quadraticAttenuation;
+		float range;
+		float color[4];
+	};
+
+	struct NodeRecord {
+		uint32_t childCount;
+		uint32_t firstTransform, transformCount;
+		uint32_t firstReference, referenceCount;
+	};
+
+	enum class TransformType : uint32_t { TRANSLATE, ROTATE, SCALE, ANIMATED_TRANSLATE, ANIMATED_ROTATE };
+
+	struct TransformRecord {
+		TransformType type;
+		float values[4]; // x y z + angle (rotate) or period (animated)
+		uint32_t aligned;
+		uint32_t firstPoint, pointCount;
+	};
+
+	struct ReferenceRecord {
+		uint32_t model;
+		uint32_t texture; // NONE without one
+		uint32_t material;
+	};
+
+	path imageFile(const path& source) {
+		path image = source;
+		image.replace_extension(".xmlb");
+		return image;
+	}
+
+	constexpr uint64_t align16(uint64_t offset) {
+		return (offset + 15) & ~uint64_t(15);
+	}
+
+	// Everything the XML describes: groups plus lights, camera and window (source stamp left empty)
+	std::vector<char> encode(const World& world) {
+
+		std::vector<LightRecord> lights;
+		std::vector<NodeRecord> nodes;
+		std::vector<TransformRecord> transforms;
+		std::vector<glm::vec3> points;
+		std::vector<ReferenceRecord> references;
+		std::vector<Material> materials;
+		std::unordered_map<std::string, uint32_t> materialIDs;
+
+		std::vector<std::string> modelNames, textureNames;
+		std::unordered_map<std::string, uint32_t> modelIDs, textureIDs;
+
+		auto intern = [](const std::string& name, std::vector<std::string>& names, std::unordered_map<std::string, uint32_t>& ids) {
+			auto [it, inserted] = ids.try_emplace(name, static_cast<uint32_t>(names.size()));
+			if (inserted) names.push_back(name);
+			return it->second;
+		};
+
+		for (const auto& light : LightCaster::lights) {
+			LightRecord record;
+			record.type = static_cast<uint32_t>(light.type);
+			std::memcpy(record.pos, light.pos, sizeof(record.pos));
+			std::memcpy(record.dir, light.dir, sizeof(record.dir));
+			record.cutoffDegs = light.cutoffDegs;
+			record.exponent = light.exponent;
+			record.constantAttenuation = light.constantAttenuation;
+			record.linearAttenuation = light.linearAttenuation;
+			record.quadraticAttenuation = light.quadraticAttenuation;
+			record.range = light.range;
+			std::memcpy(record.color, light.color, sizeof(record.color));
+			lights.push_back(record);
+		}
+
+		auto encodeGroup = [&](auto& self, const Group& group) -> void {
+
+			NodeRecord node = {
+				static_cast<uint32_t>(group.subgroups.size()),
+				static_cast<uint32_t>(transforms.size()), static_cast<uint32_t>(group.transforms.size()),
+				static_cast<uint32_t>(references.size()), static_cast<uint32_t>(group.modelReferences.size())
+			};
+			nodes.push_back(node);
+
+			for (const auto& transform : group.transforms) {
+				TransformRecord record = {};
+
+				if (auto* t = std::get_if<Translation>(&transform))
+					record = { .type = TransformType::TRANSLATE, .values = { t->x, t->y, t->z, 0.0f }, .aligned = 0, .firstPoint = 0, .pointCount = 0 };
+				else if (auto* r = std::get_if<Rotation>(&transform))
+					record = { .type = TransformType::ROTATE, .values = { r->x, r->y, r->z, r->angle }, .aligned = 0, .firstPoint = 0, .pointCount = 0 };
+				else if (auto* s = std::get_if<Scaling>(&transform))
+					record = { .type = TransformType::SCALE, .values = { s->x, s->y, s->z, 0.0f }, .aligned = 0, .firstPoint = 0, .pointCount = 0 };
+				else if (auto* ar = std::get_if<AnimatedRotation>(&transform))
+					record = { .type = TransformType::ANIMATED_ROTATE, .values = { ar->axis.x, ar->axis.y, ar->axis.z, ar->tPeriod }, .aligned = 0, .firstPoint = 0, .pointCount = 0 };
+				else if (auto* at = std::get_if<AnimatedTranslation>(&transform)) {
+					// the last three points only close the loop (see AnimatedTranslation)
+					size_t count = at->controlPoints.size() - 3;
+					record = { .type = TransformType::ANIMATED_TRANSLATE, .values = { 0.0f, 0.0f, 0.0f, at->tPeriod }, .aligned = at->aligned,
+						.firstPoint = static_cast<uint32_t>(points.size()), .pointCount = static_cast<uint32_t>(count) };
+					points.insert(points.end(), at->controlPoints.begin(), at->controlPoints.begin() + count);
+				}
+
+				transforms.push_back(record);
+			}
+
+			for (const auto& mref : group.modelReferences) {
+				std::string materialBytes(reinterpret_cast<const char*>(&mref.material), sizeof(Material));
+				auto [material, added] = materialIDs.try_emplace(std::move(materialBytes), static_cast<uint32_t>(materials.size()));
+				if (added) materials.push_back(mref.material);
+
+				references.push_back({
+					intern(mref.modelFilename, modelNames, modelIDs),
+					mref.textureFilename.empty() ? NONE : intern(mref.textureFilename, textureNames, textureIDs),
+					material->second
+				});
+			}
+
+			for (const auto& subgroup : group.subgroups)
+				self(self, subgroup);
+		};
+
+		for (const auto& group : world.groups)
+			encodeGroup(encodeGroup, group);
+
+		std::vector<uint64_t> stringOffsets = { 0 };
+		std::string stringBytes;
+		for (const auto* names : { &modelNames, &textureNames })
+			for (const auto& name : *names) {
+				stringBytes += name;
+				stringOffsets.push_back(stringBytes.size());
+			}
+
+		Header header;
+		std::memset(&header, 0, sizeof(Header)); // padding included, images compare bytewise
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+
+		header.fov = CameraController::initialProjection.fov;
+		header.near = CameraController::initialProjection.near;
+		header.far = CameraController::initialProjection.far;
+		for (int i = 0; i < 3; i++) {
+			header.cameraPosition[i] = CameraController::initialPlacement.pos[i];
+			header.cameraTarget[i] = CameraController::initialPlacement.target[i];
+			header.cameraUp[i] = CameraController::initialPlacement.up[i];
+		}
+		header.windowWidth = WindowState::initialWidth;
+		header.windowHeight = WindowState::initialHeight;
+
+		header.rootCount = static_cast<uint32_t>(world.groups.size());
+		header.modelNameCount = static_cast<uint32_t>(modelNames.size());
+
+		std::vector<char> image(sizeof(Header));
+
+		auto append = [&](Section& section, const void* data, size_t count, size_t elementSize) {
+			image.resize(align16(image.size()), 0);
+			section = { image.size(), count };
+			image.insert(image.end(), static_cast<const char*>(data), static_cast<const char*>(data) + count * elementSize);
+		};
+
+		append(header.lights, lights.data(), lights.size(), sizeof(LightRecord));
+		append(header.nodes, nodes.data(), nodes.size(), sizeof(NodeRecord));
+		append(header.transforms, transforms.data(), transforms.size(), sizeof(TransformRecord));
+		append(header.points, points.data(), points.size(), sizeof(glm::vec3));
+		append(header.references, references.data(), references.size(), sizeof(ReferenceRecord));
+		append(header.materials, materials.data(), materials.size(), sizeof(Material));
+		append(header.stringOffsets, stringOffsets.data(), stringOffsets.size(), sizeof(uint64_t));
+		append(header.stringBytes, stringBytes.data(), stringBytes.size(), 1);
+
+		std::memcpy(image.data(), &header, sizeof(Header));
+		return image;
+	}
+
+	struct Decoded {
+		World world;
+		std::vector<std::string> modelFilenames;
+		std::vector<std::string> textureFilenames;
+	};
+
+	// Rebuilds the world and sets lights, camera and window; throws std::runtime_error on a malformed image
+	Decoded decode(const char* bytes, size_t size) {
+
+		if (size < sizeof(Header)) throw std::runtime_error("Scene image is truncated");
+
+		Header header;
+		std::memcpy(&header, bytes, sizeof(Header));
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+			throw std::runtime_error("Not a scene image of this version");
+
+		auto section = [&]<typename T>(const Section& s, T) {
+			if (s.offset > size || s.count > (size - s.offset) / sizeof(T))
+				throw std::runtime_error("Scene image section out of bounds");
+			std::vector<T> elements(s.count);
+			if (s.count) std::memcpy(elements.data(), bytes + s.offset, s.count * sizeof(T));
+			return elements;
+		};
+
+		auto lights = section(header.lights, LightRecord{});
+		auto nodes = section(header.nodes, NodeRecord{});
+		auto transforms = section(header.transforms, TransformRecord{});
+		auto points = section(header.points, glm::vec3{});
+		auto references = section(header.references, ReferenceRecord{});
+		auto materials = section(header.materials, Material{});
+		auto stringOffsets = section(header.stringOffsets, uint64_t{});
+		auto stringBytes = section(header.stringBytes, char{});
+
+		if (stringOffsets.empty() || header.modelNameCount > stringOffsets.size() - 1)
+			throw std::runtime_error("Scene image string table is malformed");
+
+		Decoded decoded;
+		for (size_t i = 0; i + 1 < stringOffsets.size(); i++) {
+			if (stringOffsets[i] > stringOffsets[i + 1] || stringOffsets[i + 1] > stringBytes.size())
+				throw std::runtime_error("Scene image string table is malformed");
+			std::string name(stringBytes.data() + stringOffsets[i], stringOffsets[i + 1] - stringOffsets[i]);
+			(i < header.modelNameCount ? decoded.modelFilenames : decoded.textureFilenames).push_back(std::move(name));
+		}
+
+		size_t next = 0;
+		auto decodeGroup = [&](auto& self) -> Group {
+
+			if (next >= nodes.size()) throw std::runtime_error("Scene image node tree is malformed");
+			const NodeRecord node = nodes[next++];
+
+			if (uint64_t(node.firstTransform) + node.transformCount > transforms.size()
+				|| uint64_t(node.firstReference) + node.referenceCount > references.size())
+				throw std::runtime_error("Scene image node points outside its tables");
+
+			Group group;
+
+			group.transforms.reserve(node.transformCount);
+			for (uint32_t i = node.firstTransform; i < node.firstTransform + node.transformCount; i++) {
+				const TransformRecord& t = transforms[i];
+				const float* v = t.values;
+
+				switch (t.type) {
+					case TransformType::TRANSLATE:       group.transforms.emplace_back(Translation(v[0], v[1], v[2])); break;
+					case TransformType::ROTATE:          group.transforms.emplace_back(Rotation(v[3], v[0], v[1], v[2])); break;
+					case TransformType::SCALE:           group.transforms.emplace_back(Scaling(v[0], v[1], v[2])); break;
+					case TransformType::ANIMATED_ROTATE: group.transforms.emplace_back(AnimatedRotation(glm::vec3(v[0], v[1], v[2]), v[3])); break;
+					case TransformType::ANIMATED_TRANSLATE: {
+						if (t.pointCount < 4 || uint64_t(t.firstPoint) + t.pointCount > points.size())
+							throw std::runtime_error("Scene image control points are malformed");
+						std::vector<glm::vec3> controlPoints(points.begin() + t.firstPoint, points.begin() + t.firstPoint + t.pointCount);
+						group.transforms.emplace_back(AnimatedTranslation(std::move(controlPoints), v[3], t.aligned != 0));
+						break;
+					}
+					default: throw std::runtime_error("Scene image has an unknown transform");
+				}
+			}
+
+			group.modelReferences.reserve(node.referenceCount);
+			for (uint32_t i = node.firstReference; i < node.firstReference + node.referenceCount; i++) {
+				const ReferenceRecord& r = references[i];
+				if (r.model >= decoded.modelFilenames.size() || (r.texture != NONE && r.texture >= decoded.textureFilenames.size())
+					|| r.material >= materials.size())
+					throw std::runtime_error("Scene image reference points outside its tables");
+
+				Group::ModelReference& mref = group.modelReferences.emplace_back();
+				mref.modelFilename = decoded.modelFilenames[r.model];
+				if (r.texture != NONE) mref.textureFilename = decoded.textureFilenames[r.texture];
+				mref.material = materials[r.material];
+			}
+
+			group.subgroups.reserve(node.childCount);
+			for (uint32_t c = 0; c < node.childCount; c++)
+				group.subgroups.push_back(self(self));
+
+			return group;
+		};
+
+		decoded.world.groups.reserve(header.rootCount);
+		for (uint32_t i = 0; i < header.rootCount; i++)
+			decoded.world.groups.push_back(decodeGroup(decodeGroup));
+		if (next != nodes.size()) throw std::runtime_error("Scene image has unreachable nodes");
+
+		// the settings readLights / readCamera / readWindow would have made
+		LightCaster::lights.clear();
+		for (const auto& record : lights) {
+			if (record.type > static_cast<uint32_t>(LightCaster::Type::SPOTLIGHT))
+				throw std::runtime_error("Scene image has an unknown light type");
+
+			LightCaster light;
+			light.type = static_cast<LightCaster::Type>(record.type);
+			std::memcpy(light.pos, record.pos, sizeof(light.pos));
+			std::memcpy(light.dir, record.dir, sizeof(light.dir));
+			light.cutoffDegs = record.cutoffDegs;
+			light.exponent = record.exponent;
+			light.constantAttenuation = record.constantAttenuation;
+			light.linearAttenuation = record.linearAttenuation;
+			light.quadraticAttenuation = record.quadraticAttenuation;
+			light.range = record.range;
+			std::memcpy(light.color, record.color, sizeof(light.color));
+			LightCaster::lights.push_back(light);
+		}
+
+		CameraController::currentPlacement =
+		CameraController::initialPlacement = {
+			.pos = { header.cameraPosition[0], header.cameraPosition[1], header.cameraPosition[2] },
+			.target = { header.cameraTarget[0], header.cameraTarget[1], header.cameraTarget[2] },
+			.up = { header.cameraUp[0], header.cameraUp[1], header.cameraUp[2] }
+		};
+
+		CameraController::currentProjection =
+		CameraController::initialProjection = {
+			.fov = header.fov,
+			.near = header.near,
+			.far = header.far
+		};
+
+		WindowState::currentWidth = WindowState::initialWidth = header.windowWidth;
+		WindowState::currentHeight = WindowState::initialHeight = header.windowHeight;
+
+		return decoded;
+	}
+
+	// The compiled scene for the XML source if there is one at least as new, nothing otherwise
+	std::optional<Decoded> load(const path& source) {
+
+		path image = imageFile(source);
+
+		std::error_code ec;
+		uint64_t sourceSize = file_size(source, ec);
+		if (ec) return std::nullopt;
+		auto sourceTime = last_write_time(source, ec);
+		if (ec) return std::nullopt;
+		auto imageTime = last_write_time(image, ec);
+		if (ec || imageTime < sourceTime) return std::nullopt;
+
+		auto mapped = MappedFile::open(image);
+		if (!mapped || mapped->size() < sizeof(Header)) return std::nullopt;
+
+		Header header;
+		std::memcpy(&header, mapped->data(), sizeof(Header));
+		if (header.sourceSize != sourceSize || header.sourceMTime != sourceTime.time_since_epoch().count())
+			return std::nullopt;
+
+		try {
+			return decode(mapped->data(), mapped->size());
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << std::format("Warning: ignoring {}: {}", image.string(), e.what()) << std::endl;
+			return std::nullopt;
+		}
+	}
+
+	// Compiles the world for the XML source (written to a temporary and renamed into place)
+	bool store(const path& source, const World& world) {
+
+		std::error_code ec;
+		uint64_t sourceSize = file_size(source, ec);
+		if (ec) return false;
+		auto sourceTime = last_write_time(source, ec);
+		if (ec) return false;
+
+		std::vector<char> bytes = encode(world);
+
+		Header header;
+		std::memcpy(&header, bytes.data(), sizeof(Header));
+		header.sourceSize = sourceSize;
+		header.sourceMTime = sourceTime.time_since_epoch().count();
+		std::memcpy(bytes.data(), &header, sizeof(Header));
+
+		path image = imageFile(source);
+		path temporary = image;
+		temporary += ".tmp";
+
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			if (!file) return false;
+
+			file.write(bytes.data(), bytes.size());
+			if (!file) {
+				std::cerr << "Warning: could not write scene image " << temporary << std::endl;
+				return false;
+			}
+		}
+
+		rename(temporary, image, ec);
+		if (ec) {
+			remove(temporary, ec);
+			return false;
+		}
+
+		return true;
+	}
+};
+
+#endif
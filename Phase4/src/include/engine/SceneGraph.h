@@ -0,0 +1,407 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <string>
+#include <vector>
+#include <variant>
+#include <utility>
+#include <algorithm>
+
+#include "CoreRenderer.h"
+#include "OcclusionCulling.h"
+
+////////////////////////////////////////////////////////////
+// Flattened scene graph
+//
+// The group tree flattened depth first into parallel arrays, built once after
+// loading. Per frame work is a few linear passes over them instead of a
+// recursive walk through nested vectors and variants. World matrices and
+// world space bounds are computed on the CPU and cached: static chains are
+// multiplied out once, and each frame only the dynamic nodes (an animated
+// transform on the node or above it) are updated, in index order since
+// parents come first. Culling skips a whole subtree by jumping to its end.
+// Node i's subtree is [i, subtreeEnd[i]); its children start at firstChild[i]
+// and each one begins where the previous child's subtree ends.
+////////////////////////////////////////////////////////////
+
+struct SceneGraph {
+
+	static constexpr uint32_t NO_PARENT = ~0u;
+
+	// per node
+	std::vector<uint32_t> parent;
+	std::vector<uint32_t> firstChild;
+	std::vector<uint32_t> childCount;
+	std::vector<uint32_t> subtreeEnd;
+	std::vector<glm::mat4> localMatrix; // static ones are folded at build time
+	std::vector<glm::mat4> worldMatrix;
+	std::vector<uint32_t> firstTransform, transformCount;
+	std::vector<uint32_t> firstReference, referenceCount;
+	std::vector<BoundingSphere> contentBounds; // the subtree, in the node's frame
+	std::vector<BoundingSphere> worldBounds;   // contentBounds in world coordinates
+	std::vector<uint32_t> objectCount;         // model references in the subtree
+
+	std::vector<Transform> transforms;
+	std::vector<uint32_t> animatedNodes; // nodes with an animated transform
+	std::vector<uint32_t> dynamicNodes;  // animated nodes and everything below them
+
+	// (node, reference) pairs with the largest world bounds, the only ones
+	// considered as occluders
+	static constexpr size_t OCCLUDER_CANDIDATES = 64;
+	std::vector<std::pair<uint32_t, uint32_t>> occluderCandidates;
+
+	// references left by the frustum test, waiting for the occlusion test
+	std::vector<std::pair<uint32_t, uint32_t>> pendingReferences;
+	std::vector<BoundingSphere> pendingBounds;
+	std::vector<uint8_t> pendingVisible;
+
+	// per model reference
+	std::vector<std::string> modelFilename, textureFilename;
+	std::vector<Model*> model; // null until the model has arrived
+	std::vector<unsigned int> textureID;
+	std::vector<Material> material;
+	std::vector<unsigned int> lod; // level drawn last frame
+	std::vector<BoundingSphere> referenceBounds; // in world coordinates
+
+	// per frame statistics
+	inline static size_t nodesUpdated = 0;
+
+	// what resolveAssets last saw
+	unsigned int modelGeneration = ~0u;
+	size_t textureCount = ~size_t(0);
+
+	size_t size() const { return parent.size(); }
+
+	void build(const std::vector<Group>& groups) {
+
+		*this = SceneGraph();
+		std::vector<bool> dynamic;
+
+		auto flatten = [&](auto& self, const Group& group, uint32_t parentIndex) -> void {
+
+			uint32_t index = static_cast<uint32_t>(size());
+
+			parent.push_back(parentIndex);
+			firstChild.push_back(index + 1);
+			childCount.push_back(static_cast<uint32_t>(group.subgroups.size()));
+			subtreeEnd.push_back(index + 1);
+
+			// static transforms are kept too, the bounds sweep them one by one
+			bool animated = false;
+			glm::mat4 local(1.0f);
+			for (const auto& t : group.transforms) {
+				animated |= std::holds_alternative<AnimatedTranslation>(t) || std::holds_alternative<AnimatedRotation>(t);
+				local *= std::visit([](const auto& t) { return t.matrix(); }, t);
+			}
+			if (animated) animatedNodes.push_back(index);
+
+			dynamic.push_back(animated || (parentIndex != NO_PARENT && dynamic[parentIndex]));
+			if (dynamic[index]) dynamicNodes.push_back(index);
+
+			localMatrix.push_back(local);
+			worldMatrix.push_back(local);
+			firstTransform.push_back(static_cast<uint32_t>(transforms.size()));
+			transformCount.push_back(static_cast<uint32_t>(group.transforms.size()));
+			for (const auto& t : group.transforms)
+				transforms.push_back(t); // not assignable, so no range insert
+
+			firstReference.push_back(static_cast<uint32_t>(modelFilename.size()));
+			referenceCount.push_back(static_cast<uint32_t>(group.modelReferences.size()));
+			for (const auto& mref : group.modelReferences) {
+				modelFilename.push_back(mref.modelFilename);
+				textureFilename.push_back(mref.textureFilename);
+				model.push_back(nullptr);
+				textureID.push_back(0);
+				material.push_back(mref.material);
+				lod.push_back(mref.lod);
+				referenceBounds.push_back({});
+			}
+
+			contentBounds.push_back({});
+			worldBounds.push_back({});
+			objectCount.push_back(0);
+
+			for (const auto& subgroup : group.subgroups)
+				self(self, subgroup, index);
+
+			subtreeEnd[index] = static_cast<uint32_t>(size());
+		};
+
+		for (const auto& group : groups)
+			flatten(flatten, group, NO_PARENT);
+
+		updateWorldMatrices();
+	}
+
+	// looks the references up again whenever models or textures have arrived
+	void resolveAssets() {
+
+		bool modelsChanged = modelGeneration != ModelStorage::generation;
+		if (!modelsChanged && textureCount == Texture::textureIDs.size()) return;
+
+		for (size_t r = 0; r < modelFilename.size(); r++) {
+			auto it = ModelStorage::models.find(modelFilename[r]);
+			model[r] = (it != ModelStorage::models.end()) ? &it->second : nullptr;
+			textureID[r] = Texture::id(textureFilename[r]);
+		}
+
+		if (modelsChanged) computeBounds();
+
+		modelGeneration = ModelStorage::generation;
+		textureCount = Texture::textureIDs.size();
+	}
+
+	// Drops the removed references and hangs the added ones from a new root
+	// at the end, which keeps the depth first order. Everything derived from
+	// the references is computed again by the next resolveAssets.
+	void replaceReferences(const std::vector<uint8_t>& removed, const std::vector<Group::ModelReference>& added) {
+
+		std::vector<uint32_t> kept;
+		for (uint32_t n = 0; n < size(); n++) {
+			uint32_t first = static_cast<uint32_t>(kept.size());
+			for (uint32_t r = firstReference[n]; r < firstReference[n] + referenceCount[n]; r++)
+				if (!removed[r]) kept.push_back(r);
+
+			firstReference[n] = first;
+			referenceCount[n] = static_cast<uint32_t>(kept.size()) - first;
+		}
+
+		// kept[i] >= i, so moving forwards in place is safe
+		auto compact = [&](auto& array) {
+			for (size_t i = 0; i < kept.size(); i++)
+				array[i] = std::move(array[kept[i]]);
+			array.resize(kept.size());
+		};
+		compact(modelFilename);
+		compact(textureFilename);
+		compact(model);
+		compact(textureID);
+		compact(material);
+		compact(lod);
+		compact(referenceBounds);
+
+		uint32_t index = static_cast<uint32_t>(size());
+		parent.push_back(NO_PARENT);
+		firstChild.push_back(index + 1);
+		childCount.push_back(0);
+		subtreeEnd.push_back(index + 1);
+		localMatrix.push_back(glm::mat4(1.0f));
+		worldMatrix.push_back(glm::mat4(1.0f));
+		firstTransform.push_back(static_cast<uint32_t>(transforms.size()));
+		transformCount.push_back(0);
+		firstReference.push_back(static_cast<uint32_t>(modelFilename.size()));
+		referenceCount.push_back(static_cast<uint32_t>(added.size()));
+		contentBounds.push_back({});
+		worldBounds.push_back({});
+		objectCount.push_back(0);
+
+		for (const auto& mref : added) {
+			modelFilename.push_back(mref.modelFilename);
+			textureFilename.push_back(mref.textureFilename);
+			model.push_back(nullptr);
+			textureID.push_back(0);
+			material.push_back(mref.material);
+			lod.push_back(mref.lod);
+			referenceBounds.push_back({});
+		}
+
+		modelGeneration = ~0u;
+	}
+
+	// Bounds of node n's subtree as seen from its parent: contentBounds pushed
+	// through its transforms, with animated ones swept over their whole period
+	BoundingSphere sweptBounds(uint32_t n) const {
+		BoundingSphere bounds = contentBounds[n];
+		for (uint32_t k = firstTransform[n] + transformCount[n]; k-- > firstTransform[n];)
+			bounds = std::visit([&](const auto& t) { return t.sweep(bounds); }, transforms[k]);
+		return bounds;
+	}
+
+	// children sit after their parent, so one backwards pass sees every child first
+	void computeBounds() {
+		for (size_t n = size(); n-- > 0;) {
+
+			BoundingSphere bounds;
+			uint32_t objects = referenceCount[n];
+
+			for (uint32_t r = firstReference[n]; r < firstReference[n] + referenceCount[n]; r++)
+				if (model[r]) bounds.merge(model[r]->boundingSphere());
+
+			uint32_t child = firstChild[n];
+			for (uint32_t c = 0; c < childCount[n]; c++) {
+				bounds.merge(sweptBounds(child));
+				objects += objectCount[child];
+				child = subtreeEnd[child];
+			}
+
+			contentBounds[n] = bounds;
+			objectCount[n] = objects;
+		}
+
+		for (uint32_t n = 0; n < size(); n++)
+			updateWorldBounds(n);
+
+		chooseOccluderCandidates();
+	}
+
+	void chooseOccluderCandidates() {
+		occluderCandidates.clear();
+		for (uint32_t n = 0; n < size(); n++)
+			for (uint32_t r = firstReference[n]; r < firstReference[n] + referenceCount[n]; r++)
+				if (model[r]) occluderCandidates.push_back({ n, r });
+
+		auto larger = [&](const auto& a, const auto& b) { return referenceBounds[a.second].radius > referenceBounds[b.second].radius; };
+		if (occluderCandidates.size() > OCCLUDER_CANDIDATES) {
+			std::nth_element(occluderCandidates.begin(), occluderCandidates.begin() + OCCLUDER_CANDIDATES, occluderCandidates.end(), larger);
+			occluderCandidates.resize(OCCLUDER_CANDIDATES);
+		}
+	}
+
+	// the candidates in view and big enough on screen, largest first; an
+	// occluder around the camera hides nothing and is skipped
+	void startOcclusion(const Frustum& frustum, const glm::mat4& view, const glm::mat4& viewProjection) {
+
+		std::vector<std::pair<float, OcclusionCulling::Occluder>> chosen;
+		for (const auto& [n, r] : occluderCandidates) {
+			const BoundingSphere& bounds = referenceBounds[r];
+			if (model[r]->occluderIndices.empty() || !frustum.intersects(bounds)) continue;
+
+			float distance = glm::length(glm::vec3(view * glm::vec4(bounds.center, 1.0f)));
+			if (distance <= bounds.radius || bounds.radius < OcclusionCulling::minOccluderSize * distance) continue;
+
+			chosen.push_back({ bounds.radius / distance, { &model[r]->occluderPositions, &model[r]->occluderIndices, viewProjection * worldMatrix[n] } });
+		}
+
+		std::sort(chosen.begin(), chosen.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		if (chosen.size() > OcclusionCulling::maxOccluders) chosen.resize(OcclusionCulling::maxOccluders);
+
+		std::vector<OcclusionCulling::Occluder> occluders;
+		for (const auto& [_, occluder] : chosen)
+			occluders.push_back(occluder);
+		OcclusionCulling::begin(std::move(occluders));
+	}
+
+	void updateWorldMatrices() {
+		for (uint32_t n = 0; n < size(); n++)
+			updateWorldMatrix(n);
+	}
+
+	void updateWorldMatrix(uint32_t n) {
+		worldMatrix[n] = (parent[n] == NO_PARENT) ? localMatrix[n] : worldMatrix[parent[n]] * localMatrix[n];
+	}
+
+	void updateWorldBounds(uint32_t n) {
+		const glm::mat4& world = worldMatrix[n];
+		worldBounds[n] = contentBounds[n].transformed(world);
+		for (uint32_t r = firstReference[n]; r < firstReference[n] + referenceCount[n]; r++)
+			referenceBounds[r] = model[r] ? model[r]->boundingSphere().transformed(world) : BoundingSphere();
+	}
+
+	// animations keep running in culled subtrees as well
+	void animate(float tDelta) {
+
+		for (uint32_t n : animatedNodes) {
+			glm::mat4 local(1.0f);
+			for (uint32_t k = firstTransform[n]; k < firstTransform[n] + transformCount[n]; k++) {
+				Transform& t = transforms[k];
+				local *= std::visit([](const auto& t) { return t.matrix(); }, t);
+				if (auto* at = std::get_if<AnimatedTranslation>(&t)) at->advance(tDelta);
+				else if (auto* ar = std::get_if<AnimatedRotation>(&t)) ar->advance(tDelta);
+			}
+			localMatrix[n] = local;
+		}
+
+		// a dynamic node's parent is either dynamic itself, and updated before it, or static
+		for (uint32_t n : dynamicNodes) {
+			updateWorldMatrix(n);
+			updateWorldBounds(n);
+		}
+		nodesUpdated = dynamicNodes.size();
+	}
+
+	// Plain draws go to the RenderQueue with their whole modelview; the view is
+	// left in place afterwards. With occlusion culling on, the references that
+	// pass the frustum are held back until the occluders, rasterized meanwhile,
+	// have been tested against.
+	void render(const Frustum& frustum, const glm::mat4& view, const glm::mat4& projection) {
+
+		glPushAttrib(GL_CURRENT_BIT);
+
+		bool programmable = CoreRenderer::active();
+		bool batching = !programmable && InstanceBatcher::active();
+		bool occlusion = OcclusionCulling::enabled;
+		glm::mat4 viewProjection = projection * view;
+
+		OcclusionCulling::objectsOccluded = OcclusionCulling::occludersDrawn = 0;
+		if (occlusion) {
+			pendingReferences.clear();
+			pendingBounds.clear();
+			startOcclusion(frustum, view, viewProjection);
+		}
+
+		auto submit = [&](uint32_t n, uint32_t r) {
+			if (programmable)
+				CoreRenderer::add(*model[r], textureID[r], material[r], &lod[r], worldMatrix[n]);
+			else if (batching)
+				InstanceBatcher::add(*model[r], textureID[r], material[r], &lod[r], worldMatrix[n]);
+			else
+				RenderQueue::add(*model[r], textureID[r], material[r], &lod[r], view * worldMatrix[n]);
+
+			if (Model::showAxes) DebugDraw::object(model[r]->axes(), worldMatrix[n]);
+		};
+
+		for (uint32_t n = 0; n < size();) {
+
+			if (Group::cullingEnabled && !frustum.intersects(worldBounds[n])) {
+				Group::objectsCulled += objectCount[n];
+				n = subtreeEnd[n];
+				continue;
+			}
+
+			if (AnimatedTranslation::showPath) drawPaths(n);
+
+			for (uint32_t r = firstReference[n]; r < firstReference[n] + referenceCount[n]; r++) {
+
+				if (Group::cullingEnabled && !frustum.intersects(referenceBounds[r])) {
+					Group::objectsCulled++;
+					continue;
+				}
+				if (!model[r]) continue;
+				Group::objectsDrawn++;
+
+				if (occlusion) {
+					pendingReferences.push_back({ n, r });
+					pendingBounds.push_back(referenceBounds[r]);
+				}
+				else submit(n, r);
+			}
+
+			n++;
+		}
+
+		if (occlusion) {
+			OcclusionCulling::test(viewProjection, pendingBounds, pendingVisible);
+			Group::objectsDrawn -= OcclusionCulling::objectsOccluded;
+
+			for (size_t i = 0; i < pendingReferences.size(); i++)
+				if (pendingVisible[i]) submit(pendingReferences[i].first, pendingReferences[i].second);
+		}
+
+		glLoadMatrixf(glm::value_ptr(view));
+		glPopAttrib();
+	}
+
+	// debug drawing of node n's animation paths, each in the frame it is applied in
+	void drawPaths(uint32_t n) {
+
+		glm::mat4 frame = (parent[n] != NO_PARENT) ? worldMatrix[parent[n]] : glm::mat4(1.0f);
+
+		for (uint32_t k = firstTransform[n]; k < firstTransform[n] + transformCount[n]; k++) {
+			if (auto* at = std::get_if<AnimatedTranslation>(&transforms[k]))
+				DebugDraw::object(at->path(), frame);
+			frame *= std::visit([](const auto& t) { return t.matrix(); }, transforms[k]);
+		}
+	}
+};
+
+#endif
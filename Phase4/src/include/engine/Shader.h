@@ -0,0 +1,126 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "GLState.h"
+
+////////////////////////////////////////////////////////////
+// GLSL program helper
+//
+// Compiles and links a vertex + fragment pair, binding the
+// given generic attributes to fixed locations before linking,
+// or a single compute shader (GL 4.3).
+// Errors throw std::runtime_error with the driver's log.
+////////////////////////////////////////////////////////////
+
+struct ShaderProgram {
+
+	GLuint id = 0;
+
+	bool valid() const { return id != 0; }
+
+	void use() const { GLState::useProgram(id); }
+
+	// cached, -1 when the uniform does not exist (or was optimised away)
+	GLint uniform(const std::string& name) {
+		auto it = uniforms.find(name);
+		if (it != uniforms.end()) return it->second;
+		return uniforms[name] = glGetUniformLocation(id, name.c_str());
+	}
+
+	void destroy() {
+		if (id) glDeleteProgram(id);
+		id = 0;
+		uniforms.clear();
+	}
+
+	static ShaderProgram build(const char* vertexSource, const char* fragmentSource,
+		const std::vector<std::pair<GLuint, std::string>>& attributes = {}) {
+
+		GLuint vertex = compile(GL_VERTEX_SHADER, vertexSource);
+		GLuint fragment = 0;
+		try {
+			fragment = compile(GL_FRAGMENT_SHADER, fragmentSource);
+		}
+		catch (...) {
+			glDeleteShader(vertex);
+			throw;
+		}
+
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		for (const auto& [location, name] : attributes)
+			glBindAttribLocation(program, location, name.c_str());
+
+		// the program keeps them alive while attached
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+
+		return link(program);
+	}
+
+	static ShaderProgram buildCompute(const char* computeSource) {
+		GLuint compute = compile(GL_COMPUTE_SHADER, computeSource);
+
+		GLuint program = glCreateProgram();
+		glAttachShader(program, compute);
+		glDeleteShader(compute);
+
+		return link(program);
+	}
+
+private:
+
+	std::unordered_map<std::string, GLint> uniforms;
+
+	static ShaderProgram link(GLuint program) {
+		glLinkProgram(program);
+
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			std::string log = infoLog(program, glGetProgramiv, glGetProgramInfoLog);
+			glDeleteProgram(program);
+			throw std::runtime_error(std::format("Shader program failed to link:\n{}", log));
+		}
+
+		ShaderProgram result;
+		result.id = program;
+		return result;
+	}
+
+	static GLuint compile(GLenum stage, const char* source) {
+		GLuint shader = glCreateShader(stage);
+		glShaderSource(shader, 1, &source, nullptr);
+		glCompileShader(shader);
+
+		GLint compiled = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+		if (!compiled) {
+			std::string log = infoLog(shader, glGetShaderiv, glGetShaderInfoLog);
+			glDeleteShader(shader);
+			throw std::runtime_error(std::format("{} shader failed to compile:\n{}",
+				(stage == GL_VERTEX_SHADER) ? "Vertex" : (stage == GL_FRAGMENT_SHADER) ? "Fragment" : "Compute", log));
+		}
+		return shader;
+	}
+
+	template <typename GetIv, typename GetLog>
+	static std::string infoLog(GLuint object, GetIv getIv, GetLog getLog) {
+		GLint length = 0;
+		getIv(object, GL_INFO_LOG_LENGTH, &length);
+		std::string log(std::max(length, 1), '\0');
+		getLog(object, length, nullptr, log.data());
+		return log;
+	}
+};
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef STATICBATCHING_H
+#define STATICBATCHING_H
+
+#include <map>
+#include <limits>
+#include <string>
+#include <vector>
+#include <format>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include "SceneGraph.h"
+
+////////////////////////////////////////////////////////////
+// Static batching
+//
+// Load time merging of static geometry. References under nodes with no
+// animated transform above them that share a texture and material are
+// baked into world space and merged into a few large meshes, which replace
+// them in the scene graph under one identity root. Only small meshes are
+// merged (bigger ones are drawn well enough on their own, or instanced),
+// in spatially coherent runs up to BATCH_VERTICES so each batch keeps
+// bounds tight enough to cull. The meshes are read back from the
+// MeshArena, since their packed streams are released once uploaded.
+// Batches go through the same optimisation and level of detail steps
+// as models loaded from disk, but keep float attributes: the meshes
+// read back were quantized within the error bounds already, and a
+// second pass on top of that in world space could exceed them.
+////////////////////////////////////////////////////////////
+
+struct StaticBatching {
+
+	inline static bool enabled = true;
+
+	static constexpr size_t MODEL_VERTICES = 256;   // largest mesh merged
+	static constexpr size_t BATCH_VERTICES = 65535; // keeps 16 bit indices
+	static constexpr size_t MIN_REFERENCES = 2;
+
+	// statistics of the last build
+	inline static size_t referencesMerged = 0;
+	inline static size_t batchCount = 0;
+
+	static void build(SceneGraph& scene) {
+
+		referencesMerged = batchCount = 0;
+		if (!enabled) return;
+
+		std::vector<uint8_t> dynamic(scene.size(), 0);
+		for (uint32_t n : scene.dynamicNodes)
+			dynamic[n] = 1;
+
+		// references with the same texture, material and vertex attributes
+		std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> runs;
+		for (uint32_t n = 0; n < scene.size(); n++) {
+			if (dynamic[n]) continue;
+
+			for (uint32_t r = scene.firstReference[n]; r < scene.firstReference[n] + scene.referenceCount[n]; r++) {
+				const Model* model = scene.model[r];
+				if (!model || !model->buffersInitialised || model->vertexCount > MODEL_VERTICES) continue;
+
+				std::string key = scene.textureFilename[r];
+				key.append(reinterpret_cast<const char*>(&scene.material[r]), sizeof(Material));
+				key.push_back(model->layout.normal != VertexLayout::Normal::NONE);
+				key.push_back(model->layout.texcoord != VertexLayout::Texcoord::NONE);
+				runs[key].push_back({ n, r });
+			}
+		}
+
+		std::vector<uint8_t> removed(scene.modelFilename.size(), 0);
+		std::vector<Group::ModelReference> added;
+		std::unordered_map<const Model*, Decoded> decoded;
+		size_t vertices = 0;
+
+		for (auto& [key, run] : runs) {
+			if (run.size() < MIN_REFERENCES) continue;
+
+			sortSpatially(scene, run);
+
+			for (size_t first = 0; first < run.size();) {
+
+				size_t last = first, batchVertices = 0;
+				while (last < run.size() && batchVertices + scene.model[run[last].second]->vertexCount <= BATCH_VERTICES)
+					batchVertices += scene.model[run[last++].second]->vertexCount;
+
+				if (last - first >= MIN_REFERENCES) {
+					Model batch;
+					for (size_t i = first; i < last; i++) {
+						auto [n, r] = run[i];
+						const Model* model = scene.model[r];
+						auto it = decoded.find(model);
+						if (it == decoded.end()) it = decoded.emplace(model, decode(*model)).first;
+
+						append(batch, it->second, scene.worldMatrix[n]);
+						removed[r] = 1;
+					}
+
+					std::string name = std::format("static batch {}", batchCount++);
+					if (ModelStorage::optimizeOnLoad)
+						meshOptimizer::optimize(batch, name);
+					batch.pack(ModelStorage::lodsOnLoad, false);
+
+					ModelStorage::load(name, std::move(batch));
+					ModelStorage::models[name].initBuffers();
+
+					uint32_t r = run[first].second;
+					added.push_back({ name, scene.textureFilename[r], scene.material[r] });
+					referencesMerged += last - first;
+					vertices += batchVertices;
+				}
+
+				first = std::max(last, first + 1);
+			}
+		}
+
+		if (added.empty()) return;
+
+		scene.replaceReferences(removed, added);
+
+		std::cout
+			<< std::format("Static batching: merged {} references into {} batches ({} vertices)",
+				referencesMerged, batchCount, vertices)
+			<< std::endl;
+	}
+
+private:
+
+	// a model's full detail mesh back in model space floats
+	struct Decoded {
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texcoords;
+		std::vector<unsigned int> indices;
+	};
+
+	static Decoded decode(const Model& model) {
+
+		const VertexLayout& layout = model.layout;
+		size_t stride = layout.stride();
+		Model::Lod full = model.lodRange(0);
+
+		auto attribs = MeshArena::read(MeshArena::vertices, model.vertexBase, model.vertexCount * stride);
+		auto indices = MeshArena::read(MeshArena::indices, model.indexBase + full.firstIndex * model.indexSize(), full.indexCount * model.indexSize());
+
+		Decoded result;
+		for (size_t v = 0; v < model.vertexCount; v++) {
+			const unsigned char* vertex = attribs.data() + v * stride;
+			result.positions.push_back(layout.readPosition(vertex));
+			if (layout.normal != VertexLayout::Normal::NONE) result.normals.push_back(layout.readNormal(vertex + layout.normalOffset()));
+			if (layout.texcoord != VertexLayout::Texcoord::NONE) result.texcoords.push_back(layout.readTexcoord(vertex + layout.texcoordOffset()));
+		}
+
+		for (size_t i = 0; i < full.indexCount; i++)
+			result.indices.push_back((model.elementType == GL_UNSIGNED_SHORT)
+				? reinterpret_cast<const unsigned short*>(indices.data())[i]
+				: reinterpret_cast<const unsigned int*>(indices.data())[i]);
+
+		return result;
+	}
+
+	// in world space, as the parsed streams of a model loaded from disk
+	static void append(Model& batch, const Decoded& mesh, const glm::mat4& world) {
+
+		unsigned int base = static_cast<unsigned int>(batch.vertices.size());
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+
+		for (const glm::vec3& p : mesh.positions)
+			batch.vertices.push_back(glm::vec3(world * glm::vec4(p, 1.0f)));
+		for (const glm::vec3& n : mesh.normals)
+			batch.normals.push_back(glm::normalize(normalMatrix * n));
+		batch.texcoords.insert(batch.texcoords.end(), mesh.texcoords.begin(), mesh.texcoords.end());
+
+		for (unsigned int i : mesh.indices) {
+			batch.vIndices.push_back(base + i);
+			if (!mesh.normals.empty()) batch.vnIndices.push_back(base + i);
+			if (!mesh.texcoords.empty()) batch.vtIndices.push_back(base + i);
+		}
+	}
+
+	// along a Morton curve through the run's world bounds, so consecutive
+	// references, and the batches cut from them, stay close together
+	static void sortSpatially(const SceneGraph& scene, std::vector<std::pair<uint32_t, uint32_t>>& run) {
+
+		glm::vec3 low(std::numeric_limits<float>::max()), high(std::numeric_limits<float>::lowest());
+		for (const auto& [n, r] : run) {
+			low = glm::min(low, scene.referenceBounds[r].center);
+			high = glm::max(high, scene.referenceBounds[r].center);
+		}
+		glm::vec3 scale = 1023.0f / glm::max(high - low, glm::vec3(1e-6f));
+
+		auto spread = [](uint32_t x) {
+			x &= 0x3FF;
+			x = (x | (x << 16)) & 0x030000FF;
+			x = (x | (x << 8)) & 0x0300F00F;
+			x = (x | (x << 4)) & 0x030C30C3;
+			x = (x | (x << 2)) & 0x09249249;
+			return x;
+		};
+
+		std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t>>> keyed;
+		for (const auto& reference : run) {
+			glm::uvec3 cell = glm::uvec3((scene.referenceBounds[reference.second].center - low) * scale);
+			keyed.push_back({ spread(cell.x) | (spread(cell.y) << 1) | (spread(cell.z) << 2), reference });
+		}
+		std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+		for (size_t i = 0; i < run.size(); i++)
+			run[i] = keyed[i].second;
+	}
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/constants.hpp>
+
+////////////////////////////////////////////////////////////
+// Per-model vertex layouts
+//
+// Every model picks the smallest encoding of each attribute
+// whose error stays within the bounds in VertexQuantization:
+//
+//   position  float32 x3 | int16 x3 around the bounds centre
+//   normal    absent | float32 x3 | int16 x3 | int8 x3 | 2_10_10_10
+//   texcoord  absent | float32 x2 | half x2
+//
+// Quantized positions are undone by the modelview matrix
+// (see VertexLayout::applyDecode), with a uniform scale so
+// GL_RESCALE_NORMAL keeps the normals right.
+////////////////////////////////////////////////////////////
+
+struct VertexLayout {
+
+	enum class Position : uint8_t { FLOAT32, SNORM16 };
+	enum class Normal : uint8_t { NONE, FLOAT32, SNORM16, SNORM8, SNORM10 };
+	enum class Texcoord : uint8_t { NONE, FLOAT32, HALF16 };
+
+	Position position = Position::FLOAT32;
+	Normal normal = Normal::FLOAT32;
+	Texcoord texcoord = Texcoord::FLOAT32;
+
+	// object space position = positionOffset + positionScale * stored
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	float positionScale = 1.0f;
+
+	// attributes start on 4 byte boundaries
+	static constexpr uint32_t padded(uint32_t bytes) {
+		return (bytes + 3) & ~3u;
+	}
+
+	uint32_t positionSize() const {
+		return (position == Position::SNORM16) ? padded(3 * sizeof(int16_t)) : 3 * sizeof(float);
+	}
+
+	uint32_t normalSize() const {
+		switch (normal) {
+			case Normal::FLOAT32: return 3 * sizeof(float);
+			case Normal::SNORM16: return padded(3 * sizeof(int16_t));
+			case Normal::SNORM8:  return padded(3 * sizeof(int8_t));
+			case Normal::SNORM10: return sizeof(uint32_t);
+			default:              return 0;
+		}
+	}
+
+	uint32_t texcoordSize() const {
+		switch (texcoord) {
+			case Texcoord::FLOAT32: return 2 * sizeof(float);
+			case Texcoord::HALF16:  return 2 * sizeof(uint16_t);
+			default:                return 0;
+		}
+	}
+
+	uint32_t normalOffset() const { return positionSize(); }
+	uint32_t texcoordOffset() const { return positionSize() + normalSize(); }
+	uint32_t stride() const { return positionSize() + normalSize() + texcoordSize(); }
+
+	GLenum positionType() const {
+		return (position == Position::SNORM16) ? GL_SHORT : GL_FLOAT;
+	}
+
+	GLenum normalType() const {
+		switch (normal) {
+			case Normal::SNORM16: return GL_SHORT;
+			case Normal::SNORM8:  return GL_BYTE;
+			case Normal::SNORM10: return GL_INT_2_10_10_10_REV;
+			default:              return GL_FLOAT;
+		}
+	}
+
+	GLenum texcoordType() const {
+		return (texcoord == Texcoord::HALF16) ? GL_HALF_FLOAT : GL_FLOAT;
+	}
+
+	// folds the position dequantization into the current modelview matrix
+	void applyDecode() const {
+		if (position == Position::FLOAT32) return;
+		glTranslatef(positionOffset.x, positionOffset.y, positionOffset.z);
+		glScalef(positionScale, positionScale, positionScale);
+	}
+
+	// Encoders / decoders for a single attribute
+
+	void writePosition(unsigned char* dst, const glm::vec3& p) const {
+		if (position == Position::FLOAT32) {
+			std::memcpy(dst, &p, 3 * sizeof(float));
+			return;
+		}
+		glm::vec3 q = glm::round((p - positionOffset) / positionScale);
+		int16_t s[3];
+		for (int i = 0; i < 3; i++) s[i] = static_cast<int16_t>(std::clamp(q[i], -32767.0f, 32767.0f));
+		std::memcpy(dst, s, sizeof(s));
+	}
+
+	glm::vec3 readPosition(const unsigned char* src) const {
+		if (position == Position::FLOAT32) {
+			glm::vec3 p;
+			std::memcpy(&p, src, 3 * sizeof(float));
+			return p;
+		}
+		int16_t s[3];
+		std::memcpy(s, src, sizeof(s));
+		return positionOffset + positionScale * glm::vec3(s[0], s[1], s[2]);
+	}
+
+	void writeNormal(unsigned char* dst, const glm::vec3& n) const {
+		switch (normal) {
+			case Normal::FLOAT32: {
+				std::memcpy(dst, &n, 3 * sizeof(float));
+				break;
+			}
+			case Normal::SNORM16: {
+				int16_t s[3];
+				for (int i = 0; i < 3; i++) s[i] = static_cast<int16_t>(glm::packSnorm1x16(n[i]));
+				std::memcpy(dst, s, sizeof(s));
+				break;
+			}
+			case Normal::SNORM8: {
+				int8_t s[3];
+				for (int i = 0; i < 3; i++) s[i] = static_cast<int8_t>(glm::packSnorm1x8(n[i]));
+				std::memcpy(dst, s, sizeof(s));
+				break;
+			}
+			case Normal::SNORM10: {
+				uint32_t packed = glm::packSnorm3x10_1x2(glm::vec4(n, 0.0f));
+				std::memcpy(dst, &packed, sizeof(packed));
+				break;
+			}
+			default: break;
+		}
+	}
+
+	glm::vec3 readNormal(const unsigned char* src) const {
+		switch (normal) {
+			case Normal::FLOAT32: {
+				glm::vec3 n;
+				std::memcpy(&n, src, 3 * sizeof(float));
+				return n;
+			}
+			case Normal::SNORM16: {
+				int16_t s[3];
+				std::memcpy(s, src, sizeof(s));
+				return glm::vec3(
+					glm::unpackSnorm1x16(static_cast<uint16_t>(s[0])),
+					glm::unpackSnorm1x16(static_cast<uint16_t>(s[1])),
+					glm::unpackSnorm1x16(static_cast<uint16_t>(s[2])));
+			}
+			case Normal::SNORM8: {
+				int8_t s[3];
+				std::memcpy(s, src, sizeof(s));
+				return glm::vec3(
+					glm::unpackSnorm1x8(static_cast<uint8_t>(s[0])),
+					glm::unpackSnorm1x8(static_cast<uint8_t>(s[1])),
+					glm::unpackSnorm1x8(static_cast<uint8_t>(s[2])));
+			}
+			case Normal::SNORM10: {
+				uint32_t packed;
+				std::memcpy(&packed, src, sizeof(packed));
+				return glm::vec3(glm::unpackSnorm3x10_1x2(packed));
+			}
+			default: return glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	}
+
+	void writeTexcoord(unsigned char* dst, const glm::vec2& t) const {
+		if (texcoord == Texcoord::FLOAT32) {
+			std::memcpy(dst, &t, 2 * sizeof(float));
+		}
+		else if (texcoord == Texcoord::HALF16) {
+			uint16_t h[2] = { glm::packHalf1x16(t.s), glm::packHalf1x16(t.t) };
+			std::memcpy(dst, h, sizeof(h));
+		}
+	}
+
+	glm::vec2 readTexcoord(const unsigned char* src) const {
+		if (texcoord == Texcoord::FLOAT32) {
+			glm::vec2 t;
+			std::memcpy(&t, src, 2 * sizeof(float));
+			return t;
+		}
+		if (texcoord == Texcoord::HALF16) {
+			uint16_t h[2];
+			std::memcpy(h, src, sizeof(h));
+			return glm::vec2(glm::unpackHalf1x16(h[0]), glm::unpackHalf1x16(h[1]));
+		}
+		return glm::vec2(0.0f);
+	}
+};
+
+
+struct VertexQuantization {
+
+	inline static bool enabled = true;
+
+	// error bounds (model units / radians / texcoord units), set with --max-position-error,
+	// --max-normal-error (in degrees) and --max-texcoord-error
+	inline static float maxPositionError = 0.001f;
+	inline static float maxNormalError = glm::radians(1.0f);
+	inline static float maxTexcoordError = 1.0f / 4096.0f;
+
+	// formats the fixed function pipeline only takes with these extensions
+	inline static bool packedNormalsSupported = false;
+	inline static bool halfFloatsSupported = false;
+
+	// after glewInit
+	static void detectSupport() {
+		packedNormalsSupported = GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+		halfFloatsSupported = GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex;
+
+		// some drivers (Mesa) only take packed types with size 4, which glNormalPointer can't give
+		if (packedNormalsSupported) {
+			while (glGetError() != GL_NO_ERROR) {}
+			glNormalPointer(GL_INT_2_10_10_10_REV, 0, nullptr);
+			packedNormalsSupported = (glGetError() == GL_NO_ERROR);
+			glNormalPointer(GL_FLOAT, 0, nullptr);
+		}
+	}
+
+	// Identifies everything that affects the chosen layouts (mesh cache key)
+	static uint64_t fingerprint() {
+		if (!enabled) return 0;
+
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&](const void* data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash ^= static_cast<const unsigned char*>(data)[i];
+				hash *= 1099511628211ull;
+			}
+		};
+		mix(&maxPositionError, sizeof(float));
+		mix(&maxNormalError, sizeof(float));
+		mix(&maxTexcoordError, sizeof(float));
+		mix(&packedNormalsSupported, sizeof(bool));
+		mix(&halfFloatsSupported, sizeof(bool));
+		return hash | 1; // never 0, that means unquantized
+	}
+
+	// Picks the layout for a set of welded attributes (normals/texcoords empty when absent);
+	// all floats without quantize
+	static VertexLayout choose(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, const std::vector<glm::vec2>& texcoords, bool quantize = true) {
+
+		VertexLayout layout;
+		layout.normal = normals.empty() ? VertexLayout::Normal::NONE : VertexLayout::Normal::FLOAT32;
+		layout.texcoord = texcoords.empty() ? VertexLayout::Texcoord::NONE : VertexLayout::Texcoord::FLOAT32;
+
+		if (!enabled || !quantize || positions.empty()) return layout;
+
+		unsigned char scratch[16];
+
+		// positions: uniform scale around the bounds centre
+		{
+			glm::vec3 lo = positions[0], hi = positions[0];
+			for (const auto& p : positions) {
+				lo = glm::min(lo, p);
+				hi = glm::max(hi, p);
+			}
+			glm::vec3 halfExtent = 0.5f * (hi - lo);
+			float radius = std::max({ halfExtent.x, halfExtent.y, halfExtent.z });
+
+			VertexLayout candidate = layout;
+			candidate.position = VertexLayout::Position::SNORM16;
+			candidate.positionOffset = 0.5f * (lo + hi);
+			candidate.positionScale = (radius > 0.0f) ? radius / 32767.0f : 1.0f;
+
+			float error = 0.0f;
+			for (const auto& p : positions) {
+				candidate.writePosition(scratch, p);
+				glm::vec3 d = glm::abs(candidate.readPosition(scratch) - p);
+				error = std::max({ error, d.x, d.y, d.z });
+			}
+
+			if (error <= maxPositionError) layout = candidate;
+		}
+
+		// normals: smallest encoding within the angular bound
+		if (!normals.empty()) {
+
+			std::vector<VertexLayout::Normal> formats;
+			if (packedNormalsSupported) formats.push_back(VertexLayout::Normal::SNORM10);
+			formats.push_back(VertexLayout::Normal::SNORM8);
+			formats.push_back(VertexLayout::Normal::SNORM16);
+
+			for (auto format : formats) {
+				VertexLayout candidate = layout;
+				candidate.normal = format;
+
+				float error = 0.0f;
+				for (const auto& n : normals) {
+					float length = glm::length(n);
+					if (length == 0.0f || !std::isfinite(length)) continue;
+
+					candidate.writeNormal(scratch, n / length);
+					glm::vec3 decoded = candidate.readNormal(scratch);
+					float decodedLength = glm::length(decoded);
+					if (decodedLength == 0.0f) { error = glm::pi<float>(); break; }
+
+					float cosine = std::clamp(glm::dot(decoded / decodedLength, n / length), -1.0f, 1.0f);
+					error = std::max(error, std::acos(cosine));
+				}
+
+				if (error <= maxNormalError) {
+					layout = candidate;
+					break;
+				}
+			}
+		}
+
+		// texcoords: half floats lose precision as values grow (tiling uvs)
+		if (!texcoords.empty() && halfFloatsSupported) {
+
+			VertexLayout candidate = layout;
+			candidate.texcoord = VertexLayout::Texcoord::HALF16;
+
+			float error = 0.0f;
+			for (const auto& t : texcoords) {
+				candidate.writeTexcoord(scratch, t);
+				glm::vec2 d = glm::abs(candidate.readTexcoord(scratch) - t);
+				error = std::max({ error, d.s, d.t });
+			}
+
+			if (error <= maxTexcoordError) layout = candidate;
+		}
+
+		return layout;
+	}
+};
+
+#endif
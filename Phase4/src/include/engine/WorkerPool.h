@@ -0,0 +1,103 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+////////////////////////////////////////////////////////////
+// Worker pool
+//
+// A few threads, started the first time a job is submitted
+// and kept until the engine exits, for the work that runs
+// every frame (occluder rasterization, occlusion tests,
+// light binning). Starting threads for it each frame would
+// cost more than the work itself in small scenes.
+//
+// Jobs run in the order they were submitted. parallel()
+// runs its first chunk on the calling thread, so it still
+// finishes when every worker is busy with something else.
+////////////////////////////////////////////////////////////
+
+struct WorkerPool {
+
+	static std::future<void> submit(std::function<void()> job) {
+		std::packaged_task<void()> task(std::move(job));
+		std::future<void> done = task.get_future();
+
+		State& s = state();
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.queue.push_back(std::move(task));
+		}
+		s.wake.notify_one();
+		return done;
+	}
+
+	// [0, count) split across the workers and the caller, in chunks of at least minChunk
+	template <typename Job>
+	static void parallel(size_t count, size_t minChunk, Job job) {
+		size_t ways = state().threads.size() + 1;
+		size_t chunk = std::max<size_t>((count + ways - 1) / ways, std::max<size_t>(minChunk, 1));
+
+		std::vector<std::future<void>> jobs;
+		for (size_t first = chunk; first < count; first += chunk) {
+			size_t last = std::min(first + chunk, count);
+			jobs.push_back(submit([&job, first, last]() { job(first, last); }));
+		}
+		job(0, std::min(chunk, count));
+		for (auto& j : jobs) j.get();
+	}
+
+private:
+
+	struct State {
+		std::vector<std::thread> threads;
+		std::deque<std::packaged_task<void()>> queue;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stopping = false;
+
+		State() {
+			unsigned int count = std::clamp(std::thread::hardware_concurrency(), 2u, 8u) - 1;
+			for (unsigned int i = 0; i < count; i++)
+				threads.emplace_back([this]() { work(); });
+		}
+
+		// the jobs still queued are run first
+		~State() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (auto& thread : threads) thread.join();
+		}
+
+		void work() {
+			for (;;) {
+				std::packaged_task<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stopping || !queue.empty(); });
+					if (queue.empty()) return;
+					task = std::move(queue.front());
+					queue.pop_front();
+				}
+				task();
+			}
+		}
+	};
+
+	static State& state() {
+		static State s;
+		return s;
+	}
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <vector>
+#include <algorithm>
+
+#include "SceneGraph.h"
+#include "StaticBatching.h"
+#include "GpuCulling.h"
+
+////////////////////////////////////////////////////////////
+// World
+//
+// The groups read from the scene file and the SceneGraph
+// flattened from them on the first frame, drawn through
+// whichever renderer is active.
+////////////////////////////////////////////////////////////
+
+struct World {
+
+	std::vector<Group> groups = {};
+
+	// built from groups on the first frame, the tree is not walked after that
+	SceneGraph scene;
+	bool flattened = false;
+	bool staticBatched = false;
+
+	// once every model has arrived; the first call merges the static geometry
+	void bakeStaticBatches() {
+		if (staticBatched) return;
+
+		if (!flattened) {
+			scene.build(groups);
+			flattened = true;
+		}
+		scene.resolveAssets();
+
+		StaticBatching::build(scene);
+		staticBatched = true;
+	}
+
+	void renderGroups(float tDelta) {
+
+		if (!flattened) {
+			scene.build(groups);
+			flattened = true;
+		}
+
+		// models and textures keep arriving while the scene streams in
+		scene.resolveAssets();
+		scene.animate(tDelta);
+
+		float aspectRatio = WindowState::currentWidth * 1.0f / std::max(WindowState::currentHeight, 1);
+		glm::mat4 view = CameraController::viewMatrix();
+		glm::mat4 projection = CameraController::projectionMatrix(aspectRatio);
+		Frustum frustum = Frustum::fromMatrix(projection * view);
+
+		if (GpuCulling::active()) {
+			GpuCulling::render(scene, frustum, view);
+			return;
+		}
+
+		if (CoreRenderer::active()) {
+			CoreRenderer::begin(view, projection);
+			scene.render(frustum, view, projection);
+			CoreRenderer::flush();
+			return;
+		}
+
+		// instanced sets are drawn after the walk, from the camera's modelview
+		if (InstanceBatcher::active()) InstanceBatcher::begin(view);
+
+		scene.render(frustum, view, projection);
+
+		if (InstanceBatcher::active()) InstanceBatcher::flush();
+		RenderQueue::flush(view);
+	}
+
+};
+
+#endif
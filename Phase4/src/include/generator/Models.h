@@ -10,6 +10,12 @@
 #include <fstream>
 #include <sstream>
 #include <filesystem>
+#include <array>
+#include <unordered_map>
+
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjParser.h"
 
 struct ModelData {
 
@@ -26,6 +32,9 @@ namespace fileManagement {
 
 	using namespace std::filesystem;
 
+	// reorder triangles and vertices for the GPU caches before writing (see MeshOptimizer.h)
+	bool optimizeMeshes = true;
+
 	path ModelsFolder() {
 		path modelsFolder = current_path().parent_path() / "models";
 		create_directory(modelsFolder);
@@ -51,6 +60,9 @@ namespace fileManagement {
 
 	void exportOBJ(ModelData model, std::string filename) {
 
+		if (optimizeMeshes)
+			meshOptimizer::optimize(model, filename);
+
 		path filepath = ModelsFolder() / filename;
 
 		if (exists(filepath))
@@ -94,6 +106,38 @@ namespace fileManagement {
 		file.close();
 	}
 
+	// Reads a .3d (OBJ subset) from the models folder, polygons are fanned into triangles
+	ModelData importOBJ(std::string filename) {
+
+		ModelData model;
+
+		try {
+			std::string buffer = objParser::readFileBuffer(ModelsFolder() / filename);
+			objParser::parseReserved(buffer.data(), buffer.data() + buffer.size(), model, { .polygons = true, .placeholders = true });
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << "Error reading " << filename << ": " << e.what() << std::endl;
+			return {};
+		}
+
+		bool missingTexcoords = std::find(model.vtIndices.begin(), model.vtIndices.end(), objParser::MISSING) != model.vtIndices.end();
+		bool missingNormals = std::find(model.vnIndices.begin(), model.vnIndices.end(), objParser::MISSING) != model.vnIndices.end();
+
+		// corners without one point at a default appended at the end
+		if (missingTexcoords) {
+			for (auto& vt : model.vtIndices)
+				if (vt == objParser::MISSING) vt = static_cast<unsigned int>(model.texcoords.size());
+			model.texcoords.push_back(glm::vec2(0.0f));
+		}
+		if (missingNormals) {
+			for (auto& vn : model.vnIndices)
+				if (vn == objParser::MISSING) vn = static_cast<unsigned int>(model.normals.size());
+			model.normals.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
+		}
+
+		return model;
+	}
+
 
 	void exportToOBJOld(ModelData model, std::string filename) {
 
@@ -140,6 +184,54 @@ namespace fileManagement {
 	}
 }
 
+namespace levelsOfDetail {
+
+	// Simplified copies of a model (see MeshSimplifier.h), each with about half the
+	// triangles of the previous one, paired with their error in model units
+	std::vector<std::pair<ModelData, float>> build(const ModelData& model, size_t levels) {
+
+		auto [corners, positions] = meshOptimizer::weldCorners(model);
+
+		// the (v, vn, vt) triple behind each welded vertex
+		std::vector<std::array<unsigned int, 3>> triples(positions.size());
+		for (size_t i = 0; i < corners.size(); i++)
+			triples[corners[i]] = {
+				model.vIndices[i],
+				(i < model.vnIndices.size()) ? model.vnIndices[i] : 0,
+				(i < model.vtIndices.size()) ? model.vtIndices[i] : 0
+			};
+
+		auto chain = meshSimplifier::buildChain(corners, positions, levels + 1);
+
+		std::vector<std::pair<ModelData, float>> result;
+
+		for (size_t level = 1; level < chain.size(); level++) {
+
+			ModelData lod;
+
+			// keep only the attributes the level still uses
+			auto keep = [](auto& remap, const auto& source, auto& destination, unsigned int index) {
+				auto [it, inserted] = remap.try_emplace(index, static_cast<unsigned int>(destination.size()));
+				if (inserted) destination.push_back(source[index]);
+				return it->second;
+			};
+
+			std::unordered_map<unsigned int, unsigned int> vRemap, vnRemap, vtRemap;
+
+			for (unsigned int id : chain[level].indices) {
+				const auto& [v, vn, vt] = triples[id];
+				lod.vIndices.push_back(keep(vRemap, model.vertices, lod.vertices, v));
+				if (!model.normals.empty())   lod.vnIndices.push_back(keep(vnRemap, model.normals, lod.normals, vn));
+				if (!model.texcoords.empty()) lod.vtIndices.push_back(keep(vtRemap, model.texcoords, lod.texcoords, vt));
+			}
+
+			result.push_back({ lod, chain[level].error });
+		}
+
+		return result;
+	}
+};
+
 namespace bezier2 {
 
 	const glm::mat4 M(